@@ -0,0 +1,225 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Biquad engine: cascaded second-order sections on interleaved channels
+ * C and SSE2 versions, CPU dispatch
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "biquad.h"
+#include <avs/cpuid.h>
+
+#ifdef SOXFILTER_X86
+#include <emmintrin.h>
+#endif
+
+// SOX_ROUND_CLIP_COUNT limits
+static const double ROUND_MIN = -2147483648.0 - 0.5;
+static const double ROUND_MAX = 2147483647.0 + 0.5;
+// SOX_SAMPLE_CLIP_COUNT limits, for the truncating gain sections
+static const double SAMPLE_MIN = -2147483648.0;
+static const double SAMPLE_MAX = 2147483647.0;
+
+// ------------------------ C ------------------------------
+
+// The expression and its evaluation order are the ones of lsx_biquad_flow
+static uint64_t biquad_lanes1_c(const biquad_coefs_t* coefs, size_t sections, double* state, size_t stride,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels, size_t first_channel)
+{
+  uint64_t clips = 0;
+  for (size_t s = 0; s < sections; s++) {
+    const biquad_coefs_t& c = coefs[s];
+    double* st = state + s * BIQUAD_STATE_VARS * stride + first_channel;
+    double i1 = st[0], i2 = st[stride], o1 = st[2 * stride], o2 = st[3 * stride];
+    const bool gain_only = biquad_is_gain(c);
+    // the next section works on the output of this one
+    const sample32_t* in = (s == 0 ? src : dst) + first_channel;
+    sample32_t* out = dst + first_channel;
+    for (size_t f = 0; f < frames; f++, in += channels, out += channels) {
+      const double x = (double)*in;
+      double o0;
+      if (gain_only)
+        o0 = x * c.b0;
+      else {
+        o0 = x * c.b0 + i1 * c.b1 + i2 * c.b2 - o1 * c.a1 - o2 * c.a2;
+        i2 = i1;
+        i1 = x;
+        o2 = o1;
+        o1 = o0;
+      }
+      if (c.truncate) {
+        if (o0 > SAMPLE_MAX) {
+          ++clips;
+          *out = 2147483647;
+        }
+        else if (o0 < SAMPLE_MIN) {
+          ++clips;
+          *out = (sample32_t)-2147483647 - 1;
+        }
+        else
+          *out = (sample32_t)o0;
+      }
+      else if (o0 < 0) {
+        if (o0 <= ROUND_MIN) {
+          ++clips;
+          *out = (sample32_t)-2147483647 - 1;
+        }
+        else
+          *out = (sample32_t)(o0 - 0.5);
+      }
+      else {
+        if (o0 >= ROUND_MAX) {
+          ++clips;
+          *out = 2147483647;
+        }
+        else
+          *out = (sample32_t)(o0 + 0.5);
+      }
+    }
+    st[0] = i1; st[stride] = i2; st[2 * stride] = o1; st[3 * stride] = o2;
+  }
+  return clips;
+}
+
+static const biquad_kernels_t biquad_kernels_c = {
+  "C",
+  biquad_lanes1_c,
+  nullptr,
+  nullptr
+};
+
+// ------------------------ SSE2 ------------------------------
+
+#ifdef SOXFILTER_X86
+
+// two channels in the lanes of a vector
+static uint64_t biquad_lanes2_sse2(const biquad_coefs_t* coefs, size_t sections, double* state, size_t stride,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels, size_t first_channel)
+{
+  uint64_t clips = 0;
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d minus_half = _mm_set1_pd(-0.5);
+  const __m128d round_min = _mm_set1_pd(ROUND_MIN);
+  const __m128d round_max = _mm_set1_pd(ROUND_MAX);
+  const __m128d sample_min = _mm_set1_pd(-2147483648.0);
+  const __m128d sample_max = _mm_set1_pd(2147483647.0);
+  for (size_t s = 0; s < sections; s++) {
+    const __m128d b0 = _mm_set1_pd(coefs[s].b0);
+    const __m128d b1 = _mm_set1_pd(coefs[s].b1);
+    const __m128d b2 = _mm_set1_pd(coefs[s].b2);
+    const __m128d a1 = _mm_set1_pd(coefs[s].a1);
+    const __m128d a2 = _mm_set1_pd(coefs[s].a2);
+    double* st = state + s * BIQUAD_STATE_VARS * stride + first_channel;
+    __m128d i1 = _mm_loadu_pd(st);
+    __m128d i2 = _mm_loadu_pd(st + stride);
+    __m128d o1 = _mm_loadu_pd(st + 2 * stride);
+    __m128d o2 = _mm_loadu_pd(st + 3 * stride);
+    const bool gain_only = biquad_is_gain(coefs[s]);
+    const bool truncate = coefs[s].truncate;
+    // the next section works on the output of this one
+    const sample32_t* in = (s == 0 ? src : dst) + first_channel;
+    sample32_t* out = dst + first_channel;
+    for (size_t f = 0; f < frames; f++, in += channels, out += channels) {
+      const __m128d x = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in)));
+      __m128d o0 = _mm_mul_pd(x, b0);
+      if (!gain_only) {
+        o0 = _mm_add_pd(o0, _mm_mul_pd(i1, b1));
+        o0 = _mm_add_pd(o0, _mm_mul_pd(i2, b2));
+        o0 = _mm_sub_pd(o0, _mm_mul_pd(o1, a1));
+        o0 = _mm_sub_pd(o0, _mm_mul_pd(o2, a2));
+        i2 = i1;
+        i1 = x;
+        o2 = o1;
+        o1 = o0;
+      }
+      // -0.5 below zero, +0.5 otherwise, then truncate; saturated outside of the 32 bit range
+      __m128d rounded = o0;
+      int mask;
+      if (truncate)
+        mask = _mm_movemask_pd(_mm_or_pd(_mm_cmplt_pd(o0, sample_min), _mm_cmpgt_pd(o0, sample_max)));
+      else {
+        const __m128d negative = _mm_cmplt_pd(o0, zero);
+        rounded = _mm_add_pd(o0, _mm_or_pd(_mm_and_pd(negative, minus_half), _mm_andnot_pd(negative, half)));
+        mask = _mm_movemask_pd(_mm_or_pd(_mm_cmple_pd(o0, round_min), _mm_cmpge_pd(o0, round_max)));
+      }
+      if (mask)
+        clips += (mask & 1) + (mask >> 1);
+      const __m128i r = _mm_cvttpd_epi32(_mm_min_pd(_mm_max_pd(rounded, sample_min), sample_max));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out), r);
+    }
+    _mm_storeu_pd(st, i1);
+    _mm_storeu_pd(st + stride, i2);
+    _mm_storeu_pd(st + 2 * stride, o1);
+    _mm_storeu_pd(st + 3 * stride, o2);
+  }
+  return clips;
+}
+
+static const biquad_kernels_t biquad_kernels_sse2 = {
+  "SSE2",
+  biquad_lanes1_c,
+  biquad_lanes2_sse2,
+  nullptr
+};
+
+static const biquad_kernels_t biquad_kernels_avx2 = {
+  "AVX2",
+  biquad_lanes1_c,
+  biquad_lanes2_sse2,
+  biquad_lanes4_avx2
+};
+
+#endif // SOXFILTER_X86
+
+// ------------------------ dispatch ------------------------------
+
+const biquad_kernels_t* get_biquad_kernels_isa(biquad_isa_t isa)
+{
+  switch (isa) {
+  case BIQUAD_C:
+    return &biquad_kernels_c;
+#ifdef SOXFILTER_X86
+  case BIQUAD_SSE2:
+    return &biquad_kernels_sse2;
+  case BIQUAD_AVX2:
+    return &biquad_kernels_avx2;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const biquad_kernels_t* get_biquad_kernels(int cpu_flags)
+{
+#ifdef SOXFILTER_X86
+  if (cpu_flags & CPUF_AVX2)
+    return &biquad_kernels_avx2;
+  if (cpu_flags & CPUF_SSE2)
+    return &biquad_kernels_sse2;
+#else
+  (void)cpu_flags;
+#endif
+  return &biquad_kernels_c;
+}
+
+uint64_t biquad_process(const biquad_kernels_t* kernels, const biquad_coefs_t* coefs, size_t sections, double* state,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels)
+{
+  const size_t stride = biquad_stride(channels);
+  uint64_t clips = 0;
+  size_t c = 0;
+  if (kernels->lanes4)
+    for (; c + 4 <= channels; c += 4)
+      clips += kernels->lanes4(coefs, sections, state, stride, src, dst, frames, channels, c);
+  if (kernels->lanes2)
+    for (; c + 2 <= channels; c += 2)
+      clips += kernels->lanes2(coefs, sections, state, stride, src, dst, frames, channels, c);
+  for (; c < channels; c++)
+    clips += kernels->lanes1(coefs, sections, state, stride, src, dst, frames, channels, c);
+  return clips;
+}
@@ -0,0 +1,88 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Biquad engine: cascaded second-order sections on interleaved channels
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_BIQUAD_H__
+#define __SOXFILTER_BIQUAD_H__
+
+#include "convert.h" // sample32_t, SOXFILTER_X86
+
+// One second-order section, normalized like libsox' lsx_biquad_start does (a0 = 1)
+typedef struct biquad_coefs_t {
+  double b0, b1, b2;
+  double a1, a2;
+  bool truncate; // a gain section of vol, see biquad_is_gain
+} biquad_coefs_t;
+
+// Filter memory of a cascade, per section and channel:
+// state[(section * BIQUAD_STATE_VARS + var) * stride + channel]
+// var: 0 = i1, 1 = i2 (previous inputs), 2 = o1, 3 = o2 (previous outputs)
+// The stride is the channel count rounded up to the widest vector.
+constexpr size_t BIQUAD_STATE_VARS = 4;
+constexpr size_t BIQUAD_MAX_LANES = 4;
+
+inline size_t biquad_stride(size_t channels)
+{
+  return (channels + BIQUAD_MAX_LANES - 1) / BIQUAD_MAX_LANES * BIQUAD_MAX_LANES;
+}
+
+inline size_t biquad_state_size(size_t sections, size_t channels)
+{
+  return sections * BIQUAD_STATE_VARS * biquad_stride(channels);
+}
+
+// A section with b0 only is a plain gain (vol, gain): y = x * b0, clipped and rounded like
+// gain's flow does, or with 'truncate' clipped and truncated like vol's flow does
+// (SOX_SAMPLE_CLIP_COUNT, then the conversion to integer).
+// The kernels skip its (unused) filter memory, the result is the same.
+inline bool biquad_is_gain(const biquad_coefs_t& c)
+{
+  return c.b1 == 0.0 && c.b2 == 0.0 && c.a1 == 0.0 && c.a2 == 0.0;
+}
+
+// Runs frames of channels [first_channel, first_channel + lanes) of interleaved audio through
+// the cascade, returns the number of clipped samples.
+// Each section gives exactly what libsox' lsx_biquad_flow would: computed in double,
+// rounded and clipped to 32 bit like SOX_ROUND_CLIP_COUNT, fed to the next section,
+// so a cascade is bit-exact with the chain of the separate libsox effects, gain sections
+// included (see biquad_is_gain). The clip counts are the ones of libsox as well.
+typedef uint64_t (*biquad_lanes_fn)(const biquad_coefs_t* coefs, size_t sections, double* state, size_t stride,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels, size_t first_channel);
+
+typedef struct biquad_kernels_t {
+  const char* name;
+  biquad_lanes_fn lanes1;
+  biquad_lanes_fn lanes2; // nullptr if not available
+  biquad_lanes_fn lanes4; // nullptr if not available
+} biquad_kernels_t;
+
+enum biquad_isa_t {
+  BIQUAD_C,
+  BIQUAD_SSE2,
+  BIQUAD_AVX2
+};
+
+// The fastest one for the CPU, cpu_flags are the CPUF_* flags of avs/cpuid.h
+const biquad_kernels_t* get_biquad_kernels(int cpu_flags);
+
+// A given implementation, nullptr if it is not compiled in (e.g. for benchmarking)
+const biquad_kernels_t* get_biquad_kernels_isa(biquad_isa_t isa);
+
+// All channels of interleaved src into dst (may be the same buffer), widest vectors first
+uint64_t biquad_process(const biquad_kernels_t* kernels, const biquad_coefs_t* coefs, size_t sections, double* state,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels);
+
+#ifdef SOXFILTER_X86
+// biquad_avx2.cpp, compiled with AVX2 enabled
+uint64_t biquad_lanes4_avx2(const biquad_coefs_t* coefs, size_t sections, double* state, size_t stride,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels, size_t first_channel);
+#endif
+
+#endif // __SOXFILTER_BIQUAD_H__
@@ -0,0 +1,85 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Biquad engine: cascaded second-order sections on interleaved channels
+ * AVX2 version, this file is compiled with AVX2 enabled
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "biquad.h"
+
+#ifdef SOXFILTER_X86
+
+#include <immintrin.h>
+
+// four channels in the lanes of a vector, see biquad_lanes1_c.
+// No FMA: the products are rounded separately, like in libsox.
+uint64_t biquad_lanes4_avx2(const biquad_coefs_t* coefs, size_t sections, double* state, size_t stride,
+  const sample32_t* src, sample32_t* dst, size_t frames, size_t channels, size_t first_channel)
+{
+  uint64_t clips = 0;
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d minus_half = _mm256_set1_pd(-0.5);
+  const __m256d round_min = _mm256_set1_pd(-2147483648.0 - 0.5);
+  const __m256d round_max = _mm256_set1_pd(2147483647.0 + 0.5);
+  const __m256d sample_min = _mm256_set1_pd(-2147483648.0);
+  const __m256d sample_max = _mm256_set1_pd(2147483647.0);
+  for (size_t s = 0; s < sections; s++) {
+    const __m256d b0 = _mm256_set1_pd(coefs[s].b0);
+    const __m256d b1 = _mm256_set1_pd(coefs[s].b1);
+    const __m256d b2 = _mm256_set1_pd(coefs[s].b2);
+    const __m256d a1 = _mm256_set1_pd(coefs[s].a1);
+    const __m256d a2 = _mm256_set1_pd(coefs[s].a2);
+    double* st = state + s * BIQUAD_STATE_VARS * stride + first_channel;
+    __m256d i1 = _mm256_loadu_pd(st);
+    __m256d i2 = _mm256_loadu_pd(st + stride);
+    __m256d o1 = _mm256_loadu_pd(st + 2 * stride);
+    __m256d o2 = _mm256_loadu_pd(st + 3 * stride);
+    const bool gain_only = biquad_is_gain(coefs[s]);
+    const bool truncate = coefs[s].truncate;
+    // the next section works on the output of this one
+    const sample32_t* in = (s == 0 ? src : dst) + first_channel;
+    sample32_t* out = dst + first_channel;
+    for (size_t f = 0; f < frames; f++, in += channels, out += channels) {
+      const __m256d x = _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+      __m256d o0 = _mm256_mul_pd(x, b0);
+      if (!gain_only) {
+        o0 = _mm256_add_pd(o0, _mm256_mul_pd(i1, b1));
+        o0 = _mm256_add_pd(o0, _mm256_mul_pd(i2, b2));
+        o0 = _mm256_sub_pd(o0, _mm256_mul_pd(o1, a1));
+        o0 = _mm256_sub_pd(o0, _mm256_mul_pd(o2, a2));
+        i2 = i1;
+        i1 = x;
+        o2 = o1;
+        o1 = o0;
+      }
+      // -0.5 below zero, +0.5 otherwise, then truncate; saturated outside of the 32 bit range
+      __m256d rounded = o0;
+      __m256d clipped;
+      if (truncate)
+        clipped = _mm256_or_pd(_mm256_cmp_pd(o0, sample_min, _CMP_LT_OQ), _mm256_cmp_pd(o0, sample_max, _CMP_GT_OQ));
+      else {
+        const __m256d negative = _mm256_cmp_pd(o0, zero, _CMP_LT_OQ);
+        rounded = _mm256_add_pd(o0, _mm256_blendv_pd(half, minus_half, negative));
+        clipped = _mm256_or_pd(_mm256_cmp_pd(o0, round_min, _CMP_LE_OQ), _mm256_cmp_pd(o0, round_max, _CMP_GE_OQ));
+      }
+      const int mask = _mm256_movemask_pd(clipped);
+      if (mask)
+        clips += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+      const __m128i r = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(rounded, sample_min), sample_max));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), r);
+    }
+    _mm256_storeu_pd(st, i1);
+    _mm256_storeu_pd(st + stride, i2);
+    _mm256_storeu_pd(st + 2 * stride, o1);
+    _mm256_storeu_pd(st + 3 * stride, o2);
+  }
+  return clips;
+}
+
+#endif // SOXFILTER_X86
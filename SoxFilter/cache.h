@@ -0,0 +1,114 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Bounded, thread-safe cache of immutable shared objects
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_CACHE_H__
+#define __SOXFILTER_CACHE_H__
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+// Maps string keys to shared_ptr<const T>, least recently used entries are dropped when
+// the size of all entries (given at insert, e.g. bytes) would exceed the capacity.
+// A dropped entry stays alive as long as someone holds it.
+template<typename T>
+class SharedCache {
+public:
+  typedef struct stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+    size_t size;
+  } stats_t;
+
+private:
+  typedef struct entry_t {
+    std::string key;
+    std::shared_ptr<const T> value;
+    size_t size;
+  } entry_t;
+
+  const size_t capacity;
+  std::list<entry_t> lru; // most recently used first
+  std::unordered_map<std::string, typename std::list<entry_t>::iterator> index;
+  size_t total_size;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  std::mutex mutex;
+
+public:
+  explicit SharedCache(size_t _capacity) : capacity(_capacity), total_size(0), hits(0), misses(0), evictions(0) {}
+  SharedCache(const SharedCache&) = delete;
+  SharedCache& operator=(const SharedCache&) = delete;
+
+  // nullptr if not cached; counted as a hit or a miss
+  std::shared_ptr<const T> find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->value;
+  }
+
+  // Replaces an entry of the same key (made concurrently after the same miss).
+  // An entry larger than the capacity is not cached.
+  void insert(const std::string& key, std::shared_ptr<const T> value, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it != index.end()) {
+      total_size -= it->second->size;
+      lru.erase(it->second);
+      index.erase(it);
+    }
+    if (size > capacity)
+      return;
+    while (total_size + size > capacity) {
+      total_size -= lru.back().size;
+      index.erase(lru.back().key);
+      lru.pop_back();
+      evictions++;
+    }
+    lru.push_front(entry_t{ key, value, size });
+    index[key] = lru.begin();
+    total_size += size;
+  }
+
+  // Drops the entries whose value satisfies pred
+  template<typename P>
+  void erase_if(P pred) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = lru.begin(); it != lru.end();) {
+      if (pred(*it->value)) {
+        total_size -= it->size;
+        index.erase(it->key);
+        it = lru.erase(it);
+      }
+      else
+        ++it;
+    }
+  }
+
+  stats_t stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats_t{ hits, misses, evictions, index.size(), total_size };
+  }
+};
+
+#endif // __SOXFILTER_CACHE_H__
@@ -0,0 +1,210 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Sample format conversion between Avisynth audio and sox_sample_t
+ * C and SSE2 versions, CPU dispatch
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convert.h"
+#include <avs/cpuid.h>
+
+#ifdef SOXFILTER_X86
+#include <emmintrin.h>
+#endif
+
+static const float SCALE_TO_SAMPLE = 2147483648.0f; // 2^31
+static const float SCALE_TO_FLOAT = 1.0f / 2147483648.0f;
+
+// ------------------------ C ------------------------------
+
+static uint64_t int16_to_sample_c(const void* src, sample32_t* dst, size_t count)
+{
+  const int16_t* s = reinterpret_cast<const int16_t*>(src);
+  for (size_t i = 0; i < count; i++)
+    dst[i] = (sample32_t)((uint32_t)(uint16_t)s[i] << 16);
+  return 0;
+}
+
+static uint64_t int24_to_sample_c(const void* src, sample32_t* dst, size_t count)
+{
+  const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+  for (size_t i = 0; i < count; i++, s += 3)
+    dst[i] = (sample32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24));
+  return 0;
+}
+
+static inline sample32_t float_to_sample_1(float f, uint64_t& clips)
+{
+  const float v = f * SCALE_TO_SAMPLE;
+  if (v < -SCALE_TO_SAMPLE) {
+    ++clips;
+    return INT32_MIN;
+  }
+  if (v >= SCALE_TO_SAMPLE) {
+    if (v > SCALE_TO_SAMPLE)
+      ++clips;
+    return INT32_MAX;
+  }
+  return (sample32_t)v;
+}
+
+static uint64_t float_to_sample_c(const void* src, sample32_t* dst, size_t count)
+{
+  const float* s = reinterpret_cast<const float*>(src);
+  uint64_t clips = 0;
+  for (size_t i = 0; i < count; i++)
+    dst[i] = float_to_sample_1(s[i], clips);
+  return clips;
+}
+
+static void sample_to_float_c(const sample32_t* src, void* dst, size_t count)
+{
+  float* d = reinterpret_cast<float*>(dst);
+  for (size_t i = 0; i < count; i++)
+    d[i] = (float)src[i] * SCALE_TO_FLOAT;
+}
+
+static const sample_converters_t converters_c = {
+  "C",
+  int16_to_sample_c,
+  int24_to_sample_c,
+  float_to_sample_c,
+  sample_to_float_c
+};
+
+// ------------------------ SSE2 ------------------------------
+
+#ifdef SOXFILTER_X86
+
+static uint64_t int16_to_sample_sse2(const void* src, sample32_t* dst, size_t count)
+{
+  const int16_t* s = reinterpret_cast<const int16_t*>(src);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    // the 16 bit sample becomes the upper half
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(zero, v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(zero, v));
+  }
+  int16_to_sample_c(s + i, dst + i, count - i);
+  return 0;
+}
+
+static uint64_t float_to_sample_sse2(const void* src, sample32_t* dst, size_t count)
+{
+  const float* s = reinterpret_cast<const float*>(src);
+  uint64_t clips = 0;
+  size_t i = 0;
+  const __m128 scale = _mm_set1_ps(SCALE_TO_SAMPLE);
+  const __m128 lower = _mm_set1_ps(-SCALE_TO_SAMPLE);
+  for (; i + 4 <= count; i += 4) {
+    const __m128 v = _mm_mul_ps(_mm_loadu_ps(s + i), scale);
+    const __m128 over = _mm_cmpge_ps(v, scale);
+    const __m128 clipped = _mm_or_ps(_mm_cmpgt_ps(v, scale), _mm_cmplt_ps(v, lower));
+    // out of range gives 0x80000000, that is right for the negative side,
+    // flipping all bits makes it 0x7FFFFFFF for the positive one
+    __m128i r = _mm_cvttps_epi32(v);
+    r = _mm_xor_si128(r, _mm_castps_si128(over));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), r);
+    const int mask = _mm_movemask_ps(clipped);
+    if (mask)
+      clips += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+  }
+  return clips + float_to_sample_c(s + i, dst + i, count - i);
+}
+
+static void sample_to_float_sse2(const sample32_t* src, void* dst, size_t count)
+{
+  float* d = reinterpret_cast<float*>(dst);
+  const __m128 scale = _mm_set1_ps(SCALE_TO_FLOAT);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+  }
+  sample_to_float_c(src + i, d + i, count - i);
+}
+
+// 24 bit needs byte shuffles (SSSE3), the AVX2 version has them
+static const sample_converters_t converters_sse2 = {
+  "SSE2",
+  int16_to_sample_sse2,
+  int24_to_sample_c,
+  float_to_sample_sse2,
+  sample_to_float_sse2
+};
+
+#endif // SOXFILTER_X86
+
+// ------------------------ dispatch ------------------------------
+
+const sample_converters_t* get_sample_converters_isa(converter_isa_t isa)
+{
+  switch (isa) {
+  case CONVERT_C:
+    return &converters_c;
+#ifdef SOXFILTER_X86
+  case CONVERT_SSE2:
+    return &converters_sse2;
+  case CONVERT_AVX2:
+    return &converters_avx2;
+  case CONVERT_AVX512:
+    return &converters_avx512;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+// Each conversion takes its own instruction set, from convert_bench (Msamples/s, 7.1 audio,
+// median of 9 runs on an AVX-512 CPU; 16 bit and sample_to_float are bound by memory bandwidth):
+//                    C     SSE2   AVX2   AVX-512
+//   int16_to_sample  2485  4152   3761   3978     SSE2
+//   int24_to_sample   688   692   2946   2849     AVX2
+//   float_to_sample   328   463    650   2248     AVX-512
+//   sample_to_float  2593  2506   2543   2629     C (vectorized by the compiler)
+// An instruction set the CPU lacks falls back to the next narrower one.
+const sample_converters_t* get_sample_converters(int cpu_flags)
+{
+#ifdef SOXFILTER_X86
+  const bool avx512 = (cpu_flags & (CPUF_AVX512F | CPUF_AVX512BW)) == (CPUF_AVX512F | CPUF_AVX512BW);
+  const bool avx2 = (cpu_flags & CPUF_AVX2) != 0;
+  if (!(cpu_flags & CPUF_SSE2))
+    return &converters_c;
+  static const sample_converters_t converters_avx512_cpu = {
+    "SSE2/AVX2/AVX-512/C",
+    converters_sse2.int16_to_sample,
+    converters_avx2.int24_to_sample,
+    converters_avx512.float_to_sample,
+    converters_c.sample_to_float
+  };
+  static const sample_converters_t converters_avx2_cpu = {
+    "SSE2/AVX2/C",
+    converters_sse2.int16_to_sample,
+    converters_avx2.int24_to_sample,
+    converters_avx2.float_to_sample,
+    converters_c.sample_to_float
+  };
+  static const sample_converters_t converters_sse2_cpu = {
+    "SSE2/C",
+    converters_sse2.int16_to_sample,
+    converters_sse2.int24_to_sample,
+    converters_sse2.float_to_sample,
+    converters_c.sample_to_float
+  };
+  if (avx512)
+    return &converters_avx512_cpu;
+  if (avx2)
+    return &converters_avx2_cpu;
+  return &converters_sse2_cpu;
+#else
+  (void)cpu_flags;
+  return &converters_c;
+#endif
+}
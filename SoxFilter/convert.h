@@ -0,0 +1,65 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Sample format conversion between Avisynth audio and sox_sample_t
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_CONVERT_H__
+#define __SOXFILTER_CONVERT_H__
+
+#include <cstddef>
+#include <cstdint>
+
+// x86 with SSE2 enabled at compile time: x64, or 32 bit x86 built for SSE2 (/arch:SSE2, -msse2).
+// The SSE2 kernels are compiled without a CPU check, the AVX2/AVX-512 ones are dispatched.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || \
+  ((defined(_M_IX86) || defined(__i386__)) && defined(__SSE2__))
+#define SOXFILTER_X86
+#endif
+
+// sox_sample_t without including sox.h
+typedef int32_t sample32_t;
+
+// Converts count samples to 32 bit, returns the number of clipped samples
+typedef uint64_t (*to_sample_fn)(const void* src, sample32_t* dst, size_t count);
+// Converts count 32 bit samples to the target format
+typedef void (*from_sample_fn)(const sample32_t* src, void* dst, size_t count);
+
+// Integer input is shifted to the top of the 32 bit sample, it is lossless.
+// float -> 32 bit is the way of libsox' SOX_FLOAT_32BIT_TO_SAMPLE: scaled by 2^31
+// and truncated, saturated outside of [-1.0, 1.0] (1.0 itself is not counted as clipped).
+// 32 bit -> float is scaled by 2^-31, like Avisynth's ConvertAudio.
+typedef struct sample_converters_t {
+  const char* name;
+  to_sample_fn int16_to_sample;
+  to_sample_fn int24_to_sample;
+  to_sample_fn float_to_sample;
+  from_sample_fn sample_to_float;
+} sample_converters_t;
+
+enum converter_isa_t {
+  CONVERT_C,
+  CONVERT_SSE2,
+  CONVERT_AVX2,
+  CONVERT_AVX512
+};
+
+// The fastest one of each conversion for the CPU (see get_sample_converters),
+// cpu_flags are the CPUF_* flags of avs/cpuid.h
+const sample_converters_t* get_sample_converters(int cpu_flags);
+
+// A given implementation, nullptr if it is not compiled in (e.g. for benchmarking)
+const sample_converters_t* get_sample_converters_isa(converter_isa_t isa);
+
+#ifdef SOXFILTER_X86
+// convert_avx2.cpp and convert_avx512.cpp, compiled with the instruction set enabled
+extern const sample_converters_t converters_avx2;
+extern const sample_converters_t converters_avx512;
+#endif
+
+#endif // __SOXFILTER_CONVERT_H__
@@ -0,0 +1,103 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Sample format conversion between Avisynth audio and sox_sample_t
+ * AVX2 versions, this file is compiled with AVX2 enabled
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convert.h"
+
+#ifdef SOXFILTER_X86
+
+#include <immintrin.h>
+
+static const float SCALE_TO_SAMPLE = 2147483648.0f; // 2^31
+static const float SCALE_TO_FLOAT = 1.0f / 2147483648.0f;
+
+// the rest, less than a vector, is done by the C version
+static const sample_converters_t& tail()
+{
+  return *get_sample_converters_isa(CONVERT_C);
+}
+
+static uint64_t int16_to_sample_avx2(const void* src, sample32_t* dst, size_t count)
+{
+  const int16_t* s = reinterpret_cast<const int16_t*>(src);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_slli_epi32(v, 16));
+  }
+  tail().int16_to_sample(s + i, dst + i, count - i);
+  return 0;
+}
+
+static uint64_t int24_to_sample_avx2(const void* src, sample32_t* dst, size_t count)
+{
+  const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+  // 4 x 3 bytes into the upper 3 bytes of 4 x 32 bit, in both 128 bit lanes
+  const __m256i shuffle = _mm256_setr_epi8(
+    -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+    -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  size_t i = 0;
+  // the upper lane is loaded from the 12th byte: 28 bytes are read for 8 samples
+  for (; i + 10 <= count; i += 8) {
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 3));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i * 3 + 12));
+    const __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v, shuffle));
+  }
+  tail().int24_to_sample(s + i * 3, dst + i, count - i);
+  return 0;
+}
+
+static uint64_t float_to_sample_avx2(const void* src, sample32_t* dst, size_t count)
+{
+  const float* s = reinterpret_cast<const float*>(src);
+  uint64_t clips = 0;
+  const __m256 scale = _mm256_set1_ps(SCALE_TO_SAMPLE);
+  const __m256 lower = _mm256_set1_ps(-SCALE_TO_SAMPLE);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 v = _mm256_mul_ps(_mm256_loadu_ps(s + i), scale);
+    const __m256 over = _mm256_cmp_ps(v, scale, _CMP_GE_OQ);
+    const __m256 clipped = _mm256_or_ps(_mm256_cmp_ps(v, scale, _CMP_GT_OQ), _mm256_cmp_ps(v, lower, _CMP_LT_OQ));
+    // see the SSE2 version
+    __m256i r = _mm256_cvttps_epi32(v);
+    r = _mm256_xor_si256(r, _mm256_castps_si256(over));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+    unsigned mask = (unsigned)_mm256_movemask_ps(clipped);
+    while (mask) {
+      mask &= mask - 1;
+      clips++;
+    }
+  }
+  return clips + tail().float_to_sample(s + i, dst + i, count - i);
+}
+
+static void sample_to_float_avx2(const sample32_t* src, void* dst, size_t count)
+{
+  float* d = reinterpret_cast<float*>(dst);
+  const __m256 scale = _mm256_set1_ps(SCALE_TO_FLOAT);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+  }
+  tail().sample_to_float(src + i, d + i, count - i);
+}
+
+extern const sample_converters_t converters_avx2 = {
+  "AVX2",
+  int16_to_sample_avx2,
+  int24_to_sample_avx2,
+  float_to_sample_avx2,
+  sample_to_float_avx2
+};
+
+#endif // SOXFILTER_X86
@@ -0,0 +1,114 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Sample format conversion between Avisynth audio and sox_sample_t
+ * AVX-512 (F, BW) versions, this file is compiled with AVX-512 enabled
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convert.h"
+
+#ifdef SOXFILTER_X86
+
+// GCC 12 warns about the _mm512_undefined_* pass-through operands of the unmasked intrinsics
+// when they are inlined (GCC bug 105593), the header is included without those warnings
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+static const float SCALE_TO_SAMPLE = 2147483648.0f; // 2^31
+static const float SCALE_TO_FLOAT = 1.0f / 2147483648.0f;
+
+// the rest, less than a vector, is done by the AVX2 version
+static const sample_converters_t& tail()
+{
+  return converters_avx2;
+}
+
+static uint64_t int16_to_sample_avx512(const void* src, sample32_t* dst, size_t count)
+{
+  const int16_t* s = reinterpret_cast<const int16_t*>(src);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)));
+    _mm512_storeu_si512(dst + i, _mm512_slli_epi32(v, 16));
+  }
+  tail().int16_to_sample(s + i, dst + i, count - i);
+  return 0;
+}
+
+static uint64_t int24_to_sample_avx512(const void* src, sample32_t* dst, size_t count)
+{
+  const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+  // 4 x 3 bytes into the upper 3 bytes of 4 x 32 bit, in each 128 bit lane
+  const __m512i shuffle = _mm512_broadcast_i32x4(_mm_setr_epi8(
+    -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11));
+  size_t i = 0;
+  // lane n is loaded from the 12*n-th byte: 52 bytes are read for 16 samples
+  for (; i + 18 <= count; i += 16) {
+    const uint8_t* p = s + i * 3;
+    __m512i v = _mm512_castsi128_si512(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), 1);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 24)), 2);
+    v = _mm512_inserti32x4(v, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 36)), 3);
+    _mm512_storeu_si512(dst + i, _mm512_shuffle_epi8(v, shuffle));
+  }
+  tail().int24_to_sample(s + i * 3, dst + i, count - i);
+  return 0;
+}
+
+static uint64_t float_to_sample_avx512(const void* src, sample32_t* dst, size_t count)
+{
+  const float* s = reinterpret_cast<const float*>(src);
+  uint64_t clips = 0;
+  const __m512 scale = _mm512_set1_ps(SCALE_TO_SAMPLE);
+  const __m512 lower = _mm512_set1_ps(-SCALE_TO_SAMPLE);
+  const __m512i max = _mm512_set1_epi32(INT32_MAX);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512 v = _mm512_mul_ps(_mm512_loadu_ps(s + i), scale);
+    const __mmask16 over = _mm512_cmp_ps_mask(v, scale, _CMP_GE_OQ);
+    unsigned clipped = (unsigned)(_mm512_cmp_ps_mask(v, scale, _CMP_GT_OQ) | _mm512_cmp_ps_mask(v, lower, _CMP_LT_OQ));
+    // out of range gives 0x80000000, that is right for the negative side
+    __m512i r = _mm512_cvttps_epi32(v);
+    r = _mm512_mask_mov_epi32(r, over, max);
+    _mm512_storeu_si512(dst + i, r);
+    while (clipped) {
+      clipped &= clipped - 1;
+      clips++;
+    }
+  }
+  return clips + tail().float_to_sample(s + i, dst + i, count - i);
+}
+
+static void sample_to_float_avx512(const sample32_t* src, void* dst, size_t count)
+{
+  float* d = reinterpret_cast<float*>(dst);
+  const __m512 scale = _mm512_set1_ps(SCALE_TO_FLOAT);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m512i v = _mm512_loadu_si512(src + i);
+    _mm512_storeu_ps(d + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+  }
+  tail().sample_to_float(src + i, d + i, count - i);
+}
+
+extern const sample_converters_t converters_avx512 = {
+  "AVX-512",
+  int16_to_sample_avx512,
+  int24_to_sample_avx512,
+  float_to_sample_avx512,
+  sample_to_float_avx512
+};
+
+#endif // SOXFILTER_X86
@@ -0,0 +1,291 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Uniformly partitioned FFT convolution (overlap-save) for long FIR filters
+ * C version of the spectrum multiply-accumulate, CPU dispatch, convolver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convolver.h"
+#include <avs/cpuid.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+// ------------------------ C ------------------------------
+
+static void cmac_c(const float* xr, const float* xi, const float* hr, const float* hi, float* yr, float* yi, size_t n)
+{
+  for (size_t k = 0; k < n; k++) {
+    yr[k] += xr[k] * hr[k] - xi[k] * hi[k];
+    yi[k] += xr[k] * hi[k] + xi[k] * hr[k];
+  }
+}
+
+static const conv_kernels_t conv_kernels_c = {
+  "C",
+  cmac_c
+};
+
+#ifdef SOXFILTER_X86
+static const conv_kernels_t conv_kernels_avx2 = {
+  "AVX2",
+  cmac_avx2
+};
+#endif
+
+// ------------------------ dispatch ------------------------------
+
+const conv_kernels_t* get_conv_kernels_isa(conv_isa_t isa)
+{
+  switch (isa) {
+  case CONV_C:
+    return &conv_kernels_c;
+#ifdef SOXFILTER_X86
+  case CONV_AVX2:
+    return &conv_kernels_avx2;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const conv_kernels_t* get_conv_kernels(int cpu_flags)
+{
+#ifdef SOXFILTER_X86
+  if (cpu_flags & CPUF_AVX2)
+    return &conv_kernels_avx2;
+#else
+  (void)cpu_flags;
+#endif
+  return &conv_kernels_c;
+}
+
+// ------------------------ filter ------------------------------
+
+// FFT plans (bit reversal and twiddle tables) are shared by all filters of the same
+// partition size in the process, while any of them is alive
+static std::shared_ptr<const FFT<float>> get_fft_plan(size_t n)
+{
+  static std::mutex mutex;
+  static std::map<size_t, std::weak_ptr<const FFT<float>>> plans;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<const FFT<float>> plan = plans[n].lock();
+  if (!plan) {
+    plan = std::make_shared<const FFT<float>>(n);
+    plans[n] = plan;
+  }
+  return plan;
+}
+
+std::shared_ptr<const conv_filter_t> make_conv_filter(const double* h, size_t taps, size_t partition)
+{
+  if (!partition) {
+    // a quarter of the filter: 4 partitions are few multiply-accumulates per block,
+    // while the FFTs stay small enough for the cache
+    partition = 64;
+    while (partition < 4096 && partition * 4 < taps)
+      partition *= 2;
+  }
+  const size_t n = 2 * partition;
+  auto filter = std::make_shared<conv_filter_t>();
+  filter->taps = taps;
+  filter->partition = partition;
+  filter->partitions = (taps + partition - 1) / partition;
+  filter->fft = get_fft_plan(n);
+  filter->h_re.resize(filter->partitions * n);
+  filter->h_im.resize(filter->partitions * n);
+
+  // the spectra are made in double, the audio is processed in float.
+  // They are in the bit-reversed order of the scrambled transforms, like the ones of the input.
+  const FFT<double> fft(n);
+  std::vector<double> re(n), im(n);
+  for (size_t p = 0; p < filter->partitions; p++) {
+    std::fill(re.begin(), re.end(), 0.0);
+    std::fill(im.begin(), im.end(), 0.0);
+    for (size_t i = 0; i < partition && p * partition + i < taps; i++)
+      re[i] = h[p * partition + i] / (double)n;
+    fft.forward_scrambled(re.data(), im.data());
+    std::copy(re.begin(), re.end(), filter->h_re.begin() + p * n);
+    std::copy(im.begin(), im.end(), filter->h_im.begin() + p * n);
+  }
+  return filter;
+}
+
+// ------------------------ convolver ------------------------------
+
+PartitionedConvolver::PartitionedConvolver(std::shared_ptr<const conv_filter_t> _filter, size_t _channels, size_t _delay, const conv_kernels_t* _kernels) :
+  filter(_filter), kernels(_kernels), channels(_channels), delay(_delay), pairs((_channels + 1) / 2)
+{
+  const size_t n = 2 * filter->partition;
+  for (auto& pair : pairs) {
+    pair.in_re.resize(n);
+    pair.in_im.resize(n);
+    pair.fdl_re.resize(filter->partitions * n);
+    pair.fdl_im.resize(filter->partitions * n);
+    pair.y_re.resize(n);
+    pair.y_im.resize(n);
+  }
+  reset();
+}
+
+void PartitionedConvolver::reset()
+{
+  for (auto& pair : pairs) {
+    std::fill(pair.in_re.begin(), pair.in_re.end(), 0.0f);
+    std::fill(pair.in_im.begin(), pair.in_im.end(), 0.0f);
+    std::fill(pair.fdl_re.begin(), pair.fdl_re.end(), 0.0f);
+    std::fill(pair.fdl_im.begin(), pair.fdl_im.end(), 0.0f);
+  }
+  fill = 0;
+  block = 0;
+  out.clear();
+  out_begin = 0;
+  frames_in = 0;
+  frames_produced = 0;
+  frames_skipped = 0;
+}
+
+// The input block goes into the delay line, its spectrum and the ones of the previous blocks
+// are multiplied with the filter partitions, the second half of the inverse is the output.
+void PartitionedConvolver::process_pair(size_t p, size_t out_frame)
+{
+  pair_state_t& pair = pairs[p];
+  const conv_filter_t& f = *filter;
+  const size_t b = f.partition;
+  const size_t n = 2 * b;
+  const size_t slot = block % f.partitions;
+
+  float* xr = &pair.fdl_re[slot * n];
+  float* xi = &pair.fdl_im[slot * n];
+  std::copy(pair.in_re.begin(), pair.in_re.end(), xr);
+  std::copy(pair.in_im.begin(), pair.in_im.end(), xi);
+  f.fft->forward_scrambled(xr, xi);
+  std::copy(pair.in_re.begin() + b, pair.in_re.end(), pair.in_re.begin());
+  std::copy(pair.in_im.begin() + b, pair.in_im.end(), pair.in_im.begin());
+
+  std::fill(pair.y_re.begin(), pair.y_re.end(), 0.0f);
+  std::fill(pair.y_im.begin(), pair.y_im.end(), 0.0f);
+  for (size_t i = 0; i < f.partitions; i++) {
+    const size_t s = (slot + f.partitions - i) % f.partitions;
+    kernels->cmac(&pair.fdl_re[s * n], &pair.fdl_im[s * n], &f.h_re[i * n], &f.h_im[i * n],
+      pair.y_re.data(), pair.y_im.data(), n);
+  }
+  f.fft->inverse_scrambled_unscaled(pair.y_re.data(), pair.y_im.data());
+
+  const size_t ch = 2 * p;
+  float* dst = &out[out_frame * channels + ch];
+  if (ch + 1 < channels) {
+    for (size_t i = 0; i < b; i++, dst += channels) {
+      dst[0] = pair.y_re[b + i];
+      dst[1] = pair.y_im[b + i];
+    }
+  }
+  else {
+    for (size_t i = 0; i < b; i++, dst += channels)
+      dst[0] = pair.y_re[b + i];
+  }
+}
+
+void PartitionedConvolver::process_block(ThreadPool* pool)
+{
+  const size_t b = filter->partition;
+  // the output of the first 'delay' frames is dropped
+  const size_t skip = (size_t)std::min<uint64_t>(delay - frames_skipped, b);
+  if (out_begin > 0 && out_begin * 2 >= out.size() / channels) {
+    out.erase(out.begin(), out.begin() + out_begin * channels);
+    out_begin = 0;
+  }
+  const size_t out_frame = out.size() / channels;
+  out.resize(out.size() + b * channels);
+  if (pool && pairs.size() > 1)
+    pool->run(pairs.size(), [&](size_t p) { process_pair(p, out_frame); });
+  else
+    for (size_t p = 0; p < pairs.size(); p++)
+      process_pair(p, out_frame);
+  block++;
+  fill = 0;
+  if (skip) {
+    out.erase(out.begin() + out_frame * channels, out.begin() + (out_frame + skip) * channels);
+    frames_skipped += skip;
+  }
+  frames_produced += b - skip;
+}
+
+void PartitionedConvolver::write(const sample32_t* src, size_t frames, ThreadPool* pool)
+{
+  const size_t b = filter->partition;
+  frames_in += frames;
+  while (frames > 0) {
+    const size_t n = std::min(frames, b - fill);
+    for (size_t p = 0; p < pairs.size(); p++) {
+      const size_t ch = 2 * p;
+      const sample32_t* in = src + ch;
+      float* re = &pairs[p].in_re[b + fill];
+      float* im = &pairs[p].in_im[b + fill];
+      if (ch + 1 < channels) {
+        for (size_t i = 0; i < n; i++, in += channels) {
+          re[i] = (float)in[0];
+          im[i] = (float)in[1];
+        }
+      }
+      else {
+        for (size_t i = 0; i < n; i++, in += channels)
+          re[i] = (float)in[0];
+      }
+    }
+    src += n * channels;
+    frames -= n;
+    fill += n;
+    if (fill == b)
+      process_block(pool);
+  }
+}
+
+void PartitionedConvolver::flush(ThreadPool* pool)
+{
+  const size_t b = filter->partition;
+  while (frames_produced < frames_in) {
+    for (auto& pair : pairs) {
+      std::fill(pair.in_re.begin() + b + fill, pair.in_re.end(), 0.0f);
+      std::fill(pair.in_im.begin() + b + fill, pair.in_im.end(), 0.0f);
+    }
+    process_block(pool);
+  }
+  // as much output as input
+  out.resize(out.size() - (size_t)(frames_produced - frames_in) * channels);
+  frames_produced = frames_in;
+}
+
+size_t PartitionedConvolver::read(sample32_t* dst, size_t frames, uint64_t& clips)
+{
+  frames = std::min(frames, available());
+  const float* src = out.data() + out_begin * channels;
+  for (size_t i = 0; i < frames * channels; i++) {
+    // SOX_FLOAT_64BIT_TO_SAMPLE on the normalized value, in 32 bit sample units
+    const double d = src[i];
+    if (d < 0) {
+      if (d <= -2147483648.0 - 0.5) {
+        ++clips;
+        dst[i] = (sample32_t)-2147483647 - 1;
+      }
+      else
+        dst[i] = (sample32_t)(d - 0.5);
+    }
+    else {
+      if (d >= 2147483647.0 + 0.5) {
+        if (d > 2147483647.0 + 1.0)
+          ++clips;
+        dst[i] = 2147483647;
+      }
+      else
+        dst[i] = (sample32_t)(d + 0.5);
+    }
+  }
+  out_begin += frames;
+  return frames;
+}
@@ -0,0 +1,109 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Uniformly partitioned FFT convolution (overlap-save) for long FIR filters
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_CONVOLVER_H__
+#define __SOXFILTER_CONVOLVER_H__
+
+#include "convert.h" // sample32_t, SOXFILTER_X86
+#include "fft.h"
+#include "threadpool.h"
+#include <memory>
+#include <vector>
+
+// y += x * h on n complex bins, split real and imaginary arrays
+typedef void (*cmac_fn)(const float* xr, const float* xi, const float* hr, const float* hi, float* yr, float* yi, size_t n);
+
+typedef struct conv_kernels_t {
+  const char* name;
+  cmac_fn cmac;
+} conv_kernels_t;
+
+enum conv_isa_t {
+  CONV_C,
+  CONV_AVX2
+};
+
+// The fastest one for the CPU, cpu_flags are the CPUF_* flags of avs/cpuid.h
+const conv_kernels_t* get_conv_kernels(int cpu_flags);
+
+// A given implementation, nullptr if it is not compiled in (e.g. for benchmarking)
+const conv_kernels_t* get_conv_kernels_isa(conv_isa_t isa);
+
+#ifdef SOXFILTER_X86
+// convolver_avx2.cpp, compiled with AVX2 enabled
+void cmac_avx2(const float* xr, const float* xi, const float* hr, const float* hi, float* yr, float* yi, size_t n);
+#endif
+
+// A FIR filter split into partitions of 'partition' taps, each one transformed with an FFT
+// of 2 * partition points, scaled by the inverse FFT's 1/n already.
+// It is never changed once made, convolvers (channels, chains) share it.
+typedef struct conv_filter_t {
+  size_t taps;
+  size_t partition;
+  size_t partitions;
+  std::shared_ptr<const FFT<float>> fft;
+  std::vector<float> h_re; // [partitions][2 * partition]
+  std::vector<float> h_im;
+} conv_filter_t;
+
+// partition 0: chosen by the number of taps
+std::shared_ptr<const conv_filter_t> make_conv_filter(const double* h, size_t taps, size_t partition = 0);
+
+// Filters interleaved channels with the same FIR filter.
+// Output frame n is sum h[i] * x[n + delay - i], x being zero outside of the written frames:
+// with delay = taps - 1 - taps / 2 that is the alignment of libsox' dft_filter (sinc, fir).
+// Two channels are transformed at once, as the real and imaginary part of one complex FFT:
+// the filter is real, so the products of the two do not mix.
+class PartitionedConvolver {
+private:
+  struct pair_state_t {
+    std::vector<float> in_re; // previous and current input block
+    std::vector<float> in_im;
+    std::vector<float> fdl_re; // spectra of the last 'partitions' input blocks
+    std::vector<float> fdl_im;
+    std::vector<float> y_re;
+    std::vector<float> y_im;
+  };
+
+  std::shared_ptr<const conv_filter_t> filter;
+  const conv_kernels_t* kernels;
+  size_t channels;
+  size_t delay;
+  std::vector<pair_state_t> pairs;
+  size_t fill; // frames in the current input block
+  size_t block; // number of blocks processed
+  std::vector<float> out; // interleaved output frames from out_begin
+  size_t out_begin;
+  uint64_t frames_in; // written
+  uint64_t frames_produced; // output frames put into 'out', the first 'delay' ones are dropped
+  uint64_t frames_skipped;
+
+  void process_pair(size_t pair, size_t out_frame);
+  void process_block(ThreadPool* pool);
+
+public:
+  PartitionedConvolver(std::shared_ptr<const conv_filter_t> _filter, size_t _channels, size_t _delay, const conv_kernels_t* _kernels);
+
+  void reset();
+
+  // Takes all frames, full blocks are filtered as they fill up, on the pool if given
+  void write(const sample32_t* src, size_t frames, ThreadPool* pool);
+
+  // End of input: filters zeros until every written frame has its output
+  void flush(ThreadPool* pool);
+
+  size_t available() const { return (out.size() / channels) - out_begin; }
+
+  // Rounds and clips like SOX_FLOAT_64BIT_TO_SAMPLE, returns the frames read
+  size_t read(sample32_t* dst, size_t frames, uint64_t& clips);
+};
+
+#endif // __SOXFILTER_CONVOLVER_H__
@@ -0,0 +1,39 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Uniformly partitioned FFT convolution (overlap-save) for long FIR filters
+ * AVX2 version of the spectrum multiply-accumulate, this file is compiled with AVX2 enabled
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convolver.h"
+
+#ifdef SOXFILTER_X86
+
+#include <immintrin.h>
+
+// eight bins at once, the FFT sizes are multiples of 8
+void cmac_avx2(const float* xr, const float* xi, const float* hr, const float* hi, float* yr, float* yi, size_t n)
+{
+  size_t k = 0;
+  for (; k + 8 <= n; k += 8) {
+    const __m256 a = _mm256_loadu_ps(xr + k);
+    const __m256 b = _mm256_loadu_ps(xi + k);
+    const __m256 c = _mm256_loadu_ps(hr + k);
+    const __m256 d = _mm256_loadu_ps(hi + k);
+    const __m256 re = _mm256_sub_ps(_mm256_mul_ps(a, c), _mm256_mul_ps(b, d));
+    const __m256 im = _mm256_add_ps(_mm256_mul_ps(a, d), _mm256_mul_ps(b, c));
+    _mm256_storeu_ps(yr + k, _mm256_add_ps(_mm256_loadu_ps(yr + k), re));
+    _mm256_storeu_ps(yi + k, _mm256_add_ps(_mm256_loadu_ps(yi + k), im));
+  }
+  for (; k < n; k++) {
+    yr[k] += xr[k] * hr[k] - xi[k] * hi[k];
+    yi[k] += xr[k] * hi[k] + xi[k] * hr[k];
+  }
+}
+
+#endif // SOXFILTER_X86
@@ -0,0 +1,152 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Complex FFT, radix-2, on split real and imaginary arrays
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_FFT_H__
+#define __SOXFILTER_FFT_H__
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+// Forward transform: X[k] = sum x[j] * exp(-2*pi*i*j*k/n), n is a power of 2.
+// The inverse is the forward transform with the real and imaginary arrays swapped,
+// unscaled (the result is n times the original).
+// The arrays are separate so that the butterflies of a stage run in vector lanes.
+// A convolution does not need the spectrum in order: the scrambled transforms skip the
+// bit reversal, the forward one leaves the spectrum bit-reversed, the inverse one takes it so.
+template<typename T>
+class FFT {
+private:
+  size_t n;
+  std::vector<uint32_t> bitrev;
+  // twiddles of the stage with butterfly span h are at [h, 2h)
+  std::vector<T> tw_re;
+  std::vector<T> tw_im;
+
+  // decimation in time, bit-reversed input to natural output
+  void dit(T* re, T* im) const {
+    size_t h = 1;
+    if (n >= 4) {
+      // spans 1 and 2 at once, their twiddles are 1 and -i
+      for (size_t g = 0; g < n; g += 4) {
+        T* r = re + g;
+        T* i = im + g;
+        const T u0r = r[0] + r[1], u0i = i[0] + i[1];
+        const T u1r = r[0] - r[1], u1i = i[0] - i[1];
+        const T u2r = r[2] + r[3], u2i = i[2] + i[3];
+        const T u3r = i[2] - i[3], u3i = r[3] - r[2]; // (x2 - x3) * -i
+        r[0] = u0r + u2r; i[0] = u0i + u2i;
+        r[2] = u0r - u2r; i[2] = u0i - u2i;
+        r[1] = u1r + u3r; i[1] = u1i + u3i;
+        r[3] = u1r - u3r; i[3] = u1i - u3i;
+      }
+      h = 4;
+    }
+    for (; h < n; h *= 2) {
+      const T* wr = &tw_re[h];
+      const T* wi = &tw_im[h];
+      for (size_t g = 0; g < n; g += 2 * h) {
+        T* ar = re + g;
+        T* ai = im + g;
+        T* br = re + g + h;
+        T* bi = im + g + h;
+        for (size_t j = 0; j < h; j++) {
+          const T tr = br[j] * wr[j] - bi[j] * wi[j];
+          const T ti = br[j] * wi[j] + bi[j] * wr[j];
+          br[j] = ar[j] - tr;
+          bi[j] = ai[j] - ti;
+          ar[j] += tr;
+          ai[j] += ti;
+        }
+      }
+    }
+  }
+
+  // decimation in frequency, natural input to bit-reversed output
+  void dif(T* re, T* im) const {
+    const size_t last = n >= 4 ? 4 : 1;
+    for (size_t h = n / 2; h >= last; h /= 2) {
+      const T* wr = &tw_re[h];
+      const T* wi = &tw_im[h];
+      for (size_t g = 0; g < n; g += 2 * h) {
+        T* ar = re + g;
+        T* ai = im + g;
+        T* br = re + g + h;
+        T* bi = im + g + h;
+        for (size_t j = 0; j < h; j++) {
+          const T dr = ar[j] - br[j];
+          const T di = ai[j] - bi[j];
+          ar[j] += br[j];
+          ai[j] += bi[j];
+          br[j] = dr * wr[j] - di * wi[j];
+          bi[j] = dr * wi[j] + di * wr[j];
+        }
+      }
+    }
+    if (n >= 4) {
+      // spans 2 and 1 at once
+      for (size_t g = 0; g < n; g += 4) {
+        T* r = re + g;
+        T* i = im + g;
+        const T u0r = r[0] + r[2], u0i = i[0] + i[2];
+        const T u1r = r[1] + r[3], u1i = i[1] + i[3];
+        const T u2r = r[0] - r[2], u2i = i[0] - i[2];
+        const T u3r = i[1] - i[3], u3i = r[3] - r[1]; // (x1 - x3) * -i
+        r[0] = u0r + u1r; i[0] = u0i + u1i;
+        r[1] = u0r - u1r; i[1] = u0i - u1i;
+        r[2] = u2r + u3r; i[2] = u2i + u3i;
+        r[3] = u2r - u3r; i[3] = u2i - u3i;
+      }
+    }
+  }
+
+public:
+  explicit FFT(size_t size) : n(size), bitrev(size), tw_re(size), tw_im(size) {
+    size_t bits = 0;
+    while (((size_t)1 << bits) < n)
+      bits++;
+    for (size_t i = 0; i < n; i++) {
+      size_t r = 0;
+      for (size_t b = 0; b < bits; b++)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      bitrev[i] = (uint32_t)r;
+    }
+    for (size_t h = 1; h < n; h *= 2) {
+      for (size_t j = 0; j < h; j++) {
+        const double angle = -3.14159265358979323846 * (double)j / (double)h;
+        tw_re[h + j] = (T)cos(angle);
+        tw_im[h + j] = (T)sin(angle);
+      }
+    }
+  }
+
+  size_t size() const { return n; }
+
+  void forward(T* re, T* im) const {
+    for (size_t i = 0; i < n; i++) {
+      const size_t r = bitrev[i];
+      if (r > i) {
+        std::swap(re[i], re[r]);
+        std::swap(im[i], im[r]);
+      }
+    }
+    dit(re, im);
+  }
+
+  void inverse_unscaled(T* re, T* im) const { forward(im, re); }
+
+  void forward_scrambled(T* re, T* im) const { dif(re, im); }
+
+  void inverse_scrambled_unscaled(T* re, T* im) const { dit(im, re); }
+};
+
+#endif // __SOXFILTER_FFT_H__
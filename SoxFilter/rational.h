@@ -0,0 +1,101 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Exact rational arithmetic for sample rates, lengths and positions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_RATIONAL_H__
+#define __SOXFILTER_RATIONAL_H__
+
+#include <cstdint>
+#include <cmath>
+
+// num / den, reduced, den > 0
+typedef struct rational_t {
+  int64_t num;
+  int64_t den;
+} rational_t;
+
+static inline int64_t gcd64(int64_t a, int64_t b)
+{
+  if (a < 0) a = -a;
+  if (b < 0) b = -b;
+  while (b) {
+    const int64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// 0 if it would not fit in 63 bits
+static inline int64_t lcm64(int64_t a, int64_t b)
+{
+  const int64_t g = gcd64(a, b);
+  if (g == 0)
+    return 0;
+  const int64_t q = a / g;
+  return q != 0 && b > INT64_MAX / q ? 0 : q * b;
+}
+
+static inline rational_t make_rational(int64_t num, int64_t den)
+{
+  if (den < 0) {
+    num = -num;
+    den = -den;
+  }
+  const int64_t g = gcd64(num, den);
+  return g > 1 ? rational_t{ num / g, den / g } : rational_t{ num, den };
+}
+
+// The closest fraction with a denominator up to max_den (continued fraction convergents):
+// a sample rate is an integer, or a decimal fraction like 44100 * 1.001, and comes out exact.
+static inline rational_t rational_from_double(double x, int64_t max_den = 1 << 16)
+{
+  int64_t p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+  double r = x;
+  for (int i = 0; i < 64; i++) {
+    const double a = floor(r);
+    if (a > 9.2e18)
+      break;
+    const int64_t ai = (int64_t)a;
+    const int64_t q2 = ai * q1 + q0;
+    if (q2 > max_den)
+      break;
+    const int64_t p2 = ai * p1 + p0;
+    p0 = p1; q0 = q1; p1 = p2; q1 = q2;
+    if ((double)p1 == x * (double)q1 || r - a < 1e-12)
+      break;
+    r = 1.0 / (r - a);
+  }
+  return q1 ? make_rational(p1, q1) : rational_t{ (int64_t)floor(x + 0.5), 1 };
+}
+
+// a / b
+static inline rational_t rational_div(rational_t a, rational_t b)
+{
+  const int64_t g1 = gcd64(a.num, b.num), g2 = gcd64(a.den, b.den);
+  return make_rational((a.num / (g1 ? g1 : 1)) * (b.den / (g2 ? g2 : 1)), (a.den / (g2 ? g2 : 1)) * (b.num / (g1 ? g1 : 1)));
+}
+
+// floor(a * r) for a >= 0. Exact without 128 bit arithmetic while the terms of r are
+// below 2^31 (rates, and ratios of them), in long double otherwise.
+static inline int64_t rational_scale_floor(int64_t a, rational_t r)
+{
+  if (r.num >= ((int64_t)1 << 31) || r.den >= ((int64_t)1 << 31))
+    return (int64_t)floorl((long double)a * r.num / r.den);
+  return (a / r.den) * r.num + (a % r.den) * r.num / r.den;
+}
+
+// a * r rounded half up, like libsox' (uint64_t)(x + .5) without its double rounding
+static inline int64_t rational_scale_round(int64_t a, rational_t r)
+{
+  return (rational_scale_floor(2 * a, r) + 1) / 2;
+}
+
+#endif // __SOXFILTER_RATIONAL_H__
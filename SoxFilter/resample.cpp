@@ -0,0 +1,326 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Polyphase resampler for rational sample rate ratios
+ * C version of the dot product, CPU dispatch, filter design, resampler
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "resample.h"
+#include <avs/cpuid.h>
+#include <algorithm>
+#include <cmath>
+
+// ------------------------ C ------------------------------
+
+template<typename T>
+static void poly_dot_c(const T* const* x, const T* h, size_t taps, size_t channels, double* out)
+{
+  for (size_t c = 0; c < channels; c++) {
+    const T* in = x[c];
+    T sum[4] = { 0, 0, 0, 0 };
+    for (size_t t = 0; t < taps; t += 4) {
+      sum[0] += in[t] * h[t];
+      sum[1] += in[t + 1] * h[t + 1];
+      sum[2] += in[t + 2] * h[t + 2];
+      sum[3] += in[t + 3] * h[t + 3];
+    }
+    out[c] = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+  }
+}
+
+static const resample_kernels_t resample_kernels_c = {
+  "C",
+  poly_dot_c<float>,
+  poly_dot_c<double>
+};
+
+#ifdef SOXFILTER_X86
+static const resample_kernels_t resample_kernels_avx2 = {
+  "AVX2",
+  poly_dot_avx2,
+  poly_dot_double_avx2
+};
+
+static const resample_kernels_t resample_kernels_avx512 = {
+  "AVX512",
+  poly_dot_avx512,
+  poly_dot_double_avx512
+};
+#endif
+
+// ------------------------ dispatch ------------------------------
+
+const resample_kernels_t* get_resample_kernels_isa(resample_isa_t isa)
+{
+  switch (isa) {
+  case RESAMPLE_C:
+    return &resample_kernels_c;
+#ifdef SOXFILTER_X86
+  case RESAMPLE_AVX2:
+    return &resample_kernels_avx2;
+  case RESAMPLE_AVX512:
+    return &resample_kernels_avx512;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const resample_kernels_t* get_resample_kernels(int cpu_flags)
+{
+#ifdef SOXFILTER_X86
+  if (cpu_flags & CPUF_AVX512F)
+    return &resample_kernels_avx512;
+  if ((cpu_flags & (CPUF_AVX2 | CPUF_FMA3)) == (CPUF_AVX2 | CPUF_FMA3))
+    return &resample_kernels_avx2;
+#else
+  (void)cpu_flags;
+#endif
+  return &resample_kernels_c;
+}
+
+// ------------------------ filter ------------------------------
+
+// In float the rounding of the input, the coefficients and the sums limits the
+// attenuation to about 140 dB: h and v run in double, at about half the speed.
+// l, m, h and v have libsox' numbers, q is a sinc instead of libsox' cubic interpolation.
+static const resample_quality_t resample_qualities[] = {
+  { 'q', 0.80, 60.0, false },
+  { 'l', 0.80, 100.0, false },
+  { 'm', 0.95, 100.0, false },
+  { 'h', 0.95, 125.0, true },
+  { 'v', 0.95, 175.0, true }
+};
+
+const resample_quality_t* get_resample_quality(char flag)
+{
+  for (const auto& quality : resample_qualities)
+    if (quality.flag == flag)
+      return &quality;
+  return nullptr;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+  while (b) {
+    const uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+bool get_resample_ratio(double in_rate, double out_rate, size_t max_term, size_t& up, size_t& down)
+{
+  if (in_rate < 1 || out_rate < 1 || in_rate != floor(in_rate) || out_rate != floor(out_rate))
+    return false;
+  const uint64_t in = (uint64_t)in_rate, out = (uint64_t)out_rate, g = gcd(in, out);
+  if (out / g > max_term || in / g > max_term)
+    return false;
+  up = (size_t)(out / g);
+  down = (size_t)(in / g);
+  return true;
+}
+
+static const double PI = 3.14159265358979323846;
+
+// zeroth order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+  double sum = 1, term = 1;
+  for (int k = 1; k < 64 && term > sum * 1e-17; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+std::shared_ptr<const poly_filter_t> make_poly_filter(size_t up, size_t down, const resample_quality_t& quality)
+{
+  // frequencies relative to the upsampled rate (up times the input rate)
+  const double nyquist = 0.5 / (double)std::max(up, down);
+  const double cutoff = nyquist * (quality.passband + 1.0) / 2;
+  const double transition = 2 * PI * nyquist * (1.0 - quality.passband);
+  const double attenuation = quality.attenuation;
+  const double beta = attenuation > 50 ? 0.1102 * (attenuation - 8.7) : 0.5842 * pow(attenuation - 21, 0.4) + 0.07886 * (attenuation - 21);
+  const double length = (attenuation - 8) / (2.285 * transition) + 1;
+
+  auto filter = std::make_shared<poly_filter_t>();
+  filter->up = up;
+  filter->down = down;
+  // per phase, padded for the widest vector loop
+  filter->taps = ((size_t)ceil(length / (double)up) + 15) & ~(size_t)15;
+  filter->center = up * filter->taps / 2;
+  filter->double_precision = quality.double_precision;
+  if (filter->double_precision)
+    filter->coefs_double.resize(up * filter->taps);
+  else
+    filter->coefs.resize(up * filter->taps);
+
+  // the prototype spans up * taps upsampled samples, centered; its gain is 'up'
+  // so that the zeros inserted by the upsampling do not lower the level
+  const double half = (double)filter->center;
+  const double i0_beta = bessel_i0(beta);
+  for (size_t j = 0; j < up * filter->taps; j++) {
+    const double t = (double)j - half;
+    const double r = t / half;
+    const double window = bessel_i0(beta * sqrt(std::max(0.0, 1 - r * r))) / i0_beta;
+    const double sinc = t == 0 ? 2 * cutoff : sin(2 * PI * cutoff * t) / (PI * t);
+    const size_t p = j % up, i = j / up, k = p * filter->taps + filter->taps - 1 - i;
+    if (filter->double_precision)
+      filter->coefs_double[k] = sinc * window * (double)up;
+    else
+      filter->coefs[k] = (float)(sinc * window * (double)up);
+  }
+  return filter;
+}
+
+// ------------------------ resampler ------------------------------
+
+PolyphaseResampler::PolyphaseResampler(std::shared_ptr<const poly_filter_t> _filter, size_t _channels, const resample_kernels_t* _kernels) :
+  filter(_filter), kernels(_kernels), channels(_channels), x(_channels), x_double(_channels), dots(_channels)
+{
+  if (filter->double_precision)
+    history_double.resize(channels);
+  else
+    history.resize(channels);
+  reset();
+}
+
+template<typename T>
+void PolyphaseResampler::drop_history(std::vector<std::vector<T>>& h, size_t count)
+{
+  for (auto& v : h)
+    v.erase(v.begin(), v.begin() + count);
+}
+
+template<typename T>
+void PolyphaseResampler::append_history(std::vector<std::vector<T>>& h, const sample32_t* src, size_t frames)
+{
+  for (size_t c = 0; c < channels; c++) {
+    std::vector<T>& v = h[c];
+    const size_t size = v.size();
+    v.resize(size + frames);
+    const sample32_t* in = src + c;
+    for (size_t i = 0; i < frames; i++, in += channels)
+      v[size + i] = (T)*in;
+  }
+}
+
+template<typename T>
+void PolyphaseResampler::pad_history(std::vector<std::vector<T>>& h, size_t count)
+{
+  for (auto& v : h)
+    v.resize(v.size() + count, 0);
+}
+
+void PolyphaseResampler::reset()
+{
+  for (auto& h : history)
+    h.assign(filter->taps, 0.0f);
+  for (auto& h : history_double)
+    h.assign(filter->taps, 0.0);
+  base = 0;
+  frames_in = 0;
+  frames_out = 0;
+  frames_out_total = 0;
+  last = filter->center / filter->up;
+  phase = filter->center % filter->up;
+  flushed = false;
+}
+
+void PolyphaseResampler::write(const sample32_t* src, size_t frames)
+{
+  const size_t taps = filter->taps, size = history_size();
+  // drop the input no output needs anymore, once it is the larger part of the history
+  const size_t unused = (size_t)std::min<uint64_t>(last + 1 > base ? last + 1 - base : 0, size - taps);
+  if (unused > 0 && unused * 2 >= size) {
+    if (filter->double_precision)
+      drop_history(history_double, unused);
+    else
+      drop_history(history, unused);
+    base += unused;
+  }
+
+  if (filter->double_precision)
+    append_history(history_double, src, frames);
+  else
+    append_history(history, src, frames);
+  frames_in += frames;
+}
+
+void PolyphaseResampler::flush()
+{
+  if (flushed)
+    return;
+  flushed = true;
+  const uint64_t up = filter->up, down = filter->down;
+  frames_out_total = (2 * frames_in * up + down) / (2 * down);
+  if (frames_out_total == 0)
+    return;
+  // zeros after the input, up to the last frame the output reaches
+  const uint64_t end = ((frames_out_total - 1) * down + filter->center) / up + 1;
+  if (end > frames_in) {
+    if (filter->double_precision)
+      pad_history(history_double, (size_t)(end - frames_in));
+    else
+      pad_history(history, (size_t)(end - frames_in));
+  }
+}
+
+size_t PolyphaseResampler::read(sample32_t* dst, size_t frames, uint64_t& clips)
+{
+  const poly_filter_t& f = *filter;
+  const uint64_t available = base + history_size() - f.taps; // with the zeros of flush
+  // the position advances by down / up input frames per output frame
+  const uint64_t step = f.down / f.up;
+  const size_t phase_step = f.down % f.up;
+  size_t done = 0;
+  for (; done < frames; done++) {
+    if (ended())
+      break;
+    if (last >= available)
+      break;
+    const size_t start = (size_t)(last + 1 - base); // history[c][start] is input frame last - taps + 1
+    if (f.double_precision) {
+      for (size_t c = 0; c < channels; c++)
+        x_double[c] = &history_double[c][start];
+      kernels->dot_double(x_double.data(), &f.coefs_double[phase * f.taps], f.taps, channels, dots.data());
+    }
+    else {
+      for (size_t c = 0; c < channels; c++)
+        x[c] = &history[c][start];
+      kernels->dot(x.data(), &f.coefs[phase * f.taps], f.taps, channels, dots.data());
+    }
+
+    for (size_t c = 0; c < channels; c++, dst++) {
+      // SOX_FLOAT_64BIT_TO_SAMPLE on the normalized value, in 32 bit sample units;
+      // the sign of noise is random, the rounding must not branch on it
+      const double d = dots[c];
+      if (d > -2147483648.0 - 0.5 && d < 2147483647.0 + 0.5)
+        *dst = (sample32_t)(d + copysign(0.5, d));
+      else if (d < 0) {
+        ++clips;
+        *dst = (sample32_t)-2147483647 - 1;
+      }
+      else {
+        if (d > 2147483647.0 + 1.0)
+          ++clips;
+        *dst = 2147483647;
+      }
+    }
+    frames_out++;
+    last += step;
+    phase += phase_step;
+    if (phase >= f.up) {
+      phase -= f.up;
+      last++;
+    }
+  }
+  return done;
+}
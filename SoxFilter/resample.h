@@ -0,0 +1,131 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Polyphase resampler for rational sample rate ratios
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_RESAMPLE_H__
+#define __SOXFILTER_RESAMPLE_H__
+
+#include "convert.h" // sample32_t, SOXFILTER_X86
+#include <memory>
+#include <vector>
+
+// out[c] = sum x[c][t] * h[t], t < taps, for each channel; taps is a multiple of 16
+typedef void (*poly_dot_fn)(const float* const* x, const float* h, size_t taps, size_t channels, double* out);
+// the same in double, for the presets float would limit
+typedef void (*poly_dot_double_fn)(const double* const* x, const double* h, size_t taps, size_t channels, double* out);
+
+typedef struct resample_kernels_t {
+  const char* name;
+  poly_dot_fn dot;
+  poly_dot_double_fn dot_double;
+} resample_kernels_t;
+
+enum resample_isa_t {
+  RESAMPLE_C,
+  RESAMPLE_AVX2,
+  RESAMPLE_AVX512
+};
+
+// The fastest one for the CPU, cpu_flags are the CPUF_* flags of avs/cpuid.h
+const resample_kernels_t* get_resample_kernels(int cpu_flags);
+
+// A given implementation, nullptr if it is not compiled in (e.g. for benchmarking)
+const resample_kernels_t* get_resample_kernels_isa(resample_isa_t isa);
+
+#ifdef SOXFILTER_X86
+// resample_avx2.cpp (with FMA) and resample_avx512.cpp, compiled with the instruction set enabled
+void poly_dot_avx2(const float* const* x, const float* h, size_t taps, size_t channels, double* out);
+void poly_dot_double_avx2(const double* const* x, const double* h, size_t taps, size_t channels, double* out);
+void poly_dot_avx512(const float* const* x, const float* h, size_t taps, size_t channels, double* out);
+void poly_dot_double_avx512(const double* const* x, const double* h, size_t taps, size_t channels, double* out);
+#endif
+
+// Quality presets with the bandwidth and rejection of libsox' rate, but 'q' (libsox: cubic
+// interpolation, here the cheapest sinc): the passband ends at 'passband' of the lower Nyquist
+// frequency (libsox: the -3 dB point), the stopband begins at the Nyquist frequency (no aliasing).
+// Float coefficients, input and sums limit the attenuation to about 140 dB: the presets
+// asking for more are computed in double.
+typedef struct resample_quality_t {
+  char flag; // rate's option letter: q, l, m, h, v
+  double passband;
+  double attenuation; // dB
+  bool double_precision;
+} resample_quality_t;
+
+// nullptr for an unknown letter
+const resample_quality_t* get_resample_quality(char flag);
+
+// Kaiser windowed sinc lowpass, decomposed into 'up' phases of 'taps' coefficients.
+// Output sample k is at input position (k * down + center) / up, its phase is that
+// position modulo up: phase p is coefs[p * taps .. (p + 1) * taps), reversed, so that it
+// runs along the input from x[n - taps + 1] to x[n].
+typedef struct poly_filter_t {
+  size_t up; // L
+  size_t down; // M
+  size_t taps; // per phase
+  size_t center; // up * taps / 2, the delay of the filter in upsampled samples
+  bool double_precision; // coefs_double is filled instead of coefs
+  std::vector<float> coefs;
+  std::vector<double> coefs_double;
+} poly_filter_t;
+
+// The reduced ratio of two integral rates: false if a rate is not an integer, or a term
+// of the ratio is above max_term (the phase table grows with both)
+bool get_resample_ratio(double in_rate, double out_rate, size_t max_term, size_t& up, size_t& down);
+
+std::shared_ptr<const poly_filter_t> make_poly_filter(size_t up, size_t down, const resample_quality_t& quality);
+
+// Resamples interleaved channels: the output of n input frames is n * up / down frames,
+// rounded to the nearest, like libsox' rate; the filter delay is compensated.
+class PolyphaseResampler {
+private:
+  std::shared_ptr<const poly_filter_t> filter;
+  const resample_kernels_t* kernels;
+  size_t channels;
+  // per channel, taps zeros then the input from 'base': history_double with double_precision
+  std::vector<std::vector<float>> history;
+  std::vector<std::vector<double>> history_double;
+  uint64_t base; // input frame at history[c][taps]
+  uint64_t frames_in;
+  uint64_t frames_out;
+  uint64_t frames_out_total; // known when the input has ended
+  // position of the next output frame: its last input frame, its phase
+  uint64_t last;
+  size_t phase;
+  bool flushed;
+  std::vector<const float*> x;
+  std::vector<const double*> x_double;
+  std::vector<double> dots;
+
+  size_t history_size() const { return filter->double_precision ? history_double[0].size() : history[0].size(); }
+  template<typename T> void drop_history(std::vector<std::vector<T>>& h, size_t count);
+  template<typename T> void append_history(std::vector<std::vector<T>>& h, const sample32_t* src, size_t frames);
+  template<typename T> void pad_history(std::vector<std::vector<T>>& h, size_t count);
+
+public:
+  PolyphaseResampler(std::shared_ptr<const poly_filter_t> _filter, size_t _channels, const resample_kernels_t* _kernels);
+
+  void reset();
+
+  // Takes all frames
+  void write(const sample32_t* src, size_t frames);
+
+  // End of input
+  void flush();
+
+  // Rounds and clips like SOX_FLOAT_64BIT_TO_SAMPLE, returns the frames given,
+  // less than asked if the input is not there yet (or has ended)
+  size_t read(sample32_t* dst, size_t frames, uint64_t& clips);
+
+  // All output is read after flush
+  bool ended() const { return flushed && frames_out >= frames_out_total; }
+};
+
+#endif // __SOXFILTER_RESAMPLE_H__
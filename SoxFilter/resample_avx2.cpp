@@ -0,0 +1,97 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Polyphase resampler for rational sample rate ratios
+ * AVX2 versions of the dot products, this file is compiled with AVX2 and FMA enabled
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "resample.h"
+
+#ifdef SOXFILTER_X86
+
+#include <immintrin.h>
+
+static inline float hsum(__m256 v)
+{
+  const __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  const __m128 s2 = _mm_add_ps(s4, _mm_movehl_ps(s4, s4));
+  return _mm_cvtss_f32(_mm_add_ss(s2, _mm_shuffle_ps(s2, s2, 1)));
+}
+
+// 16 taps per step in two accumulators, channels in pairs so that a load of the
+// coefficients serves both
+void poly_dot_avx2(const float* const* x, const float* h, size_t taps, size_t channels, double* out)
+{
+  size_t c = 0;
+  for (; c + 2 <= channels; c += 2) {
+    const float* a = x[c];
+    const float* b = x[c + 1];
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+    __m256 b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+    for (size_t t = 0; t < taps; t += 16) {
+      const __m256 h0 = _mm256_loadu_ps(h + t);
+      const __m256 h1 = _mm256_loadu_ps(h + t + 8);
+      a0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + t), h0, a0);
+      a1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + t + 8), h1, a1);
+      b0 = _mm256_fmadd_ps(_mm256_loadu_ps(b + t), h0, b0);
+      b1 = _mm256_fmadd_ps(_mm256_loadu_ps(b + t + 8), h1, b1);
+    }
+    out[c] = hsum(_mm256_add_ps(a0, a1));
+    out[c + 1] = hsum(_mm256_add_ps(b0, b1));
+  }
+  for (; c < channels; c++) {
+    const float* a = x[c];
+    __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+    for (size_t t = 0; t < taps; t += 16) {
+      a0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + t), _mm256_loadu_ps(h + t), a0);
+      a1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + t + 8), _mm256_loadu_ps(h + t + 8), a1);
+    }
+    out[c] = hsum(_mm256_add_ps(a0, a1));
+  }
+}
+
+static inline double hsum(__m256d v)
+{
+  const __m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+}
+
+// The same in double: 16 taps per step in four vectors, two accumulators per channel
+void poly_dot_double_avx2(const double* const* x, const double* h, size_t taps, size_t channels, double* out)
+{
+  size_t c = 0;
+  for (; c + 2 <= channels; c += 2) {
+    const double* a = x[c];
+    const double* b = x[c + 1];
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+    __m256d b0 = _mm256_setzero_pd(), b1 = _mm256_setzero_pd();
+    for (size_t t = 0; t < taps; t += 16) {
+      for (size_t i = 0; i < 16; i += 8) {
+        const __m256d h0 = _mm256_loadu_pd(h + t + i);
+        const __m256d h1 = _mm256_loadu_pd(h + t + i + 4);
+        a0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + t + i), h0, a0);
+        a1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + t + i + 4), h1, a1);
+        b0 = _mm256_fmadd_pd(_mm256_loadu_pd(b + t + i), h0, b0);
+        b1 = _mm256_fmadd_pd(_mm256_loadu_pd(b + t + i + 4), h1, b1);
+      }
+    }
+    out[c] = hsum(_mm256_add_pd(a0, a1));
+    out[c + 1] = hsum(_mm256_add_pd(b0, b1));
+  }
+  for (; c < channels; c++) {
+    const double* a = x[c];
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+    for (size_t t = 0; t < taps; t += 8) {
+      a0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + t), _mm256_loadu_pd(h + t), a0);
+      a1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + t + 4), _mm256_loadu_pd(h + t + 4), a1);
+    }
+    out[c] = hsum(_mm256_add_pd(a0, a1));
+  }
+}
+
+#endif // SOXFILTER_X86
@@ -0,0 +1,101 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Polyphase resampler for rational sample rate ratios
+ * AVX-512 versions of the dot products, this file is compiled with AVX-512F enabled
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "resample.h"
+
+#ifdef SOXFILTER_X86
+
+// GCC 12 warns about the _mm512_undefined_* pass-through operands of the unmasked intrinsics
+// when they are inlined (GCC bug 105593), the header is included without those warnings
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// 16 taps per step, channels in pairs so that a load of the coefficients serves both;
+// two accumulators per channel over 32 taps while they last
+void poly_dot_avx512(const float* const* x, const float* h, size_t taps, size_t channels, double* out)
+{
+  size_t c = 0;
+  for (; c + 2 <= channels; c += 2) {
+    const float* a = x[c];
+    const float* b = x[c + 1];
+    __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+    __m512 b0 = _mm512_setzero_ps(), b1 = _mm512_setzero_ps();
+    size_t t = 0;
+    for (; t + 32 <= taps; t += 32) {
+      const __m512 h0 = _mm512_loadu_ps(h + t);
+      const __m512 h1 = _mm512_loadu_ps(h + t + 16);
+      a0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + t), h0, a0);
+      a1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + t + 16), h1, a1);
+      b0 = _mm512_fmadd_ps(_mm512_loadu_ps(b + t), h0, b0);
+      b1 = _mm512_fmadd_ps(_mm512_loadu_ps(b + t + 16), h1, b1);
+    }
+    if (t < taps) {
+      const __m512 h0 = _mm512_loadu_ps(h + t);
+      a0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + t), h0, a0);
+      b0 = _mm512_fmadd_ps(_mm512_loadu_ps(b + t), h0, b0);
+    }
+    out[c] = _mm512_reduce_add_ps(_mm512_add_ps(a0, a1));
+    out[c + 1] = _mm512_reduce_add_ps(_mm512_add_ps(b0, b1));
+  }
+  for (; c < channels; c++) {
+    const float* a = x[c];
+    __m512 a0 = _mm512_setzero_ps(), a1 = _mm512_setzero_ps();
+    size_t t = 0;
+    for (; t + 32 <= taps; t += 32) {
+      a0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + t), _mm512_loadu_ps(h + t), a0);
+      a1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + t + 16), _mm512_loadu_ps(h + t + 16), a1);
+    }
+    if (t < taps)
+      a0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + t), _mm512_loadu_ps(h + t), a0);
+    out[c] = _mm512_reduce_add_ps(_mm512_add_ps(a0, a1));
+  }
+}
+
+// The same in double: 16 taps per step in two vectors, one accumulator per vector
+void poly_dot_double_avx512(const double* const* x, const double* h, size_t taps, size_t channels, double* out)
+{
+  size_t c = 0;
+  for (; c + 2 <= channels; c += 2) {
+    const double* a = x[c];
+    const double* b = x[c + 1];
+    __m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd();
+    __m512d b0 = _mm512_setzero_pd(), b1 = _mm512_setzero_pd();
+    for (size_t t = 0; t < taps; t += 16) {
+      const __m512d h0 = _mm512_loadu_pd(h + t);
+      const __m512d h1 = _mm512_loadu_pd(h + t + 8);
+      a0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + t), h0, a0);
+      a1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + t + 8), h1, a1);
+      b0 = _mm512_fmadd_pd(_mm512_loadu_pd(b + t), h0, b0);
+      b1 = _mm512_fmadd_pd(_mm512_loadu_pd(b + t + 8), h1, b1);
+    }
+    out[c] = _mm512_reduce_add_pd(_mm512_add_pd(a0, a1));
+    out[c + 1] = _mm512_reduce_add_pd(_mm512_add_pd(b0, b1));
+  }
+  for (; c < channels; c++) {
+    const double* a = x[c];
+    __m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd();
+    for (size_t t = 0; t < taps; t += 16) {
+      a0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + t), _mm512_loadu_pd(h + t), a0);
+      a1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + t + 8), _mm512_loadu_pd(h + t + 8), a1);
+    }
+    out[c] = _mm512_reduce_add_pd(_mm512_add_pd(a0, a1));
+  }
+}
+
+#endif // SOXFILTER_X86
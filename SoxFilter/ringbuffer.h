@@ -0,0 +1,235 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Single producer - single consumer ring buffer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_RINGBUFFER_H__
+#define __SOXFILTER_RINGBUFFER_H__
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// FIFO with a power of 2 capacity. Lock-free for one producer thread and
+// one consumer thread: each position is written by one side only, published
+// with release and read with acquire semantics.
+// Content is never moved: the producer appends at the write position, the
+// consumer reads from the read position, wrap-around is handled by the
+// read and write helpers (or by the span functions, at most two spans).
+// set_capacity and reset must not be called while the other side is active.
+template<typename T>
+class RingBuffer {
+private:
+  std::vector<T> buffer;
+  size_t mask;
+  std::atomic<size_t> read_pos; // free running positions, wrapped by mask
+  std::atomic<size_t> write_pos;
+
+public:
+  RingBuffer() : mask(0), read_pos(0), write_pos(0) {}
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  // rounds up to the next power of 2, drops the content
+  void set_capacity(size_t min_capacity) {
+    size_t capacity = 1;
+    while (capacity < min_capacity)
+      capacity <<= 1;
+    buffer.resize(capacity);
+    mask = capacity - 1;
+    reset();
+  }
+
+  void reset() {
+    read_pos.store(0, std::memory_order_relaxed);
+    write_pos.store(0, std::memory_order_release);
+  }
+
+  size_t capacity() const { return buffer.size(); }
+
+  size_t size() const {
+    return write_pos.load(std::memory_order_acquire) - read_pos.load(std::memory_order_acquire);
+  }
+
+  size_t free_space() const { return capacity() - size(); }
+
+  // ---------------- producer side ----------------
+
+  // Contiguous writable area at the write position
+  T* write_span(size_t& count) {
+    const size_t wp = write_pos.load(std::memory_order_relaxed);
+    const size_t offset = wp & mask;
+    count = std::min(capacity() - (wp - read_pos.load(std::memory_order_acquire)), capacity() - offset);
+    return buffer.data() + offset;
+  }
+
+  // Publishes count elements written into the write span
+  void commit_write(size_t count) {
+    write_pos.store(write_pos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  // appends up to count elements, returns the actually written element count
+  size_t write(const T* source, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+      size_t span;
+      T* target = write_span(span);
+      span = std::min(span, count - done);
+      if (span == 0)
+        break;
+      memcpy(target, source + done, span * sizeof(T));
+      commit_write(span);
+      done += span;
+    }
+    return done;
+  }
+
+  // ---------------- consumer side ----------------
+
+  // Contiguous readable area at the read position
+  const T* read_span(size_t& count) const {
+    const size_t rp = read_pos.load(std::memory_order_relaxed);
+    const size_t offset = rp & mask;
+    count = std::min(write_pos.load(std::memory_order_acquire) - rp, capacity() - offset);
+    return buffer.data() + offset;
+  }
+
+  // Releases count elements from the read position
+  void commit_read(size_t count) {
+    read_pos.store(read_pos.load(std::memory_order_relaxed) + count, std::memory_order_release);
+  }
+
+  // copies up to count elements to target without consuming them
+  size_t peek(T* target, size_t count) const {
+    const size_t rp = read_pos.load(std::memory_order_relaxed);
+    count = std::min(count, write_pos.load(std::memory_order_acquire) - rp);
+    const size_t offset = rp & mask;
+    const size_t first = std::min(count, capacity() - offset);
+    memcpy(target, buffer.data() + offset, first * sizeof(T));
+    memcpy(target + first, buffer.data(), (count - first) * sizeof(T));
+    return count;
+  }
+
+  // copies up to count elements to target, returns the actually copied element count
+  size_t read(T* target, size_t count) {
+    count = peek(target, count);
+    commit_read(count);
+    return count;
+  }
+};
+
+// Fills a RingBuffer from a worker thread: the producer function is called
+// whenever at least 'min_free' elements of space are available in the ring.
+// The consumer reads the ring directly, then calls notify_consumed.
+// An exception thrown by the producer stops the worker: it is no longer running,
+// wait_for_data fails once the ring runs empty, the consumer then takes the error
+// (take_error) and reports it. The next start runs a new worker.
+template<typename T>
+class RingProducer {
+private:
+  RingBuffer<T>& ring;
+  size_t min_free;
+  std::function<void()> produce;
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable cv_producer; // free space or stop
+  std::condition_variable cv_consumer; // data or error
+  bool stop_requested;
+  std::exception_ptr error;
+  std::atomic<bool> failed; // the worker ended with an error
+
+  void run() {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_producer.wait(lock, [&] { return stop_requested || ring.free_space() >= min_free; });
+        if (stop_requested)
+          return;
+      }
+      try {
+        produce();
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+        failed = true;
+        cv_consumer.notify_all();
+        return;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      cv_consumer.notify_all();
+    }
+  }
+
+public:
+  RingProducer(RingBuffer<T>& _ring, size_t _min_free) : ring(_ring), min_free(_min_free), stop_requested(false), failed(false) {}
+  ~RingProducer() { stop(); }
+
+  // false after an error of the producer as well
+  bool running() const { return worker.joinable() && !failed; }
+
+  // no-op if already running, an error not taken is dropped
+  void start(std::function<void()> _produce) {
+    if (running())
+      return;
+    if (worker.joinable())
+      worker.join(); // ended with an error
+    produce = std::move(_produce);
+    stop_requested = false;
+    error = nullptr;
+    failed = false;
+    worker = std::thread(&RingProducer::run, this);
+  }
+
+  void stop() {
+    if (!worker.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop_requested = true;
+    }
+    cv_producer.notify_all();
+    worker.join();
+  }
+
+  // Consumer: waits until at least min_count elements are available.
+  // false: the producer failed before, see take_error
+  bool wait_for_data(size_t min_count = 1) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv_consumer.wait(lock, [&] { return error != nullptr || ring.size() >= min_count; });
+    return error == nullptr || ring.size() >= min_count;
+  }
+
+  // Consumer: the error of a failed producer, nullptr if there is none.
+  // The worker is gone afterwards, the next start runs a new one.
+  std::exception_ptr take_error() {
+    if (!failed)
+      return nullptr;
+    worker.join();
+    failed = false;
+    std::exception_ptr taken = error;
+    error = nullptr;
+    return taken;
+  }
+
+  // Consumer: some space was freed up in the ring
+  void notify_consumed() {
+    { std::lock_guard<std::mutex> lock(mutex); }
+    cv_producer.notify_all();
+  }
+};
+
+#endif // __SOXFILTER_RINGBUFFER_H__
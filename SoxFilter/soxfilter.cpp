@@ -41,100 +41,843 @@
 #include <avisynth.h>
 #include <avs/filesystem.h>
 #include <avs/minmax.h>
+#ifdef _WIN32
+#include <avs/win.h>
+#endif
 #include <sox.h>
 #include <vector>
 #include <algorithm>
 #include <string>
 #include <sstream>
 #include <atomic>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <stdexcept>
+#include "ringbuffer.h"
+#include "threadpool.h"
+#include "convert.h"
+#include "biquad.h"
+#include "convolver.h"
+#include "resample.h"
+#include "rational.h"
+#include "cache.h"
+#include "stats.h"
+#include <mutex>
+#include <unordered_map>
 
 #define OUTPUT_MESSAGE_HANDLER_BUFFERS
 
 static std::atomic<int> sox_init_counter = 0;
 
+// libsox' effects share global caches (e.g. the FFT tables of the filter designs), their locks
+// are no-ops in libsox builds without OpenMP: starting libsox effects (and parsing the options
+// into the shared argument buffers of the effect descriptions) is serialized process-wide.
+static std::mutex effect_build_lock;
+
+// env->ThrowError. Without an environment (a chain built off the request path, see
+// StartSpareChain) a std::runtime_error, reported when the chain is taken.
+[[noreturn]] static void throw_error(IScriptEnvironment* env, const char* fmt, ...)
+{
+  char text[4096];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(text, sizeof(text), fmt, ap);
+  va_end(ap);
+  if (env)
+    env->ThrowError("%s", text);
+  throw std::runtime_error(text);
+}
+
+// To the debugger (e.g. DebugView) on Windows, to stderr elsewhere. Unlike _RPT also in release builds.
+static void debug_output(const std::string& text)
+{
+#ifdef _WIN32
+  OutputDebugStringA(text.c_str());
+#else
+  fputs(text.c_str(), stderr);
+#endif
+}
+
+// The text of an error caught on a worker thread, to be thrown again on the request's one
+static std::string error_message(std::exception_ptr error)
+{
+  try {
+    std::rethrow_exception(error);
+  }
+  catch (const AvisynthError& e) {
+    return e.msg;
+  }
+  catch (const std::exception& e) {
+    return e.what();
+  }
+  catch (...) {
+    return "unknown error";
+  }
+}
+
 class SoxFilter; // forward
 sox_effect_handler_t const* input_handler(void);
 sox_effect_handler_t const* output_handler(void);
+sox_effect_handler_t const* pipe_in_handler(void);
+sox_effect_handler_t const* pipe_out_handler(void);
+sox_effect_handler_t const* probe_handler(void);
+sox_effect_handler_t const* parallel_handler(void);
+sox_effect_handler_t const* biquads_handler(void);
+sox_effect_handler_t const* fftconv_handler(void);
+sox_effect_handler_t const* polyphase_handler(void);
+static void instrument_effects(sox_effects_chain_t* chain, size_t first, effect_stats_t* stats);
+
+// child->GetAudio is called only while a GetAudio of the filter is running, with the env of
+// that request, also from worker threads (prefetch): an env must not be used after its request
+// has returned, the source may feed other branches of the script or be called by AVS+ Prefetch()
+// threads by then. Between requests the workers wait for the next one; the request's thread
+// closes the gate on return, after the calls in progress.
+class RequestGate {
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  IScriptEnvironment* env; // nullptr: no request is running
+  int calls; // child->GetAudio calls in progress
+  bool shut; // the filter is being destroyed
 
-typedef struct avs_privdata_t {
-  SoxFilter* caller;
-} avs_privdata_t;
+public:
+  RequestGate() : env(nullptr), calls(0), shut(false) {}
+
+  void open(IScriptEnvironment* _env) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      env = _env;
+    }
+    cv.notify_all();
+  }
+
+  void close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    env = nullptr;
+    cv.wait(lock, [&] { return calls == 0; });
+  }
+
+  // Workers blocked in enter give up (stopping them would wait forever otherwise)
+  void shutdown() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shut = true;
+    }
+    cv.notify_all();
+  }
 
-class SimpleBuf {
+  // Waits for a request, its env is valid until leave.
+  // nullptr: shut down, the child must not be called any more.
+  IScriptEnvironment* enter() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return shut || env != nullptr; });
+    if (shut)
+      return nullptr;
+    calls++;
+    return env;
+  }
+
+  void leave() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      calls--;
+    }
+    cv.notify_all();
+  }
+};
+
+// Keeps the gate open for the current GetAudio, exceptions included
+class RequestScope {
 private:
-  size_t read_ptr;
-public:
-  SimpleBuf() {
-    reset();
-  };
+  RequestGate& gate;
 
-  void reset() {
-    read_ptr = 0;
-    avs_start = 0;
-    avs_count = 0;
-    avs_channels = 1;
-  }
-  size_t used_count() { return read_ptr / avs_channels; }
-  size_t free_count_all_channels() { return read_buffer.size() - read_ptr; }
-  size_t free_count() { return (read_buffer.size() - read_ptr) / avs_channels; }
-  size_t size() { return read_buffer.size(); }
-
-  // copies up to count elements from buffer to target
-  // returns the actually copied element count
-  size_t read(sox_sample_t *target, size_t count) {
-    size_t copy_count = std::min(count, free_count_all_channels());
-    std::copy(read_buffer.data() + read_ptr, read_buffer.data() + read_ptr + copy_count, target);
-    read_ptr += copy_count;
-    return copy_count;
-  }
-
-  // reinits and sets whole buffer from source
-  void setdata_info(int64_t _avs_start, size_t count, int channels) {
-    read_buffer.resize(count * channels);
-    avs_channels = channels;
-    read_ptr = 0;
-    avs_start = _avs_start;
-    avs_count = count;
-  }
-
-  // reinits and sets whole buffer from source
-  void setdata(sox_sample_t* source, int64_t _avs_start, size_t count, int channels) {
-    read_buffer.resize(count * channels);
-    std::copy(source, source + count * channels, read_buffer.data());
-    read_ptr = 0;
-    avs_start = _avs_start;
-    avs_count = count;
-    avs_channels = channels;
-  }
-
-  int64_t next_start() {
-    return avs_start + avs_count; // is not ChannelCount aware
-  }
-
-  std::vector<sox_sample_t> read_buffer; // sox_sample_t = int32_t
-  int64_t avs_start;
-  int64_t avs_count;
-  int avs_channels;
+public:
+  RequestScope(RequestGate& _gate, IScriptEnvironment* env) : gate(_gate) { gate.open(env); }
+  ~RequestScope() { gate.close(); }
 };
 
 typedef struct avs_in_info_t {
   // general
   PClip child;
   int AudioChannels;
-  IScriptEnvironment* env;
-  size_t buffersize_for_samples; // size of read_buffer
-  SimpleBuf inputbuf;
+  IScriptEnvironment* env; // for errors: the request's while it flows the chain, nullptr on workers
+  size_t buffersize_for_samples; // amount of a child->GetAudio, all channels
+  RingBuffer<sox_sample_t> inputbuf; // sox_sample_t = int32_t
+  // producer side (worker thread when prefetching)
+  int64_t fetch_start; // child position of the next child->GetAudio (not ChannelCount aware)
+  std::vector<sox_sample_t> frame_buf; // one frame, for the ring's wrap-around
+  // consumer side
+  int64_t read_start; // child position of the next sample the chain reads
+  // Keeps the input ring filled from a worker thread, so that decoding in
+  // the upstream filters overlaps with the effect processing.
+  // Reading is strictly sequential from fetch_start. The worker is started
+  // on demand by the 'input' drain and stopped on every input seek.
+  RingProducer<sox_sample_t>* prefetcher; // nullptr: child->GetAudio is called from 'input' drain
+  std::mutex* child_lock; // when chains of the same filter read the child concurrently, or nullptr
+  RequestGate* gate; // of the filter, child->GetAudio is called through it
+  // 16/24 bit and (in nativefloat mode) float child audio is converted while fetching
+  to_sample_fn convert_input; // nullptr: the child is 32 bit already
+  int bytes_per_sample; // of the child
+  std::vector<uint8_t> convert_buf; // one child->GetAudio
+  std::atomic<sox_uint64_t> clips; // in the conversion, not yet reported by the 'input' effect
 } avs_in_info_t; // helper for Async child->GetAudio
 
+// Appends up to 'count' samples (per channel) of child audio, directly into the ring.
+// Frames are never split, so the ring always holds whole frames.
+// The child is called with the env of the running request, see RequestGate.
+static void input_fetch(avs_in_info_t& info, size_t count)
+{
+  const int channels = info.AudioChannels;
+  count = std::min(count, info.inputbuf.free_space() / channels);
+  IScriptEnvironment* env = info.gate->enter();
+  if (!env)
+    throw std::runtime_error("SoxFilter: the filter is destroyed");
+  struct gate_leave_t {
+    RequestGate* gate;
+    ~gate_leave_t() { gate->leave(); }
+  } gate_leave{ info.gate };
+  std::unique_lock<std::mutex> lock;
+  if (info.child_lock)
+    lock = std::unique_lock<std::mutex>(*info.child_lock);
+  if (info.convert_input) {
+    // the converted samples go straight into the ring, frames may wrap around
+    while (count > 0) {
+      const size_t frames = std::min(count, info.convert_buf.size() / info.bytes_per_sample / channels);
+      info.child->GetAudio(info.convert_buf.data(), info.fetch_start, frames, env);
+      const size_t total = frames * channels;
+      size_t done = 0;
+      while (done < total) {
+        size_t span;
+        sox_sample_t* target = info.inputbuf.write_span(span);
+        span = std::min(span, total - done);
+        info.clips += info.convert_input(info.convert_buf.data() + done * info.bytes_per_sample, target, span);
+        info.inputbuf.commit_write(span);
+        done += span;
+      }
+      info.fetch_start += frames;
+      count -= frames;
+    }
+    return;
+  }
+  while (count > 0) {
+    size_t span;
+    sox_sample_t* target = info.inputbuf.write_span(span);
+    size_t frames = std::min(count, span / channels);
+    if (frames > 0) {
+      info.child->GetAudio(target, info.fetch_start, frames, env);
+      info.inputbuf.commit_write(frames * channels);
+    }
+    else {
+      // a frame would wrap around the end of the ring
+      frames = 1;
+      info.child->GetAudio(info.frame_buf.data(), info.fetch_start, 1, env);
+      info.inputbuf.write(info.frame_buf.data(), channels);
+    }
+    info.fetch_start += frames;
+    count -= frames;
+  }
+}
+
+// child position of the next sample the chain reads
+static int64_t input_read_start(const avs_in_info_t& info)
+{
+  return info.read_start;
+}
+
+// drops the buffered input, next read will continue from child position 'start'
+static void input_seek(avs_in_info_t& info, int64_t start)
+{
+  if (info.prefetcher)
+    info.prefetcher->stop(); // restarted by the next read
+  info.inputbuf.reset();
+  info.fetch_start = start;
+  info.read_start = start;
+}
+
 typedef struct avs_out_info_t {
   size_t sample_count_getaudio;
   size_t output_sample_counter;
-  size_t remaining_precalculated_samples;
-  size_t precalc_ptr;
-  sox_sample_t* output_sample_buf;
-  std::vector<sox_sample_t> precalc_buf; // sox_sample_t = int32_t
+  sox_sample_t* output_sample_buf; // holds float samples when convert_output is set
+  RingBuffer<sox_sample_t> precalc; // samples the chain produced beyond the actual request
+  from_sample_fn convert_output; // to float in nativefloat mode; nullptr: no conversion
 } avs_out_info_t;
 
+// Appends count samples to the output buffer, converted to the output sample type
+static void output_append(avs_out_info_t& out, const sox_sample_t* src, size_t count)
+{
+  sox_sample_t* target = &out.output_sample_buf[out.output_sample_counter];
+  if (out.convert_output)
+    out.convert_output(src, target, count);
+  else
+    memcpy(target, src, count * sizeof(sox_sample_t));
+  out.output_sample_counter += count;
+}
+
+// Moves up to 'count' samples from the precalc ring to the output buffer
+static size_t output_append_precalc(avs_out_info_t& out, size_t count)
+{
+  size_t done = 0;
+  while (done < count) {
+    size_t span;
+    const sox_sample_t* src = out.precalc.read_span(span);
+    span = std::min(span, count - done);
+    if (span == 0)
+      break;
+    output_append(out, src, span);
+    out.precalc.commit_read(span);
+    done += span;
+  }
+  return done;
+}
+
+// private data of the 'input' and 'output' effects
+typedef struct avs_privdata_t {
+  SoxFilter* caller;
+  avs_in_info_t* in_info; // the filter's own, or the one of a segment renderer
+  avs_out_info_t* out_info;
+} avs_privdata_t;
+
+// An independent chain rendering one segment of the timeline, see RenderSegments.
+typedef struct segment_renderer_t {
+  avs_in_info_t in_info;
+  avs_out_info_t out_info;
+  int64_t index; // segment number; -1: none rendered yet
+  std::vector<sox_sample_t> samples; // output of the segment
+} segment_renderer_t;
+
+// A worker stage of the pipeline: some consecutive effects in a chain of their own,
+// run on a separate thread. Its output is queued for the next stage's 'pipe_in'.
+typedef struct pipeline_stage_t {
+  size_t first_effect; // effect_descs[first_effect..last_effect)
+  size_t last_effect;
+  sox_effects_chain_t* chain;
+  RingBuffer<sox_sample_t> queue;
+  std::unique_ptr<RingProducer<sox_sample_t>> worker;
+  size_t produce_count; // samples (all channels) produced at least by one worker step
+  size_t produced; // in the current worker step
+} pipeline_stage_t;
+
+typedef struct pipe_privdata_t {
+  SoxFilter* caller;
+  pipeline_stage_t* stage; // 'pipe_in': the upstream stage, 'pipe_out': its own stage
+} pipe_privdata_t;
+
+// Per-channel flows of an effect without SOX_EFF_MCHAN, run in parallel.
+// The effect itself is held in a chain of its own which is never flowed,
+// sox_add_effect set it up there the usual way: one flow per channel.
+// The actual chain gets a multichannel 'parallel' effect calling those flows.
+typedef struct parallel_flows_t {
+  sox_effects_chain_t* host; // host->effects[0][0..flows)
+  ThreadPool* pool;
+  std::vector<std::vector<sox_sample_t>> ibufc; // deinterleaved, per flow
+  std::vector<std::vector<sox_sample_t>> obufc;
+  std::vector<size_t> idonec;
+  std::vector<size_t> odonec;
+  std::vector<int> statuses;
+} parallel_flows_t;
+
+typedef struct parallel_privdata_t {
+  parallel_flows_t* state; // owned, deleted by the 'kill' of the effect
+} parallel_privdata_t;
+
+// Private data of the libsox biquad family, as in libsox' biquad.h (priv_t).
+// The effects' start designs the filter and leaves the normalized coefficients here.
+typedef struct libsox_biquad_priv_t {
+  double gain;
+  double fc;
+  double width;
+  int width_type; // width_t
+  int filter_type; // filter_t
+  double b0, b1, b2;
+  double a0, a1, a2;
+  sox_sample_t i1, i2;
+  double o1, o2;
+} libsox_biquad_priv_t;
+
+// Private data of the 'biquads' effect, see add_effect_biquad.
+// Followed by biquad_coefs_t[sections] and the filter memory (biquad_state_size doubles):
+// the whole state is in the private area, it can be checkpointed with a memory copy.
+typedef struct biquads_privdata_t {
+  const biquad_kernels_t* kernels;
+  size_t sections;
+  size_t channels;
+} biquads_privdata_t;
+
+static size_t biquads_priv_size(size_t sections, size_t channels)
+{
+  return sizeof(biquads_privdata_t) + sections * sizeof(biquad_coefs_t) + biquad_state_size(sections, channels) * sizeof(double);
+}
+
+static biquad_coefs_t* biquads_coefs(biquads_privdata_t* p)
+{
+  return reinterpret_cast<biquad_coefs_t*>(p + 1);
+}
+
+static double* biquads_state(biquads_privdata_t* p)
+{
+  return reinterpret_cast<double*>(biquads_coefs(p) + p->sections);
+}
+
+// libsox' fifo_t, dft_filter_t and dft_filter_priv_t, as in libsox' fifo.h and dft_filter.h.
+// sinc and fir design their FIR filter in start and leave its spectrum here.
+typedef struct libsox_fifo_t {
+  char* data;
+  size_t allocation;
+  size_t item_size;
+  size_t begin;
+  size_t end;
+} libsox_fifo_t;
+
+typedef struct libsox_dft_filter_t {
+  int dft_length, num_taps, post_peak;
+  double* coefs;
+} libsox_dft_filter_t;
+
+typedef struct libsox_dft_filter_priv_t {
+  sox_uint64_t samples_in, samples_out;
+  libsox_fifo_t input_fifo, output_fifo;
+  libsox_dft_filter_t filter, * filter_ptr;
+} libsox_dft_filter_priv_t;
+
+// The priv_t of sinc.c and fir.c, only used for their exact size: the layouts above are
+// the ones of libsox 14.4, other versions leave sinc and fir to libsox' dft_filter.
+typedef struct libsox_sinc_priv_t {
+  libsox_dft_filter_priv_t base;
+  double att, beta, phase, Fc0, Fc1, tbw0, tbw1;
+  int num_taps[2];
+  sox_bool round;
+} libsox_sinc_priv_t;
+
+typedef struct libsox_fir_priv_t {
+  libsox_dft_filter_priv_t base;
+  char const* filename;
+  double* h;
+  int n;
+} libsox_fir_priv_t;
+
+#if SOX_LIB_VERSION_CODE >= SOX_LIB_VERSION(14, 4, 0) && SOX_LIB_VERSION_CODE < SOX_LIB_VERSION(14, 5, 0)
+#define SOXFILTER_LIBSOX_DFT_FILTER_LAYOUT
+#endif
+
+// Private data of the 'fftconv' effect, see add_effect_fftconv
+typedef struct fftconv_privdata_t {
+  PartitionedConvolver* conv; // owned, deleted by the 'kill' of the effect
+  ThreadPool* pool; // nullptr: the channel pairs are filtered one after another
+  bool flushed; // the input has ended
+} fftconv_privdata_t;
+
+// Private data of the 'polyphase' effect, see add_effect_polyphase
+typedef struct polyphase_privdata_t {
+  PolyphaseResampler* resampler; // owned, deleted by the 'kill' of the effect
+} polyphase_privdata_t;
+
+typedef struct probe_privdata_t {
+  size_t remaining; // samples (all channels) to generate, 0 for the output end
+  uint32_t seed;
+} probe_privdata_t;
+
+// Snapshot of the whole effect chain state at a given output position.
+// Restoring it into the very same chain and continuing the flow gives the
+// same output as if the flow had never been interrupted.
+typedef struct chain_checkpoint_t {
+  int64_t position; // output sample position (not ChannelCount aware) this state belongs to
+  // 'input' effect: child position of the next sample read
+  int64_t input_position;
+  // per effect (first flow): pending output buffer content and positions
+  std::vector<size_t> obegs;
+  std::vector<size_t> oends;
+  std::vector<size_t> imins;
+  std::vector<sox_sample_t> obufs; // concatenated obuf[obeg..oend) of all effects
+  // per flow: private effect state
+  std::vector<sox_uint64_t> clips;
+  std::vector<uint8_t> privs; // concatenated priv areas
+  // precalculated but not yet consumed output samples
+  std::vector<sox_sample_t> precalc;
+} chain_checkpoint_t;
+
+// Effects whose complete running state is held inside their 'priv' area,
+// without heap allocated delay lines or fifos. Such a state can be saved and
+// restored with a plain memory copy. Pointers in their priv (e.g. remix's
+// output channel specs) only refer to option data, which stays constant for
+// the whole lifetime of the chain.
+static const char* const checkpointable_effects[] = {
+  "allpass", "band", "bandpass", "bandreject", "bass", "treble", "equalizer",
+  "highpass", "lowpass", "biquad", "deemph", "riaa",
+  "vol", "dcshift", "remix",
+  nullptr
+};
+
+static bool is_checkpointable_effect(const std::string& name)
+{
+  for (int i = 0; checkpointable_effects[i]; i++)
+    if (name == checkpointable_effects[i])
+      return true;
+  return false;
+}
+
+// How far back an effect's output at a given sample depends on its input.
+enum effect_history_t {
+  HISTORY_NONE,      // output depends only on the actual input sample(s)
+  HISTORY_FINITE,    // bounded (or quickly decaying) impulse response: a pre-roll is enough
+  HISTORY_UNBOUNDED  // output depends on the whole stream from the very first sample
+};
+
+typedef struct effect_history_info_t {
+  const char* name;
+  effect_history_t history;
+} effect_history_info_t;
+
+// Effects not listed here are considered as HISTORY_UNBOUNDED,
+// e.g. reverb, compand, echo, echos, chorus, flanger, phaser, tremolo.
+static const effect_history_info_t effect_histories[] = {
+  { "vol", HISTORY_NONE },
+  { "dcshift", HISTORY_NONE },
+  { "remix", HISTORY_NONE },
+  { "channels", HISTORY_NONE },
+  { "swap", HISTORY_NONE },
+  // biquads are IIR filters, but their response decays below the 32 bit
+  // sample resolution in a short time
+  { "allpass", HISTORY_FINITE },
+  { "band", HISTORY_FINITE },
+  { "bandpass", HISTORY_FINITE },
+  { "bandreject", HISTORY_FINITE },
+  { "bass", HISTORY_FINITE },
+  { "treble", HISTORY_FINITE },
+  { "equalizer", HISTORY_FINITE },
+  { "highpass", HISTORY_FINITE },
+  { "lowpass", HISTORY_FINITE },
+  { "biquad", HISTORY_FINITE },
+  { "deemph", HISTORY_FINITE },
+  { "riaa", HISTORY_FINITE },
+  // FIR filters
+  { "sinc", HISTORY_FINITE },
+  { "fir", HISTORY_FINITE },
+  { "earwax", HISTORY_FINITE },
+  { "hilbert", HISTORY_FINITE },
+  // linear phase lowpass, its delay is compensated; positions are mapped by rate_ratio
+  { "rate", HISTORY_FINITE },
+  { nullptr, HISTORY_UNBOUNDED }
+};
+
+// The biquad family (allpass, band, bandpass, bandreject, bass, treble, equalizer, highpass,
+// lowpass, biquad, deemph, riaa) shares libsox' lsx_biquad_flow and private data layout
+static bool is_biquad_handler(const sox_effect_handler_t* handler)
+{
+  const sox_effect_handler_t* biquad = sox_find_effect("biquad");
+  return handler && biquad && handler->flow == biquad->flow && handler->priv_size == sizeof(libsox_biquad_priv_t);
+}
+
+// sinc and fir run libsox' dft_filter flow on a priv_t beginning with dft_filter_priv_t.
+// Their priv_size must be the one of libsox_sinc_priv_t or libsox_fir_priv_t exactly.
+static bool is_dft_filter_handler(const sox_effect_handler_t* handler)
+{
+#ifdef SOXFILTER_LIBSOX_DFT_FILTER_LAYOUT
+  const sox_effect_handler_t* sinc = sox_find_effect("sinc");
+  const sox_effect_handler_t* fir = sox_find_effect("fir");
+  if (!handler || !sinc || !fir || sinc->flow != fir->flow || handler->flow != sinc->flow)
+    return false;
+  if (!strcmp(handler->name, "sinc"))
+    return handler->priv_size == sizeof(libsox_sinc_priv_t);
+  if (!strcmp(handler->name, "fir"))
+    return handler->priv_size == sizeof(libsox_fir_priv_t);
+#endif
+  return false;
+}
+
+// The taps of a dft_filter_t. Its coefs are the real FFT (Ooura's rdft: a[2k] = Re X[k],
+// a[2k + 1] = -Im X[k], a[1] = X[n/2]) of the taps rotated so that the last one is at 0,
+// scaled by 2 / dft_length. The inverse is done on the whole complex spectrum.
+static bool get_dft_filter_taps(const libsox_dft_filter_t& f, std::vector<double>& h)
+{
+  const size_t n = f.dft_length > 0 ? (size_t)f.dft_length : 0;
+  const size_t taps = f.num_taps > 0 ? (size_t)f.num_taps : 0;
+  if (!f.coefs || taps == 0 || n < 4 || (n & (n - 1)) || taps >= n)
+    return false;
+  std::vector<double> re(n), im(n);
+  re[0] = f.coefs[0];
+  re[n / 2] = f.coefs[1];
+  for (size_t k = 1; k < n / 2; k++) {
+    re[k] = re[n - k] = f.coefs[2 * k];
+    im[k] = -f.coefs[2 * k + 1];
+    im[n - k] = f.coefs[2 * k + 1];
+  }
+  FFT<double>(n).inverse_unscaled(re.data(), im.data());
+  h.resize(taps);
+  for (size_t i = 0; i < taps; i++)
+    h[i] = 0.5 * re[(i + n - taps + 1) & (n - 1)];
+  return true;
+}
+
+// The output length of an effect in samples, of whole frames. sox_add_effect rescales
+// the length of rate changing effects in double, without considering the channels:
+//   effp->out_signal.length = effp->out_signal.length / in->rate * effp->out_signal.rate + .5;
+// Example (old rate = 48000; new rate = 48100), in: 2884481 frames, 2 channels = 5768962 samples
+// out (exact): 2 * round(2884481 * 481 / 480) = 2 * round(2890490.335) = 5780980
+// out (sox)  : round(5768962 / 48000.0 * 48100.0) = round(5780980.670) = 5780981
+// and on long material the double drifts from the count rate really gives.
+// Here the frames are rescaled with the exact ratio of the rates, rounded like rate does.
+static sox_uint64_t get_output_length(const sox_signalinfo_t& in, const sox_signalinfo_t& out, unsigned int flags)
+{
+  if (in.length == 0 || in.length == SOX_UNKNOWN_LEN || out.length == 0 || out.length == SOX_UNKNOWN_LEN)
+    return out.length; // unknown
+  int64_t frames = (int64_t)(in.length / in.channels);
+  if (flags & SOX_EFF_LENGTH)
+    frames = (int64_t)(out.length / out.channels); // trim, pad, ...: the effect knows
+  else if (in.rate != out.rate)
+    frames = rational_scale_round(frames, rational_div(rational_from_double(out.rate), rational_from_double(in.rate)));
+  return (sox_uint64_t)frames * out.channels;
+}
+
+static effect_history_t get_effect_history(const std::string& name, const sox_effect_handler_t* handler)
+{
+  // sample positions would not map between input and output; rate changes are
+  // mapped exactly (see rate_ratio), but only the effects listed resample that way
+  if (handler == nullptr || (handler->flags & SOX_EFF_LENGTH))
+    return HISTORY_UNBOUNDED;
+  for (int i = 0; effect_histories[i].name; i++)
+    if (name == effect_histories[i].name)
+      return effect_histories[i].history;
+  return HISTORY_UNBOUNDED;
+}
+
+// An effect from the filter parameters, parsed once at filter creation.
+// Chain (re)builds use it without any string processing or allocation.
+typedef struct effect_desc_t {
+  std::string name;
+  const sox_effect_handler_t* handler;
+  // effect parameters as zero terminated strings, one after the other
+  std::vector<char> arg_storage; // pristine
+  std::vector<char> arg_work; // passed to the effect, may be modified by its getopts
+  std::vector<char*> argv; // points into arg_work
+  effect_history_t history;
+  bool changes_rate;
+  bool changes_channels;
+  bool biquad; // can be run by the biquad engine
+  bool dft_filter; // sinc, fir: can be run by the FFT convolver
+  bool cacheable; // its design depends on its parameters and input signal only, see design_cache
+  bool polyphase; // rate -P: can be run by the polyphase resampler, see add_effect_polyphase
+  char rate_quality; // of rate -P: q, l, m, h or v
+  bool linear_gain; // plain multiplication by 'gain', see parse_linear_gain
+  double gain;
+  sox_signalinfo_t in_signal; // input signal of the effect, known after the first build
+} effect_desc_t;
+
+// libsox' dB_to_linear
+static double db_to_linear(double db)
+{
+  return exp(db * 2.30258509299404568402 /* M_LN10 */ * 0.05);
+}
+
+// Parses the parameters of 'vol' without limiter and 'gain' without options
+// (normalise, limiter, balance, headroom) the way their getopts do. These effects multiply
+// each sample by a constant gain, then clip it; gain rounds it like a biquad section does,
+// vol truncates it (see biquad_is_gain).
+// Returns false for anything else, those remain libsox effects.
+static bool parse_linear_gain(const effect_desc_t& desc, double& gain)
+{
+  const size_t argc = desc.argv.size();
+  char* end;
+  if (desc.name == "gain") {
+    if (argc == 0) {
+      gain = 1.0;
+      return true;
+    }
+    if (argc != 1)
+      return false;
+    const double db = strtod(desc.argv[0], &end);
+    if (end == desc.argv[0] || *end != '\0')
+      return false; // an option
+    gain = db_to_linear(db);
+    return true;
+  }
+  if (desc.name == "vol") {
+    // vol GAIN [TYPE], the type may be appended to the gain: "-3dB"
+    if (argc == 0 || argc > 2)
+      return false; // third one: limiter
+    gain = strtod(desc.argv[0], &end);
+    if (end == desc.argv[0])
+      return false;
+    while (*end == ' ')
+      end++;
+    std::string type = end;
+    if (!type.empty() && argc == 2)
+      return false; // limiter
+    if (type.empty() && argc == 2)
+      type = desc.argv[1];
+    // case insensitive abbreviations, like lsx_find_enum_text
+    auto is_type = [&type](const std::string& name) {
+      return !type.empty() && type.size() <= name.size() &&
+        std::equal(type.begin(), type.end(), name.begin(), [](char a, char b) { return tolower(a) == tolower(b); });
+    };
+    if (type.empty() || is_type("amplitude"))
+      return true;
+    if (is_type("dB")) {
+      gain = db_to_linear(gain);
+      return true;
+    }
+    if (is_type("power") && gain > 0) {
+      gain = sqrt(gain);
+      return true;
+    }
+    return false;
+  }
+  return false;
+}
+
+// Fills desc from e.g. "sinc -n 29 -b 100 7000". Returns false if no effect name was given.
+// desc must already be at its final place: argv points into its own buffer.
+static bool parse_effect_desc(const std::string& arg_str, effect_desc_t& desc)
+{
+  std::vector<std::string> arg_list_array;
+
+  std::istringstream find_in_this(arg_str);
+  std::string one_string;
+  while (std::getline(find_in_this, one_string, ' ')) {
+    arg_list_array.push_back(one_string);
+  }
+  if (arg_list_array.empty() || arg_list_array[0].empty())
+    return false;
+
+  // First argument is the effect name
+  desc.name = arg_list_array[0];
+
+  // rate -P is SoxFilter's: the polyphase resampler, libsox does not see the option.
+  // Only a quality option may come with it, libsox' rate runs the other ones.
+  desc.polyphase = false;
+  desc.rate_quality = 'h';
+  if (desc.name == "rate") {
+    const size_t count = arg_list_array.size();
+    arg_list_array.erase(std::remove(arg_list_array.begin() + 1, arg_list_array.end(), "-P"), arg_list_array.end());
+    if (arg_list_array.size() < count) {
+      size_t rates = 0;
+      desc.polyphase = true;
+      for (size_t i = 1; i < arg_list_array.size(); i++) {
+        const std::string& param = arg_list_array[i];
+        if (param.size() == 2 && param[0] == '-' && get_resample_quality(param[1]))
+          desc.rate_quality = param[1];
+        else if (param.empty() || param[0] == '-' || ++rates > 1)
+          desc.polyphase = false;
+      }
+      if (!desc.polyphase)
+        _RPT1(0, "SoxFilter: rate -P with other options than the quality (%s), libsox' rate runs\n", arg_str.c_str());
+    }
+  }
+
+  // The rest (size-1) strings are effect parameters
+  const size_t num_params = arg_list_array.size() - 1;
+  std::vector<size_t> offsets(num_params);
+  for (size_t i = 0; i < num_params; i++) {
+    offsets[i] = desc.arg_storage.size();
+    const std::string& param = arg_list_array[i + 1];
+    desc.arg_storage.insert(desc.arg_storage.end(), param.begin(), param.end());
+    desc.arg_storage.push_back('\0');
+  }
+  desc.arg_work = desc.arg_storage;
+  desc.argv.resize(num_params);
+  for (size_t i = 0; i < num_params; i++)
+    desc.argv[i] = desc.arg_work.data() + offsets[i];
+
+  // Find a named effect in the effects library
+  desc.handler = sox_find_effect(desc.name.c_str());
+  desc.history = get_effect_history(desc.name, desc.handler);
+  desc.changes_rate = desc.handler && (desc.handler->flags & SOX_EFF_RATE);
+  desc.changes_channels = desc.handler && (desc.handler->flags & SOX_EFF_CHAN);
+  desc.biquad = is_biquad_handler(desc.handler);
+  desc.dft_filter = is_dft_filter_handler(desc.handler);
+  // fir may read its coefficients from a file, which can change
+  char* end;
+  desc.cacheable = !(desc.name == "fir" && num_params == 1 && (strtod(desc.argv[0], &end), *end != '\0'));
+  desc.gain = 1.0;
+  desc.linear_gain = desc.handler && parse_linear_gain(desc, desc.gain);
+  return true;
+}
+
+// A filter designed by libsox
+typedef struct effect_design_t {
+  bool active; // false: the effect has nothing to do with its options
+  std::vector<biquad_coefs_t> sections; // biquad family
+  // sinc, fir: libsox' filter (coefs is dft_coefs) and its taps, empty if it could not be read
+  libsox_dft_filter_t dft_filter;
+  std::vector<double> dft_coefs;
+  std::vector<double> h;
+  size_t delay; // of the output, see PartitionedConvolver
+} effect_design_t;
+
+// Designs and FFT convolver filters shared by all SoxFilter instances of the process:
+// identical instances, and every chain rebuild (restart, spare chain, segments), take the
+// filter designed once. Bounded by their size in bytes.
+static SharedCache<effect_design_t> design_cache(64 << 20);
+static SharedCache<conv_filter_t> conv_filter_cache(64 << 20);
+static SharedCache<poly_filter_t> poly_filter_cache(64 << 20);
+// Processing times of the effects, see MeasureEffectCosts
+static SharedCache<double> effect_cost_cache(1 << 20);
+
+// The FFT length libsox' FFT table was grown to by the sinc and fir designs since sox_init,
+// under effect_build_lock. libsox grows the table when an effect starts (lsx_safe_rdft), a
+// cached design skips that: it is only taken up to this length, see get_design.
+static int fft_table_length = 0;
+
+// Releases libsox for one user, the last one quits it. sox_quit frees the FFT table:
+// the sinc and fir designs, which rely on it, are dropped with it.
+static void release_sox()
+{
+  if (--sox_init_counter != 0)
+    return;
+  std::lock_guard<std::mutex> build_lock(effect_build_lock);
+  design_cache.erase_if([](const effect_design_t& design) { return !design.dft_coefs.empty(); });
+  fft_table_length = 0;
+  sox_quit();
+}
+
+// Effect name, parameters, sample rate and channel count: what a design depends on
+static std::string design_key(const effect_desc_t& desc, const sox_signalinfo_t& signalinfo)
+{
+  char signal[64];
+  snprintf(signal, sizeof(signal), "%.17g/%u", signalinfo.rate, (unsigned)signalinfo.channels);
+  std::string key = desc.name;
+  key += '\0';
+  key.append(desc.arg_storage.begin(), desc.arg_storage.end()); // each one zero terminated
+  key += signal;
+  return key;
+}
+
+static size_t design_size(const effect_design_t& design)
+{
+  return sizeof(effect_design_t) + design.sections.size() * sizeof(biquad_coefs_t)
+    + (design.dft_coefs.size() + design.h.size()) * sizeof(double);
+}
+
+// The partitioned spectra of a sinc or fir design, made once per key
+static std::shared_ptr<const conv_filter_t> get_conv_filter(const std::string& key, const effect_design_t& design)
+{
+  std::shared_ptr<const conv_filter_t> filter = key.empty() ? nullptr : conv_filter_cache.find(key);
+  if (!filter) {
+    filter = make_conv_filter(design.h.data(), design.h.size());
+    if (!key.empty())
+      conv_filter_cache.insert(key, filter, sizeof(conv_filter_t) + (filter->h_re.size() + filter->h_im.size()) * sizeof(float));
+  }
+  return filter;
+}
+
+// Gives the cached filter to a sinc or fir effect e created with its options: its start
+// finds the filter designed already and skips the design, like the start of its other flows.
+// The coefficients are freed by libsox (dft_filter's stop).
+static void set_dft_filter(sox_effect_t* e, const effect_design_t& design)
+{
+  libsox_dft_filter_priv_t* p = reinterpret_cast<libsox_dft_filter_priv_t*>(e->priv);
+  if (design.dft_coefs.empty() || p->filter_ptr != &p->filter || p->filter.num_taps != 0)
+    return;
+  double* coefs = reinterpret_cast<double*>(malloc(design.dft_coefs.size() * sizeof(double)));
+  if (!coefs)
+    return;
+  std::copy(design.dft_coefs.begin(), design.dft_coefs.end(), coefs);
+  p->filter = design.dft_filter;
+  p->filter.coefs = coefs;
+}
+
 class SoxFilter : public GenericVideoFilter
 {
 public:
@@ -164,11 +907,67 @@ public:
     return 0;
   }
 
-  void add_effect_output(sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, IScriptEnvironment* env);
-  void add_effect_input(sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, IScriptEnvironment* env);
+  void add_effect_output(sox_effects_chain_t* new_chain, avs_out_info_t* out, sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, IScriptEnvironment* env);
+  void add_effect_input(sox_effects_chain_t* new_chain, avs_in_info_t* in, sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, IScriptEnvironment* env);
   void init_signalinfos(sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, sox_encodinginfo_t& encodinginfo_in, sox_encodinginfo_t& encodinginfo_out);
+  void add_effect_pipe(sox_effects_chain_t* new_chain, sox_effect_handler_t const* handler, pipeline_stage_t* stage, sox_signalinfo_t& signalinfo, IScriptEnvironment* env);
+  void add_effect(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env);
+  int add_effect_parallel(sox_effects_chain_t* new_chain, sox_effect_t* e, sox_signalinfo_t& signalinfo);
+  sox_effect_t* create_effect(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env);
+  int design_biquad(sox_effects_chain_t* new_chain, sox_effect_t* e, const sox_signalinfo_t& signalinfo, std::vector<biquad_coefs_t>& sections);
+  int add_effect_biquads(sox_effects_chain_t* new_chain, const std::vector<biquad_coefs_t>& sections,
+    const char* name, unsigned int flags, sox_signalinfo_t& signalinfo);
+  void add_effects_fused_biquads(sox_effects_chain_t* new_chain, size_t first, size_t last, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env);
+  int design_fir(sox_effects_chain_t* new_chain, sox_effect_t* e, const sox_signalinfo_t& signalinfo, effect_design_t& design);
+  std::shared_ptr<const effect_design_t> get_design(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env);
+  int add_effect_fftconv(sox_effects_chain_t* new_chain, std::shared_ptr<const conv_filter_t> filter, size_t delay,
+    const char* name, unsigned int flags, sox_signalinfo_t& signalinfo);
+  bool add_effect_polyphase(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, int& sox_errno, IScriptEnvironment* env);
+  sox_effects_chain_t* build_effect_chain_part(bool first_time, size_t first, size_t last,
+    pipeline_stage_t* upstream, pipeline_stage_t* downstream, segment_renderer_t* segment, sox_signalinfo_t& signalinfo, IScriptEnvironment* env);
+  sox_effects_chain_t* build_effect_chain(bool first_time, IScriptEnvironment* env);
+  void instrument_chain_effects(sox_effects_chain_t* new_chain, size_t length, size_t index, bool first_time);
+  void LogStats();
   void rebuild_effect_chain(bool first_time, IScriptEnvironment* env);
   void RestartEffects(IScriptEnvironment* env);
+  void RenderAudio(void* buf, int64_t count, IScriptEnvironment* env);
+  void SkipAudio(int64_t count, IScriptEnvironment* env);
+  void SaveCheckpoint(int64_t position);
+  void RestoreCheckpoint(const chain_checkpoint_t& cp, IScriptEnvironment* env);
+  void SeekToCheckpoint(int64_t start, IScriptEnvironment* env);
+  void SeekWithPreroll(int64_t start, IScriptEnvironment* env);
+  // the last input position a chain can start from to reach output position 'start'
+  int64_t GetPrimeInputPosition(int64_t start) const {
+    const int64_t position = rational_scale_floor(start, rational_t{ rate_ratio.den, rate_ratio.num });
+    return position - position % input_period;
+  }
+  void PositionChain(int64_t start, IScriptEnvironment* env);
+  void RenderAhead();
+  void StopPipeline();
+  std::vector<double> MeasureEffectCosts(IScriptEnvironment* env);
+  double GetEffectHistorySeconds(effect_desc_t& desc, IScriptEnvironment* env);
+  void RenderSegment(segment_renderer_t& segment, int64_t index, bool replay);
+  void RenderSegments(int64_t first_index, IScriptEnvironment* env);
+  void GetSegmentedAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env);
+  bool HandlesSeeking() const { return checkpoint_interval > 0 || preroll_samples > 0 || segment_samples > 0; }
+  void StartSpareChain();
+  // false for effects of a spare or half-built chain
+  bool IsActiveChainEffect(const sox_effect_t* effp) const {
+    if (IsChainEffect(chain, effp))
+      return true;
+    for (const auto& stage : pipeline)
+      if (IsChainEffect(stage->chain, effp))
+        return true;
+    return false;
+  }
+  static bool IsChainEffect(const sox_effects_chain_t* c, const sox_effect_t* effp) {
+    if (c == nullptr)
+      return false;
+    for (size_t i = 0; i < c->length; i++)
+      if (c->effects[i] == effp)
+        return true;
+    return false;
+  }
 
   avs_in_info_t avs_in_info;
   avs_out_info_t out_info;
@@ -176,11 +975,81 @@ public:
 private:
   bool has_at_least_v10;
   sox_effects_chain_t* chain;
-  std::vector<std::string> effect_s_array;
+  std::vector<effect_desc_t> effect_descs;
+
+  // Request and per-effect counters, see SoxFilter_Stats.
+  // Before the chains, their effects use it until they are deleted.
+  std::unique_ptr<FilterStats> stats;
+  bool effect_timers; // the effects are instrumented, see instrument_effects
+  std::string stats_log; // file the counters are appended to, empty: no log
+  std::chrono::steady_clock::duration stats_interval; // of the log, 0: only at the end
+  std::chrono::steady_clock::time_point next_stats_log;
+  int64_t next_request_start; // where a sequential request would start
+  int64_t rendered_end; // the chain has rendered the output up to here, the rest is replayed
+  std::vector<bool> segments_rendered; // the segment was rendered once
   bool restarted;
   VideoInfo vi_orig;
+  int64_t next_output_start; // where the next sequential GetAudio would start
+
+  // checkpoints, see SeekToCheckpoint
+  int64_t checkpoint_interval; // in output samples; 0: checkpointing is off
+  int64_t next_checkpoint_position;
+  std::vector<chain_checkpoint_t> checkpoints; // sorted by position
+
+  // pre-roll seek, see SeekWithPreroll
+  int64_t preroll_samples; // 0: pre-roll seek is off
+
+  // Exact mapping of positions between the input and the output of the chain, see build_effect_chain
+  rational_t rate_ratio; // output frames per input frame
+  int64_t input_period; // input frames, the chain can start on its multiples
+
+  // A ready-made, never flowed chain, built in the background after each restart
+  bool use_spare_chain;
+  std::future<sox_effects_chain_t*> spare_chain;
+
+  RequestGate request_gate; // the workers call the child only during a GetAudio
+  std::unique_ptr<RingProducer<sox_sample_t>> prefetcher;
+
+  // render-ahead, see RenderAhead
+  int64_t render_chunk; // output samples rendered by one worker step; 0: render-ahead is off
+  RingBuffer<sox_sample_t> rendered; // rendered output, from ahead_read_position to next_output_start
+  std::vector<sox_sample_t> render_buf; // for a chunk which would wrap in the ring
+  int64_t ahead_read_position; // where the next sequential GetAudio would start
+  std::unique_ptr<RingProducer<sox_sample_t>> renderer;
+
+  // Pipeline stages, the actual chain runs the effects after the last stage.
+  // Empty: no pipeline, the actual chain runs all effects.
+  std::vector<std::unique_ptr<pipeline_stage_t>> pipeline;
+
+  // Runs the per-channel flows of the effects without SOX_EFF_MCHAN, see add_effect_parallel.
+  // nullptr: libsox processes the flows one after another.
+  std::unique_ptr<ThreadPool> flow_pool;
+
+  // segment-parallel rendering, see RenderSegments
+  int64_t segment_samples; // output samples per segment; 0: segments are off
+  std::vector<std::unique_ptr<segment_renderer_t>> segments; // one per worker, they also hold the rendered segments
+  std::unique_ptr<ThreadPool> segment_pool;
+  std::mutex child_lock; // serializes child->GetAudio of the segment chains
+
+  const sample_converters_t* converters; // for the CPU
+
+  // Runs the biquad family instead of libsox, see add_effect_biquad.
+  // nullptr: libsox runs them.
+  const biquad_kernels_t* biquad_kernels;
+
+  // Runs sinc and fir filters of at least fftconv_taps taps on the FFT convolver instead
+  // of libsox, see add_effect_fftconv. 0: libsox runs them.
+  size_t fftconv_taps;
+  const conv_kernels_t* conv_kernels;
+
+  // Runs rate -P, see add_effect_polyphase
+  const resample_kernels_t* resample_kernels;
 };
 
+// Maximum number of checkpoints kept per filter instance. When reached,
+// every second checkpoint is dropped and the interval is doubled.
+constexpr size_t MAX_CHECKPOINTS = 1024;
+
 #ifdef OUTPUT_MESSAGE_HANDLER_BUFFERS
 #include <mutex>
 std::mutex errormessagemutex;
@@ -225,24 +1094,26 @@ static void output_message(unsigned level, const char *filename, const char *fmt
 
 // ------------------------ output ------------------------------
 // Final 'effect' in the chain: output, copy back to Avisynth GetAudio buffer
-void SoxFilter::add_effect_output(sox_signalinfo_t &signalinfo_in, sox_signalinfo_t &signalinfo_out, IScriptEnvironment* env) {
+void SoxFilter::add_effect_output(sox_effects_chain_t* new_chain, avs_out_info_t* out, sox_signalinfo_t &signalinfo_in, sox_signalinfo_t &signalinfo_out, IScriptEnvironment* env) {
   sox_effect_t* e;
   int sox_errno;
 
   e = sox_create_effect(output_handler());
   if (!e) {
-    sox_delete_effects_chain(chain);
-    env->ThrowError("SoxFilter: error creating output handler\n");
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: error creating output handler\n");
   }
   avs_privdata_t priv_for_output;
   priv_for_output.caller = this; // to access the Avisynth SoxFilter class variables 
+  priv_for_output.in_info = nullptr;
+  priv_for_output.out_info = out;
   *reinterpret_cast<avs_privdata_t*>(e->priv) = priv_for_output; // whole struct copy
 
-  sox_errno = sox_add_effect(chain, e, &signalinfo_in, &signalinfo_in);
+  sox_errno = sox_add_effect(new_chain, e, &signalinfo_in, &signalinfo_in);
   free(e);
   if (sox_errno != SOX_SUCCESS) {
-    sox_delete_effects_chain(chain);
-    env->ThrowError("Error in creating effect 'output' as output_handler: %d %s\n", sox_errno, sox_strerror(sox_errno));
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "Error in creating effect 'output' as output_handler: %d %s\n", sox_errno, sox_strerror(sox_errno));
   }
 }
 
@@ -252,24 +1123,26 @@ void SoxFilter::add_effect_output(sox_signalinfo_t &signalinfo_in, sox_signalinf
 // from our internal buffer.
 // This buffer is filled by calling child's GetAudio
 // on demand, asynchronously.
-void SoxFilter::add_effect_input(sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, IScriptEnvironment* env) {
+void SoxFilter::add_effect_input(sox_effects_chain_t* new_chain, avs_in_info_t* in, sox_signalinfo_t& signalinfo_in, sox_signalinfo_t& signalinfo_out, IScriptEnvironment* env) {
   sox_effect_t* e;
   int sox_errno;
 
   e = sox_create_effect(input_handler());
   if (!e) {
-    sox_delete_effects_chain(chain);
-    env->ThrowError("SoxFilter: error creating input handler\n");
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: error creating input handler\n");
   }
   avs_privdata_t priv_for_input;
   priv_for_input.caller = this; // to access the Avisynth SoxFilter class variables 
+  priv_for_input.in_info = in;
+  priv_for_input.out_info = nullptr;
   *reinterpret_cast<avs_privdata_t*>(e->priv) = priv_for_input; // whole struct copy
   // This input drain becomes the first effect in the chain
-  sox_errno = sox_add_effect(chain, e, &signalinfo_in, &signalinfo_in);
+  sox_errno = sox_add_effect(new_chain, e, &signalinfo_in, &signalinfo_in);
   free(e);
   if (sox_errno != SOX_SUCCESS) {
-    sox_delete_effects_chain(chain);
-    env->ThrowError("Error in creating effect 'input' as input_handler: %d %s\n", sox_errno, sox_strerror(sox_errno));
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "Error in creating effect 'input' as input_handler: %d %s\n", sox_errno, sox_strerror(sox_errno));
   }
 }
 
@@ -295,154 +1168,510 @@ void SoxFilter::init_signalinfos(sox_signalinfo_t& signalinfo_in, sox_signalinfo
   signalinfo_out = signalinfo_in;
 }
 
-void SoxFilter::rebuild_effect_chain(bool first_time, IScriptEnvironment *env)
+// Creates the effect described by desc, initialised with its parameters.
+// signalinfo is the input signal of the effect.
+// desc's argument buffer is shared by the chains built concurrently (spare chain, segments),
+// getopts may keep pointers into it: the caller holds effect_build_lock until the effect is
+// added to a chain (or freed).
+sox_effect_t* SoxFilter::create_effect(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env)
 {
   int sox_errno;
 
-  sox_signalinfo_t signalinfo_in;
-  sox_signalinfo_t signalinfo_out;
-  sox_encodinginfo_t encodinginfo_in;
-  sox_encodinginfo_t encodinginfo_out;
-
-  init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out); // all refs. Work by vi_orig
-
-  // Create an effects chain; some effects need to know about the input
-  // or output file encoding so we provide that information here
-  // In Avisynth this is fixed and the setting is the same for both in and out
-  chain = sox_create_effects_chain(&encodinginfo_in, &encodinginfo_out);
-  if (!chain)
-    env->ThrowError("SoxFilter: error creating effect chain\n");
+  // Create the effect, and initialise it with the parameters
+  sox_effect_t* e = sox_create_effect(desc.handler);
+  if (!e) {
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: (%s) Cannot create effect: sox_create_effect failed.\n", desc.name.c_str());
+  }
 
-  // -------------- input ------------------------------------------
-  // The first effect in the effect chain: source.
-  add_effect_input(signalinfo_in, signalinfo_out, env);
+  // getopts receives non-const strings: start from the pristine copy each time
+  std::copy(desc.arg_storage.begin(), desc.arg_storage.end(), desc.arg_work.begin());
+  const int num_params = (int)desc.argv.size();
 
-  // --------------- effects ----------------------------------------
-  // Add effects one by one from SoxFilter's parameter(s)
-  for (auto arg_str : effect_s_array)
+  if (first_time)
+  { // mutex scope
+#ifdef OUTPUT_MESSAGE_HANDLER_BUFFERS
+    std::lock_guard<std::mutex> lock(errormessagemutex);
+    // Hijack it only for catching errors in 'options' processing
+    auto tmp_output_message_handler = sox_globals.output_message_handler;
+    sox_globals.output_message_handler = my_output_message;
+#endif
+    sox_errno = sox_effect_options(e, num_params, desc.argv.data());
+    if (sox_errno != SOX_SUCCESS) {
+      // "my_output_message" will add a more detailed error beforehand.
+      free(e);
+      sox_delete_effects_chain(new_chain);
+      std::string error_text = "SoxFilter: (" + desc.name + ") ";
+      error_text += "Error in options.\n" + errormessage;
+      throw_error(env, "%s", error_text.c_str());
+    }
+#ifdef OUTPUT_MESSAGE_HANDLER_BUFFERS
+    sox_globals.output_message_handler = tmp_output_message_handler;
+#endif
+    desc.in_signal = signalinfo;
+  }
+  else
   {
-    std::vector<std::string> arg_list_array;
+    // when called after a restart this shouldn't error out, ignore
+    sox_errno = sox_effect_options(e, num_params, desc.argv.data());
+  }
+  return e;
+}
 
-    std::istringstream find_in_this(arg_str);
-    std::string one_string;
-    while (std::getline(find_in_this, one_string, ' ')) {
-      arg_list_array.push_back(one_string);
-    }
+// Creates the effect described by desc and appends it to the chain.
+// signalinfo is the input signal of the effect, updated to its output signal.
+void SoxFilter::add_effect(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env)
+{
+  int sox_errno = SOX_SUCCESS;
+  const sox_signalinfo_t in_signal = signalinfo;
+
+  std::unique_lock<std::mutex> build_lock(effect_build_lock);
+  // the biquad engine and the FFT convolver take the filter libsox designed,
+  // libsox takes the one of sinc and fir from the cache as well
+  std::shared_ptr<const effect_design_t> design;
+  if ((biquad_kernels && desc.biquad) || desc.dft_filter)
+    design = get_design(new_chain, desc, signalinfo, first_time, env);
+
+  // sox_add_effect:
+  // signalinfo_in specifies the input signal info for this effect. 
+  // signalinfo_out is a suggestion as to what the output signal should be 
+  // but depending on the effects given options and on in the effect can choose 
+  // to do differently; we pass the same signalinfo_in for that.
+  // Whatever output rate and channels the effect does produce are written back to 
+  // signalinfo_in.
+  // It is meant that in be stored and passed to each new call to sox_add_effect so 
+  // that changes will be propagated to each new effect.
+
+  // Add the effect to the end of the effects processing chain
+  if (design && !design->active) {
+    // nothing to do with these options, libsox would not add it either
+  }
+  else if (desc.polyphase && add_effect_polyphase(new_chain, desc, signalinfo, first_time, sox_errno, env)) {
+    // the polyphase resampler stands for rate
+  }
+  else if (design && desc.biquad) {
+    build_lock.unlock(); // no libsox effect is started
+    sox_errno = add_effect_biquads(new_chain, design->sections, desc.handler->name, desc.handler->flags, signalinfo);
+    if (first_time)
+      stats->add_engine(desc.name + " -> biquads sections=" + std::to_string(design->sections.size()));
+  }
+  else if (design && fftconv_taps && !design->h.empty() && design->h.size() >= fftconv_taps) {
+    build_lock.unlock();
+    const std::string key = desc.cacheable ? design_key(desc, signalinfo) : std::string();
+    sox_errno = add_effect_fftconv(new_chain, get_conv_filter(key, *design), design->delay, desc.handler->name, desc.handler->flags, signalinfo);
+    if (first_time)
+      stats->add_engine(desc.name + " -> fftconv taps=" + std::to_string(design->h.size()));
+  }
+  else {
+    // short FIR filters stay with libsox' single FFT
+    sox_effect_t* e = create_effect(new_chain, desc, signalinfo, first_time, env);
+    if (design && desc.dft_filter)
+      set_dft_filter(e, *design);
+    if (flow_pool && !(desc.handler->flags & (SOX_EFF_MCHAN | SOX_EFF_CHAN)) && signalinfo.channels > 1)
+      sox_errno = add_effect_parallel(new_chain, e, signalinfo);
+    else
+      sox_errno = sox_add_effect(new_chain, e, &signalinfo, &signalinfo);
+    free(e);
+  }
+  if (build_lock.owns_lock())
+    build_lock.unlock();
+  if (sox_errno != SOX_SUCCESS) {
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: (%s) Cannot add effect to the chain.", desc.name.c_str());
+  }
+  signalinfo.length = get_output_length(in_signal, signalinfo, desc.handler->flags);
+}
 
-    // First argument is the effect name
-    const char* effect_name = arg_list_array[0].c_str();
+// Adds effect e to the chain with its per-channel flows run in parallel on flow_pool.
+// e is set up in a host chain of its own, with one flow per channel, the chain gets
+// a 'parallel' effect which has the same signal properties and calls those flows.
+// Effects sharing libsox' FFT table cache (sinc, rate) fill it in their start,
+// their flows only read it.
+int SoxFilter::add_effect_parallel(sox_effects_chain_t* new_chain, sox_effect_t* e, sox_signalinfo_t& signalinfo)
+{
+  sox_effects_chain_t* host = sox_create_effects_chain(new_chain->in_enc, new_chain->out_enc);
+  if (!host)
+    return SOX_ENOMEM;
+  sox_signalinfo_t signalinfo_out = signalinfo;
+  int sox_errno = sox_add_effect(host, e, &signalinfo_out, &signalinfo_out);
+  if (sox_errno != SOX_SUCCESS || host->length == 0) {
+    // error, or the effect has nothing to do with these options: libsox did not add it
+    sox_delete_effects_chain(host);
+    return sox_errno;
+  }
 
-    // create char * array from arglist[] elements
-    // The rest (size-1) strings are effect parameters
-    int num_params = (int)arg_list_array.size() - 1;
-    std::vector<char*> arglist_ptr(num_params);
-    for (int i = 0; i < num_params; i++)
-      arglist_ptr[i] = (char*)arg_list_array[i + 1].c_str();
+  sox_effect_t* w = sox_create_effect(parallel_handler());
+  if (!w) {
+    sox_delete_effects_chain(host);
+    return SOX_ENOMEM;
+  }
+  // same signal handling as of the effect, but all channels are passed at once
+  w->handler.name = host->effects[0]->handler.name;
+  w->handler.flags = host->effects[0]->handler.flags | SOX_EFF_MCHAN;
+  parallel_flows_t* state = new parallel_flows_t;
+  state->host = host;
+  state->pool = flow_pool.get();
+  reinterpret_cast<parallel_privdata_t*>(w->priv)->state = state;
+
+  sox_errno = sox_add_effect(new_chain, w, &signalinfo, &signalinfo_out);
+  free(w);
+  if (sox_errno != SOX_SUCCESS) {
+    sox_delete_effects_chain(host);
+    delete state;
+  }
+  return sox_errno;
+}
 
-    std::string error_text = "SoxFilter: (" + std::string(effect_name) + ") ";
-    bool ok = false;
+// The biquad family is run by the biquad engine instead of libsox.
+// The filter design is still libsox' own: the biquad effect e is started in a host chain
+// of its own, its coefficients are taken from its private data and appended to sections.
+// Nothing is appended if the effect has nothing to do with its options.
+int SoxFilter::design_biquad(sox_effects_chain_t* new_chain, sox_effect_t* e, const sox_signalinfo_t& signalinfo, std::vector<biquad_coefs_t>& sections)
+{
+  sox_effects_chain_t* host = sox_create_effects_chain(new_chain->in_enc, new_chain->out_enc);
+  if (!host)
+    return SOX_ENOMEM;
+  sox_signalinfo_t signalinfo_host = signalinfo;
+  signalinfo_host.channels = 1; // the design is the same for each channel
+  signalinfo_host.length = 0;
+  const int sox_errno = sox_add_effect(host, e, &signalinfo_host, &signalinfo_host);
+  // on error, or when the effect has nothing to do, libsox did not add it
+  if (sox_errno == SOX_SUCCESS && host->length > 0) {
+    const libsox_biquad_priv_t* p = reinterpret_cast<const libsox_biquad_priv_t*>(host->effects[0]->priv);
+    sections.push_back({ p->b0, p->b1, p->b2, p->a1, p->a2 });
+  }
+  sox_delete_effects_chain(host);
+  return sox_errno;
+}
 
-    sox_effect_t* e;
+// Appends a multichannel 'biquads' effect running the cascade of sections on all channels
+// at once, in SIMD lanes. name and flags are the ones of the effect(s) it stands for.
+int SoxFilter::add_effect_biquads(sox_effects_chain_t* new_chain, const std::vector<biquad_coefs_t>& sections,
+  const char* name, unsigned int flags, sox_signalinfo_t& signalinfo)
+{
+  const size_t channels = signalinfo.channels;
+  // the private area is sized for the sections and channels
+  sox_effect_handler_t handler = *biquads_handler();
+  handler.name = name;
+  handler.flags = flags | SOX_EFF_MCHAN;
+  handler.priv_size = biquads_priv_size(sections.size(), channels);
+  sox_effect_t* w = sox_create_effect(&handler);
+  if (!w)
+    return SOX_ENOMEM;
+  biquads_privdata_t* priv = reinterpret_cast<biquads_privdata_t*>(w->priv);
+  priv->kernels = biquad_kernels;
+  priv->sections = sections.size();
+  priv->channels = channels;
+  std::copy(sections.begin(), sections.end(), biquads_coefs(priv));
+
+  const int sox_errno = sox_add_effect(new_chain, w, &signalinfo, &signalinfo);
+  free(w);
+  return sox_errno;
+}
 
-    // Find a named effect in the effects library 
-    const sox_effect_handler_t* effect_handler = sox_find_effect(effect_name);
-    if (effect_handler == nullptr)
-      error_text += "Could not find effect.";
-    /* v2.1: Let's allow them, we can change the VideoInfo audio properties at the end.
-    // some checking on possible incompatibility
-    else if (effect_handler->flags & SOX_EFF_CHAN)
-      error_text += "Cannot run effects that change the number of channels.";
-    else if (effect_handler->flags & SOX_EFF_RATE)
-      error_text += "Cannot run effects that change the samplerate.";
-    */
-    else {
-      // Create the effect, and initialise it with the parameters
-      e = sox_create_effect(effect_handler);
-      if (!e)
-        error_text += "Cannot create effect: sox_create_effect failed.\n";
-      else
-        ok = true;
+// The filter of sinc and fir, for the FFT convolver and for libsox itself (see set_dft_filter).
+// The filter design is libsox' own: the effect e is started in a host chain of its own,
+// its spectrum is copied and the taps are recovered from it. h stays empty if the filter
+// could not be read, active is false if the effect has nothing to do with its options.
+int SoxFilter::design_fir(sox_effects_chain_t* new_chain, sox_effect_t* e, const sox_signalinfo_t& signalinfo, effect_design_t& design)
+{
+  sox_effects_chain_t* host = sox_create_effects_chain(new_chain->in_enc, new_chain->out_enc);
+  if (!host)
+    return SOX_ENOMEM;
+  sox_signalinfo_t signalinfo_host = signalinfo;
+  signalinfo_host.channels = 1; // the design is the same for each channel
+  signalinfo_host.length = 0;
+  const int sox_errno = sox_add_effect(host, e, &signalinfo_host, &signalinfo_host);
+  // on error, or when the effect has nothing to do, libsox did not add it
+  if (sox_errno == SOX_SUCCESS && host->length > 0) {
+    design.active = true;
+    const libsox_dft_filter_priv_t* p = reinterpret_cast<const libsox_dft_filter_priv_t*>(host->effects[0]->priv);
+    const libsox_dft_filter_t* f = p->filter_ptr;
+    if (f && get_dft_filter_taps(*f, design.h)) {
+      design.delay = (size_t)(f->num_taps - 1 - f->post_peak);
+      design.dft_filter = *f;
+      design.dft_coefs.assign(f->coefs, f->coefs + f->dft_length);
+      design.dft_filter.coefs = nullptr;
     }
+  }
+  sox_delete_effects_chain(host);
+  return sox_errno;
+}
 
-    if (!ok) {
-      sox_delete_effects_chain(chain);
-      env->ThrowError(error_text.c_str());
+// The filter of desc for this input signal: from design_cache, or designed by libsox
+// (see design_biquad, design_fir) and cached. The caller holds effect_build_lock.
+// The options are checked by libsox' getopts every time, the cache only saves the design.
+// A sinc or fir design longer than fft_table_length is designed again: libsox' start grows
+// the FFT table here, under the lock, before any flow of the chain uses it.
+std::shared_ptr<const effect_design_t> SoxFilter::get_design(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env)
+{
+  sox_effect_t* e = create_effect(new_chain, desc, signalinfo, first_time, env);
+  const std::string key = desc.cacheable ? design_key(desc, signalinfo) : std::string();
+  if (desc.cacheable) {
+    std::shared_ptr<const effect_design_t> cached = design_cache.find(key);
+    if (cached && cached->dft_filter.dft_length <= fft_table_length) {
+      free(e);
+      return cached;
     }
+  }
 
+  auto design = std::make_shared<effect_design_t>();
+  design->active = false;
+  design->dft_filter = libsox_dft_filter_t{};
+  design->delay = 0;
+  int sox_errno;
+  if (desc.biquad) {
+    sox_errno = design_biquad(new_chain, e, signalinfo, design->sections);
+    design->active = !design->sections.empty();
+  }
+  else
+    sox_errno = design_fir(new_chain, e, signalinfo, *design);
+  free(e);
+  if (sox_errno != SOX_SUCCESS) {
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: (%s) Cannot add effect to the chain.", desc.name.c_str());
+  }
+  fft_table_length = std::max(fft_table_length, design->dft_filter.dft_length);
+  if (desc.cacheable)
+    design_cache.insert(key, design, design_size(*design));
+  return design;
+}
 
-    if (first_time)
-    { // mutex scope
-#ifdef OUTPUT_MESSAGE_HANDLER_BUFFERS
-      std::lock_guard<std::mutex> lock(errormessagemutex);
-      // Hijack it only for catching errors in 'options' processing
-      auto tmp_output_message_handler = sox_globals.output_message_handler;
-      sox_globals.output_message_handler = my_output_message;
-#endif
-      sox_errno = sox_effect_options(e, num_params, arglist_ptr.data());
-      if (sox_errno != SOX_SUCCESS) {
-        // "my_output_message" will add a more detailed error beforehand.
-        free(e);
-        sox_delete_effects_chain(chain);
-        error_text += "Error in options.\n" + errormessage;
-        env->ThrowError(error_text.c_str());
-      }
-#ifdef OUTPUT_MESSAGE_HANDLER_BUFFERS
-      sox_globals.output_message_handler = tmp_output_message_handler;
-#endif
-    }
-    else
-    {
-      // when called after a restart this shouldn't error out, ignore
-      sox_errno = sox_effect_options(e, num_params, arglist_ptr.data());
-    }
+// Appends a multichannel 'fftconv' effect filtering all channels with the filter by
+// uniformly partitioned FFT convolution, two channels per FFT, the channel pairs on flow_pool.
+// The output is aligned like the one of libsox' dft_filter, it is computed in float:
+// it differs from libsox' (double) by less than 1e-6 of full scale, see conv_bench.
+// name and flags are the ones of the effect it stands for.
+int SoxFilter::add_effect_fftconv(sox_effects_chain_t* new_chain, std::shared_ptr<const conv_filter_t> filter, size_t delay,
+  const char* name, unsigned int flags, sox_signalinfo_t& signalinfo)
+{
+  sox_effect_handler_t handler = *fftconv_handler();
+  handler.name = name;
+  handler.flags = flags | SOX_EFF_MCHAN;
+  sox_effect_t* w = sox_create_effect(&handler);
+  if (!w)
+    return SOX_ENOMEM;
+  fftconv_privdata_t* priv = reinterpret_cast<fftconv_privdata_t*>(w->priv);
+  priv->conv = new PartitionedConvolver(filter, signalinfo.channels, delay, conv_kernels);
+  priv->pool = flow_pool.get();
+  priv->flushed = false;
+
+  const int sox_errno = sox_add_effect(new_chain, w, &signalinfo, &signalinfo);
+  if (sox_errno != SOX_SUCCESS)
+    delete priv->conv;
+  free(w);
+  return sox_errno;
+}
 
-    // sox_add_effect:
-    // signalinfo_in specifies the input signal info for this effect. 
-    // signalinfo_out is a suggestion as to what the output signal should be 
-    // but depending on the effects given options and on in the effect can choose 
-    // to do differently; we pass the same signalinfo_in for that.
-    // Whatever output rate and channels the effect does produce are written back to 
-    // signalinfo_in.
-    // It is meant that in be stored and passed to each new call to sox_add_effect so 
-    // that changes will be propagated to each new effect.
-
-    // Add the effect to the end of the effects processing chain
-    sox_errno = sox_add_effect(chain, e, &signalinfo_in, &signalinfo_in);
-    free(e);
-    if (sox_errno != SOX_SUCCESS) {
-      sox_delete_effects_chain(chain);
-      error_text += "Cannot add effect to the chain.";
-      env->ThrowError(error_text.c_str());
-    }
-    // sanity test: may fail.
-    if ((signalinfo_in.length % signalinfo_in.channels) != 0) {
-      // Opps, unfortunately this can occur: odd number of samples for two channels.
-      // A bug? Maybe.
-      // This happens:
-      // sox_add_effects recalculates the length without considering the channel count.
-      //   if (effp->handler.flags & SOX_EFF_RATE)
-      //     effp->out_signal.length = effp->out_signal.length / in->rate * effp->out_signal.rate + .5;
-      // This should happen:
-      // Calculate the number of samples which are available for all channels.
-      // Example (old rate = 48000; new rate = 48100)
-      // in: sample_count = 2884481, channels=2 => length = 5768962
-      // out (ideal): 2 * round(2884481 / 48000.0 * 48100.0) = 2 * round(2890490,335) = 2 * 2890490 = 5780980
-      // out (sox)  : round(5768962 / 48000.0 * 48100.0) = round (5780980,670) = 5780981 (odd sample count for two channels?!)
-      signalinfo_in.length -= (signalinfo_in.length % signalinfo_in.channels); // make it multiple of channels.
-      /*
-      So we don't throw fatal error, just adjust the total length instead.
-      error_text += "The number of samples the effect returned is not multiple of number of channels.";
-      env->ThrowError(error_text.c_str());
-      */
+// Largest term of the reduced rate ratio the polyphase resampler takes: its table holds up to
+// 512 coefficients per term (5 MB at most in float, 17 MB in double for -h and -v), common
+// rates have much smaller ones (44.1k to 48k: 160/147)
+constexpr size_t MAX_RESAMPLE_TERM = 4096;
+
+// rate -P: appends a multichannel 'rate' effect running the polyphase resampler instead of
+// libsox' rate, see resample.h. The input and output rates must be integers of a ratio
+// with terms up to MAX_RESAMPLE_TERM, otherwise libsox' rate runs: returns false.
+// The output length, thus the clip's, follows from SOX_EFF_RATE like the one of libsox' rate.
+// Its phase tables are shared like the other designs, see poly_filter_cache.
+bool SoxFilter::add_effect_polyphase(sox_effects_chain_t* new_chain, effect_desc_t& desc, sox_signalinfo_t& signalinfo, bool first_time, int& sox_errno, IScriptEnvironment* env)
+{
+  // rate's getopts checks the options and sets the output rate, if one is given
+  sox_effect_t* e = create_effect(new_chain, desc, signalinfo, first_time, env);
+  const double out_rate = e->out_signal.rate > 0 ? e->out_signal.rate : signalinfo.rate;
+  free(e);
+  sox_errno = SOX_SUCCESS;
+  if (out_rate == signalinfo.rate)
+    return true; // libsox would not add rate either
+  size_t up, down;
+  if (!get_resample_ratio(signalinfo.rate, out_rate, MAX_RESAMPLE_TERM, up, down)) {
+    _RPT2(0, "SoxFilter: rate -P: no polyphase table for %g to %g Hz, libsox' rate runs\n", signalinfo.rate, out_rate);
+    return false;
+  }
+
+  const std::string key = design_key(desc, signalinfo);
+  std::shared_ptr<const poly_filter_t> filter = poly_filter_cache.find(key);
+  if (!filter) {
+    filter = make_poly_filter(up, down, *get_resample_quality(desc.rate_quality));
+    poly_filter_cache.insert(key, filter, sizeof(poly_filter_t) + filter->coefs.size() * sizeof(float) + filter->coefs_double.size() * sizeof(double));
+  }
+
+  sox_effect_handler_t handler = *polyphase_handler();
+  handler.name = desc.handler->name;
+  handler.flags = desc.handler->flags | SOX_EFF_RATE | SOX_EFF_MCHAN;
+  sox_effect_t* w = sox_create_effect(&handler);
+  if (!w) {
+    sox_errno = SOX_ENOMEM;
+    return true;
+  }
+  w->out_signal.rate = out_rate; // kept by sox_add_effect for SOX_EFF_RATE
+  polyphase_privdata_t* priv = reinterpret_cast<polyphase_privdata_t*>(w->priv);
+  priv->resampler = new PolyphaseResampler(filter, signalinfo.channels, resample_kernels);
+
+  sox_errno = sox_add_effect(new_chain, w, &signalinfo, &signalinfo);
+  if (sox_errno != SOX_SUCCESS)
+    delete priv->resampler;
+  else if (first_time)
+    stats->add_engine(desc.name + " -> polyphase " + std::to_string(up) + "/" + std::to_string(down) + " quality=" + desc.rate_quality);
+  free(w);
+  return true;
+}
+
+// Chain optimiser: consecutive biquad and linear gain effects, effect_descs[first..last),
+// become a single 'biquads' effect running their sections as one cascade, in one pass per block.
+// A gain is a section with b0 = gain only, the engine runs it as a multiplication.
+// The output is bit-exact with the one of the separate effects.
+void SoxFilter::add_effects_fused_biquads(sox_effects_chain_t* new_chain, size_t first, size_t last, sox_signalinfo_t& signalinfo, bool first_time, IScriptEnvironment* env)
+{
+  std::vector<biquad_coefs_t> sections;
+  std::string fused;
+  unsigned int flags = 0;
+  {
+    std::lock_guard<std::mutex> build_lock(effect_build_lock);
+    for (size_t i = first; i < last; i++) {
+      effect_desc_t& desc = effect_descs[i];
+      if (desc.biquad) {
+        std::shared_ptr<const effect_design_t> design = get_design(new_chain, desc, signalinfo, first_time, env);
+        sections.insert(sections.end(), design->sections.begin(), design->sections.end());
+      }
+      else {
+        // the options are checked by libsox all the same
+        free(create_effect(new_chain, desc, signalinfo, first_time, env));
+        if (desc.gain != 1.0) // 1.0: libsox would drop it as well
+          sections.push_back({ desc.gain, 0.0, 0.0, 0.0, 0.0, desc.name == "vol" }); // vol truncates, gain rounds
+      }
+      flags |= desc.handler->flags;
+      fused += (fused.empty() ? "" : ",") + desc.name;
+    }
+  }
+  if (first_time)
+    stats->add_engine(fused + " -> biquads sections=" + std::to_string(sections.size()));
+  if (sections.empty())
+    return; // all of them were no-ops
+  if (add_effect_biquads(new_chain, sections, "biquads", flags, signalinfo) != SOX_SUCCESS) {
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: (biquads) Cannot add effect to the chain.");
+  }
+}
+
+// Creates a chain of effect_descs[first..last).
+// It begins with the 'input' effect, or with a 'pipe_in' reading the upstream stage's queue.
+// It ends with the 'output' effect, or with a 'pipe_out' filling the downstream stage's queue.
+// 'input' and 'output' use the buffers of the segment renderer if given, the filter's own ones otherwise.
+// signalinfo is the input signal, updated to the output signal of the chain.
+sox_effects_chain_t* SoxFilter::build_effect_chain_part(bool first_time, size_t first, size_t last,
+  pipeline_stage_t* upstream, pipeline_stage_t* downstream, segment_renderer_t* segment, sox_signalinfo_t& signalinfo, IScriptEnvironment* env)
+{
+  sox_signalinfo_t signalinfo_in;
+  sox_signalinfo_t signalinfo_out;
+  sox_encodinginfo_t encodinginfo_in;
+  sox_encodinginfo_t encodinginfo_out;
+
+  init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out); // all refs. Work by vi_orig
+
+  // Create an effects chain; some effects need to know about the input
+  // or output file encoding so we provide that information here
+  // In Avisynth this is fixed and the setting is the same for both in and out
+  sox_effects_chain_t* new_chain = sox_create_effects_chain(&encodinginfo_in, &encodinginfo_out);
+  if (!new_chain)
+    throw_error(env, "SoxFilter: error creating effect chain\n");
+
+  // -------------- input ------------------------------------------
+  // The first effect in the effect chain: source.
+  if (upstream)
+    add_effect_pipe(new_chain, pipe_in_handler(), upstream, signalinfo, env);
+  else {
+    add_effect_input(new_chain, segment ? &segment->in_info : &avs_in_info, signalinfo, signalinfo, env);
+    instrument_chain_effects(new_chain, 0, 0, first_time);
+  }
+
+  // --------------- effects ----------------------------------------
+  // Add effects one by one from SoxFilter's parameter(s),
+  // consecutive biquads and linear gains as one cascade when the biquad engine is on
+  for (size_t i = first; i < last; ) {
+    const size_t length = new_chain->length;
+    const size_t index = i + 1;
+    size_t run_end = i;
+    if (biquad_kernels)
+      while (run_end < last && (effect_descs[run_end].biquad || effect_descs[run_end].linear_gain))
+        run_end++;
+    if (run_end - i > 1) {
+      add_effects_fused_biquads(new_chain, i, run_end, signalinfo, first_time, env);
+      i = run_end;
     }
+    else
+      add_effect(new_chain, effect_descs[i++], signalinfo, first_time, env);
+    instrument_chain_effects(new_chain, length, index, first_time);
   }
 
+  // ------------------------ output ------------------------------
+  // Final 'effect' in the chain: output, copy back to Avisynth GetAudio buffer
+  if (downstream)
+    add_effect_pipe(new_chain, pipe_out_handler(), downstream, signalinfo, env);
+  else {
+    const size_t length = new_chain->length;
+    add_effect_output(new_chain, segment ? &segment->out_info : &out_info, signalinfo, signalinfo, env);
+    instrument_chain_effects(new_chain, length, effect_descs.size() + 1, first_time);
+  }
+
+  return new_chain;
+}
+
+// The effects added to the chain since it had 'length' effects are counted in entry 'index'
+// of the filter's counters: 0 is 'input', 1 + i effect_descs[i] (a fused cascade counts in the
+// entry of its first effect), then 'output'. Entries are named after the first chain.
+void SoxFilter::instrument_chain_effects(sox_effects_chain_t* new_chain, size_t length, size_t index, bool first_time)
+{
+  if (!effect_timers || new_chain->length == length)
+    return;
+  effect_stats_t* entry = stats->effect(index);
+  if (first_time) {
+    entry->active = true;
+    entry->name = new_chain->effects[length]->handler.name;
+  }
+  instrument_effects(new_chain, length, entry);
+}
+
+// Creates a new effect chain, the filter's actual chain is not touched.
+// With first_time == false it can run on a worker thread: no VideoInfo changes,
+// no error message handler hijacking, and env may be nullptr (see throw_error).
+// The libsox effects are started under effect_build_lock, so that their designs do not race
+// on libsox' FFT table cache. A flow only reads the table up to the lengths the starts (or
+// the designs, see get_design) grew it to before the flow began. The table is reallocated
+// when a longer filter is designed: a new SoxFilter instance with a longer sinc or fir than
+// all before must be created before the audio of the other instances flows on worker
+// threads, as Avisynth does it when the script is loaded.
+sox_effects_chain_t* SoxFilter::build_effect_chain(bool first_time, IScriptEnvironment *env)
+{
+  sox_signalinfo_t signalinfo_in;
+  sox_signalinfo_t signalinfo_out;
+  sox_encodinginfo_t encodinginfo_in;
+  sox_encodinginfo_t encodinginfo_out;
+
+  init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out); // all refs. Work by vi_orig
+
+  sox_effects_chain_t* new_chain = build_effect_chain_part(first_time, 0, effect_descs.size(), nullptr, nullptr, nullptr, signalinfo_in, env);
+
   if (first_time) {
     const int input_AudioChannels = vi.AudioChannels();
     // write back the resulting rate and channel count to VideoInfo format
     vi.audio_samples_per_second = (int)(signalinfo_in.rate + 0.5); // effects can change sampling rate
     vi.nchannels = signalinfo_in.channels; // effects can change number of channels, e.g. remix stereo to mono
-    vi.num_audio_samples = signalinfo_in.length / vi.AudioChannels();
+    vi.num_audio_samples = signalinfo_in.length / vi.AudioChannels(); // whole frames, see get_output_length
+    if (vi.audio_samples_per_second != signalinfo_in.rate)
+      _RPT1(0, "SoxFilter: output rate %f is not an integer, rounded\n", signalinfo_in.rate);
+
+    // Every effect starts on an exact output frame when the input starts at a multiple of
+    // input_period: the frame count of each rate change is integral there.
+    const rational_t in_rate = rational_from_double(vi_orig.audio_samples_per_second);
+    rate_ratio = rational_t{ 1, 1 };
+    input_period = 1;
+    for (size_t i = 0; i < new_chain->length; i++) {
+      const rational_t ratio = rational_div(rational_from_double(new_chain->effects[i][0].out_signal.rate), in_rate);
+      input_period = lcm64(input_period, ratio.den);
+      if (input_period == 0)
+        input_period = INT64_MAX; // never aligned but at zero
+      rate_ratio = ratio;
+    }
 
     // Clear channel speaker mask if the number of channels has been changed.
     // Better than guessing
@@ -453,11 +1682,177 @@ void SoxFilter::rebuild_effect_chain(bool first_time, IScriptEnvironment *env)
     }
   }
 
-  // ------------------------ output ------------------------------
-  // Final 'effect' in the chain: output, copy back to Avisynth GetAudio buffer
-  add_effect_output(signalinfo_in, signalinfo_out, env);
+  return new_chain;
 }
 
+void SoxFilter::rebuild_effect_chain(bool first_time, IScriptEnvironment* env)
+{
+  if (pipeline.empty()) {
+    chain = build_effect_chain(first_time, env);
+    return;
+  }
+
+  // Pipeline: the stages' chains, then the actual chain runs the last stage's effects
+  sox_signalinfo_t signalinfo_in;
+  sox_signalinfo_t signalinfo_out;
+  sox_encodinginfo_t encodinginfo_in;
+  sox_encodinginfo_t encodinginfo_out;
+  init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out);
+
+  pipeline_stage_t* upstream = nullptr;
+  for (auto& stage : pipeline) {
+    stage->queue.reset();
+    stage->chain = build_effect_chain_part(false, stage->first_effect, stage->last_effect, upstream, stage.get(), nullptr, signalinfo_in, env);
+    upstream = stage.get();
+  }
+  chain = build_effect_chain_part(false, upstream->last_effect, effect_descs.size(), upstream, nullptr, nullptr, signalinfo_in, env);
+}
+
+// Stops the workers and deletes the chains of the pipeline stages
+void SoxFilter::StopPipeline()
+{
+  // downstream first: a stage may wait for data from its upstream
+  for (auto it = pipeline.rbegin(); it != pipeline.rend(); ++it)
+    (*it)->worker->stop();
+  for (auto& stage : pipeline) {
+    sox_delete_effects_chain(stage->chain);
+    stage->chain = nullptr;
+  }
+}
+
+// Splits 'costs' into at most 'parts' consecutive groups, minimizing the cost of
+// the most expensive group. Returns the index of the first element of each group.
+static std::vector<size_t> partition_by_cost(const std::vector<double>& costs, size_t parts)
+{
+  const size_t n = costs.size();
+  parts = std::max((size_t)1, std::min(parts, n));
+  std::vector<double> prefix(n + 1, 0.0);
+  for (size_t i = 0; i < n; i++)
+    prefix[i + 1] = prefix[i] + costs[i];
+  // best[k][i]: the first i elements in k + 1 groups; from[k][i]: start of the last group
+  std::vector<std::vector<double>> best(parts, std::vector<double>(n + 1, 0.0));
+  std::vector<std::vector<size_t>> from(parts, std::vector<size_t>(n + 1, 0));
+  for (size_t i = 1; i <= n; i++)
+    best[0][i] = prefix[i];
+  for (size_t k = 1; k < parts; k++) {
+    for (size_t i = k + 1; i <= n; i++) {
+      best[k][i] = -1.0;
+      for (size_t j = k; j < i; j++) {
+        const double cost = std::max(best[k - 1][j], prefix[i] - prefix[j]);
+        if (best[k][i] < 0.0 || cost < best[k][i]) {
+          best[k][i] = cost;
+          from[k][i] = j;
+        }
+      }
+    }
+  }
+  std::vector<size_t> starts(parts);
+  size_t end = n;
+  for (size_t k = parts; k-- > 0; ) {
+    starts[k] = k == 0 ? 0 : from[k][end];
+    end = starts[k];
+  }
+  return starts;
+}
+
+// Processing time of each effect alone, on one second of noise at its input format.
+// Measured once per process for the same effect, input format and engines, see effect_cost_cache.
+std::vector<double> SoxFilter::MeasureEffectCosts(IScriptEnvironment* env)
+{
+  char engines[64];
+  snprintf(engines, sizeof(engines), "|%d/%d/%d", biquad_kernels ? 1 : 0, (int)fftconv_taps, flow_pool ? 1 : 0);
+  std::vector<double> costs;
+  for (auto& desc : effect_descs) {
+    const std::string key = desc.cacheable ? design_key(desc, desc.in_signal) + engines : std::string();
+    std::shared_ptr<const double> cached = key.empty() ? nullptr : effect_cost_cache.find(key);
+    if (cached) {
+      costs.push_back(*cached);
+      continue;
+    }
+
+    sox_signalinfo_t signalinfo_in;
+    sox_signalinfo_t signalinfo_out;
+    sox_encodinginfo_t encodinginfo_in;
+    sox_encodinginfo_t encodinginfo_out;
+    init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out);
+
+    sox_effects_chain_t* probe_chain = sox_create_effects_chain(&encodinginfo_in, &encodinginfo_out);
+    if (!probe_chain)
+      env->ThrowError("SoxFilter: error creating effect chain\n");
+
+    // the probe is both the source and the sink
+    sox_signalinfo_t signalinfo = desc.in_signal;
+    auto add_probe = [&](size_t samples) {
+      sox_effect_t* e = sox_create_effect(probe_handler());
+      int sox_errno = SOX_ENOMEM;
+      if (e) {
+        probe_privdata_t* probe = reinterpret_cast<probe_privdata_t*>(e->priv);
+        probe->remaining = samples;
+        probe->seed = 1;
+        sox_errno = sox_add_effect(probe_chain, e, &signalinfo, &signalinfo);
+        free(e);
+      }
+      if (sox_errno != SOX_SUCCESS) {
+        sox_delete_effects_chain(probe_chain);
+        env->ThrowError("SoxFilter: error creating the cost probe: %d %s\n", sox_errno, sox_strerror(sox_errno));
+      }
+    };
+    add_probe((size_t)(signalinfo.rate + 0.5) * signalinfo.channels);
+    add_effect(probe_chain, desc, signalinfo, false, env);
+    add_probe(0);
+
+    const auto t0 = std::chrono::steady_clock::now();
+    const int sox_errno = sox_flow_effects(probe_chain, NULL, NULL);
+    const auto t1 = std::chrono::steady_clock::now();
+    sox_delete_effects_chain(probe_chain);
+    if (sox_errno != SOX_SUCCESS && sox_errno != SOX_EOF)
+      env->ThrowError("SoxFilter: (%s) sox_flow_effects error measuring the effect: %d %s\n", desc.name.c_str(), sox_errno, sox_strerror(sox_errno));
+
+    costs.push_back(std::chrono::duration<double>(t1 - t0).count());
+    if (!key.empty())
+      effect_cost_cache.insert(key, std::make_shared<const double>(costs.back()), key.size() + sizeof(double));
+    _RPT2(0, "MeasureEffectCosts: %s %d us\n", desc.name.c_str(), (int)(costs.back() * 1e6));
+  }
+  return costs;
+}
+
+
+
+// Samples after which a biquad section's response to its past input is below 2^-33 of full scale,
+// from the largest radius of the poles: the roots of z^2 + a1 z + a2
+static double biquad_decay_samples(const biquad_coefs_t& c)
+{
+  const double disc = c.a1 * c.a1 - 4.0 * c.a2;
+  const double r = disc < 0.0 ? sqrt(c.a2) : std::max(fabs(-c.a1 + sqrt(disc)), fabs(-c.a1 - sqrt(disc))) * 0.5;
+  if (r >= 1.0)
+    return INFINITY;
+  return r > 0.0 ? -33.0 * 0.69314718055994531 / log(r) : 2.0;
+}
+
+// The input the output of the effect depends on, in seconds, as far as it is known: the taps of
+// sinc and fir, the decay of the biquad family; 0 for the other effects.
+double SoxFilter::GetEffectHistorySeconds(effect_desc_t& desc, IScriptEnvironment* env)
+{
+  if (!desc.biquad && !desc.dft_filter)
+    return 0.0;
+  sox_signalinfo_t signalinfo_in, signalinfo_out;
+  sox_encodinginfo_t encodinginfo_in, encodinginfo_out;
+  init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out);
+  sox_signalinfo_t signalinfo = desc.in_signal;
+  sox_effects_chain_t* host = sox_create_effects_chain(&encodinginfo_in, &encodinginfo_out);
+  if (!host)
+    env->ThrowError("SoxFilter: error creating effect chain\n");
+  std::shared_ptr<const effect_design_t> design;
+  {
+    std::lock_guard<std::mutex> build_lock(effect_build_lock);
+    design = get_design(host, desc, signalinfo, false, env);
+  }
+  sox_delete_effects_chain(host);
+  double samples = (double)design->h.size();
+  for (const auto& section : design->sections)
+    samples += biquad_decay_samples(section);
+  return samples / desc.in_signal.rate;
+}
 
 SoxFilter::SoxFilter(PClip _child, const AVSValue args_avs, IScriptEnvironment* env) :
   GenericVideoFilter(_child),
@@ -485,10 +1880,46 @@ SoxFilter::SoxFilter(PClip _child, const AVSValue args_avs, IScriptEnvironment*
   avs_in_info.AudioChannels = vi.AudioChannels();
   // sample count for holding all channels' samples in 1 seconds
   avs_in_info.buffersize_for_samples = vi.audio_samples_per_second * vi.AudioChannels();
+  avs_in_info.inputbuf.set_capacity(avs_in_info.buffersize_for_samples);
+  avs_in_info.fetch_start = 0;
+  avs_in_info.read_start = 0;
+  avs_in_info.frame_buf.resize(vi.AudioChannels());
+  avs_in_info.child_lock = nullptr;
+  avs_in_info.gate = &request_gate;
+  // Create_SoxFilter leaves 16 and 24 bit (and float in nativefloat mode) audio as is
+  converters = get_sample_converters(env->GetCPUFlags());
+  switch (vi.SampleType()) {
+  case SAMPLE_INT16: avs_in_info.convert_input = converters->int16_to_sample; break;
+  case SAMPLE_INT24: avs_in_info.convert_input = converters->int24_to_sample; break;
+  case SAMPLE_FLOAT: avs_in_info.convert_input = converters->float_to_sample; break;
+  default: avs_in_info.convert_input = nullptr; break;
+  }
+  avs_in_info.bytes_per_sample = vi.BytesPerChannelSample();
+  if (avs_in_info.convert_input)
+    avs_in_info.convert_buf.resize(avs_in_info.buffersize_for_samples * avs_in_info.bytes_per_sample);
+  avs_in_info.clips = 0;
+
+  // Optional read-ahead of child audio on a worker thread, 'prefetch' seconds ahead
+  const float prefetch_seconds = args_avs[5].AsFloatf(0.0f);
+  if (prefetch_seconds < 0.0f)
+    env->ThrowError("SoxFilter: prefetch must be positive or zero");
+  avs_in_info.prefetcher = nullptr;
+  if (prefetch_seconds > 0.0f) {
+    // plus one chunk, the worker fetches only when a whole chunk fits in
+    const size_t ahead = (size_t)(prefetch_seconds * vi.audio_samples_per_second + 0.5) * vi.AudioChannels();
+    avs_in_info.inputbuf.set_capacity(ahead + avs_in_info.buffersize_for_samples);
+    prefetcher = std::make_unique<RingProducer<sox_sample_t>>(avs_in_info.inputbuf, avs_in_info.buffersize_for_samples);
+    avs_in_info.prefetcher = prefetcher.get();
+  }
 
-  out_info.remaining_precalculated_samples = 0;
-  out_info.precalc_ptr = 0;
-  out_info.precalc_buf.resize(avs_in_info.buffersize_for_samples); // 1 sec
+  // 1 sec, but at least one libsox buffer: that's the maximum excess of a single flow
+  out_info.precalc.set_capacity(std::max(avs_in_info.buffersize_for_samples, sox_globals.bufsiz));
+
+  // nativefloat: float input gives float output, converted in the 'output' effect, instead of
+  // a ConvertAudio after us. Integer input keeps 32 bit integer output.
+  const bool float_output = args_avs[10].AsBool(false) && vi.SampleType() == SAMPLE_FLOAT;
+  out_info.convert_output = float_output ? converters->sample_to_float : nullptr;
+  vi.sample_type = out_info.convert_output ? SAMPLE_FLOAT : SAMPLE_INT32;
 
   restarted = false;
 
@@ -500,29 +1931,269 @@ SoxFilter::SoxFilter(PClip _child, const AVSValue args_avs, IScriptEnvironment*
   if (!num_args)
     env->ThrowError("SoxFilter: No effects specified");
 
-  // move all avisynth parameters into string array
-  effect_s_array.resize(num_args);
+  // parse all avisynth parameters into effect descriptions
+  effect_descs.resize(num_args);
   for (auto i = 0; i < num_args; i++) {
     std::string arg_str = args_effectlist[i].AsString();
     // magic: remove multiple spaces and convert them into a single one
     arg_str.erase(std::unique(arg_str.begin(), arg_str.end(),
       [](char a, char b) { return a == ' ' && b == ' '; }), arg_str.end());
-    effect_s_array[i] = arg_str;
+    if (!parse_effect_desc(arg_str, effect_descs[i]))
+      env->ThrowError("SoxFilter: No effect name given in parameter #%d", i + 1);
+    if (effect_descs[i].handler == nullptr)
+      env->ThrowError("SoxFilter: (%s) Could not find effect.", effect_descs[i].name.c_str());
+    /* v2.1: Let's allow them, we can change the VideoInfo audio properties at the end.
+    // some checking on possible incompatibility
+    else if (effect_descs[i].changes_channels)
+      error_text += "Cannot run effects that change the number of channels.";
+    else if (effect_descs[i].changes_rate)
+      error_text += "Cannot run effects that change the samplerate.";
+    */
   }
 
   vi_orig = vi;
 
+  // Parallel flows: the per-channel flows of effects without SOX_EFF_MCHAN
+  // (e.g. the biquad family, sinc, rate) run on a thread pool instead of one after another.
+  const int flow_threads = args_avs[8].AsInt(0);
+  if (flow_threads < 0)
+    env->ThrowError("SoxFilter: threads must be positive or zero");
+  if (flow_threads > 1 && args_avs[2].AsFloatf(0.0f) > 0.0f)
+    env->ThrowError("SoxFilter: checkpoint and threads cannot be used together");
+  if (flow_threads > 1)
+    flow_pool = std::make_unique<ThreadPool>(flow_threads);
+  const float segment_seconds = args_avs[9].AsFloatf(0.0f);
+  if (segment_seconds < 0.0f)
+    env->ThrowError("SoxFilter: segment must be positive or zero");
+  const int segment_threads = args_avs[16].AsInt(0);
+  if (segment_threads < 0)
+    env->ThrowError("SoxFilter: segmentthreads must be positive or zero");
+
+  // The biquad family runs on SoxFilter's own SIMD engine, bit-exact with libsox.
+  // Off by default until golden_check passes against the goldens of the shipped libsox.
+  biquad_kernels = args_avs[11].AsBool(false) ? get_biquad_kernels(env->GetCPUFlags()) : nullptr;
+
+  // Long sinc and fir filters run on SoxFilter's own partitioned FFT convolver
+  const int fftconv = args_avs[12].AsInt(0);
+  if (fftconv < 0)
+    env->ThrowError("SoxFilter: fftconv must be positive or zero");
+  fftconv_taps = (size_t)fftconv;
+  conv_kernels = get_conv_kernels(env->GetCPUFlags());
+
+  // rate -P runs on SoxFilter's own polyphase resampler
+  resample_kernels = get_resample_kernels(env->GetCPUFlags());
+
+  // Request counters, per-effect counters and their log
+  const float stats_seconds = args_avs[13].AsFloatf(0.0f);
+  if (stats_seconds < 0.0f)
+    env->ThrowError("SoxFilter: stats must be positive or zero");
+  std::vector<std::string> names(1, "input");
+  for (const auto& desc : effect_descs)
+    names.push_back(desc.name);
+  names.push_back("output");
+  stats = std::make_unique<FilterStats>(names);
+  effect_timers = stats_seconds > 0.0f;
+  stats_log = args_avs[14].AsString("");
+  stats_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(stats_seconds));
+  next_stats_log = std::chrono::steady_clock::now() + stats_interval;
+  rendered_end = 0;
+  next_request_start = 0;
+
   rebuild_effect_chain(true, env); // true: first time
+  stats->publish(vi.audio_samples_per_second);
+
+  next_output_start = 0;
+
+  // Checkpointing: the chain state is saved periodically, out-of-order requests
+  // continue from the nearest saved state instead of restarting from zero.
+  const float checkpoint_seconds = args_avs[2].AsFloatf(0.0f);
+  if (checkpoint_seconds < 0.0f)
+    env->ThrowError("SoxFilter: checkpoint must be positive or zero");
+  checkpoint_interval = (int64_t)(checkpoint_seconds * vi.audio_samples_per_second + 0.5);
+  if (checkpoint_interval > 0) {
+    for (const auto& desc : effect_descs) {
+      if (!is_checkpointable_effect(desc.name))
+        env->ThrowError("SoxFilter: checkpoint cannot be used with effect '%s', its state cannot be saved", desc.name.c_str());
+    }
+    // state of the freshly built chain: restoring it is a restart without rebuild
+    SaveCheckpoint(0);
+    next_checkpoint_position = checkpoint_interval;
+  }
+
+  // Pre-roll seek: when every effect has a bounded history, an out-of-order
+  // request is served by a fresh chain primed a bit before the requested position.
+  // Otherwise we silently stay with the restart-from-zero method.
+  const float preroll_seconds = args_avs[3].AsFloatf(0.0f);
+  if (preroll_seconds < 0.0f)
+    env->ThrowError("SoxFilter: preroll must be positive or zero");
+  if (preroll_seconds > 0.0f && checkpoint_interval > 0)
+    env->ThrowError("SoxFilter: checkpoint and preroll cannot be used together");
+  preroll_samples = 0;
+  if (preroll_seconds > 0.0f) {
+    bool bounded = true;
+    for (const auto& desc : effect_descs) {
+      if (desc.history == HISTORY_UNBOUNDED) {
+        _RPT1(0, "SoxFilter: effect %s has unbounded history, no pre-roll seek\n", desc.name.c_str());
+        bounded = false;
+        break;
+      }
+    }
+    if (bounded && input_period > vi_orig.audio_samples_per_second) {
+      _RPT1(0, "SoxFilter: the rates are aligned every %d input samples only, no pre-roll seek\n", (int)std::min(input_period, (int64_t)INT_MAX));
+      bounded = false;
+    }
+    if (bounded)
+      preroll_samples = (int64_t)(preroll_seconds * vi.audio_samples_per_second + 0.5);
+  }
+
+  // Segments: the timeline is split into segments, each one is rendered by an independent
+  // chain primed with a pre-roll, 'segmentthreads' of them at the same time. The pre-roll must
+  // cover the history of the filters (GetEffectHistorySeconds), output is the same as the one of
+  // the sequential chain then: FIR filters are exact, the state of the recursive biquads differs
+  // by rounding only, a few steps of the last bit of the 32 bit samples (see golden_check).
+  segment_samples = 0;
+  if (segment_seconds > 0.0f) {
+    if (preroll_seconds == 0.0f)
+      env->ThrowError("SoxFilter: segment needs preroll");
+    for (const auto& desc : effect_descs) {
+      if (desc.history == HISTORY_UNBOUNDED)
+        env->ThrowError("SoxFilter: segment cannot be used with effect '%s', its output depends on the whole stream", desc.name.c_str());
+    }
+    double history_seconds = 0.0;
+    for (auto& desc : effect_descs) {
+      history_seconds += GetEffectHistorySeconds(desc, env);
+      if (history_seconds > preroll_seconds)
+        env->ThrowError("SoxFilter: segment: preroll does not cover the history of effect '%s', it needs %.3f s", desc.name.c_str(), history_seconds);
+    }
+    if (input_period > vi_orig.audio_samples_per_second)
+      env->ThrowError("SoxFilter: segment cannot be used with these sample rates, their ratio is too complex");
+    if (args_avs[6].AsFloatf(0.0f) > 0.0f || args_avs[7].AsInt(0) > 1)
+      env->ThrowError("SoxFilter: segment cannot be used together with lookahead or pipeline");
+    segment_samples = std::max((int64_t)1, (int64_t)(segment_seconds * vi.audio_samples_per_second + 0.5));
+    size_t workers = segment_threads > 0 ? segment_threads : std::thread::hardware_concurrency();
+    workers = std::max((size_t)1, workers);
+    for (size_t i = 0; i < workers; i++) {
+      auto segment = std::make_unique<segment_renderer_t>();
+      segment->in_info.child = avs_in_info.child;
+      segment->in_info.AudioChannels = avs_in_info.AudioChannels;
+      segment->in_info.env = nullptr; // flowed on the workers only
+      segment->in_info.buffersize_for_samples = avs_in_info.buffersize_for_samples;
+      segment->in_info.inputbuf.set_capacity(avs_in_info.buffersize_for_samples);
+      segment->in_info.fetch_start = 0;
+      segment->in_info.read_start = 0;
+      segment->in_info.frame_buf.resize(avs_in_info.AudioChannels);
+      segment->in_info.prefetcher = nullptr;
+      segment->in_info.child_lock = &child_lock;
+      segment->in_info.gate = &request_gate;
+      segment->in_info.convert_input = avs_in_info.convert_input;
+      segment->in_info.bytes_per_sample = avs_in_info.bytes_per_sample;
+      segment->in_info.convert_buf.resize(avs_in_info.convert_buf.size());
+      segment->in_info.clips = 0;
+      segment->out_info.precalc.set_capacity(out_info.precalc.capacity());
+      segment->out_info.convert_output = out_info.convert_output;
+      segment->index = -1;
+      segments.push_back(std::move(segment));
+    }
+    segment_pool = std::make_unique<ThreadPool>(workers);
+  }
 
+  // Restarts are served by swapping in a spare chain, its expensive construction
+  // (option parsing, filter design) is done in the background.
+  // Never restarted in checkpoint mode, no need for it.
+  use_spare_chain = args_avs[4].AsBool(false) && checkpoint_interval == 0 && segment_samples == 0;
+  if (use_spare_chain)
+    StartSpareChain();
+
+  // Pipeline: the effects are split into stages by their measured cost, each stage
+  // runs on its own worker thread, connected by queues. The last stage is the actual chain.
+  const int pipeline_stages = args_avs[7].AsInt(0);
+  if (pipeline_stages < 0)
+    env->ThrowError("SoxFilter: pipeline must be positive or zero");
+  if (pipeline_stages > 1 && checkpoint_interval > 0)
+    env->ThrowError("SoxFilter: checkpoint and pipeline cannot be used together");
+  if (pipeline_stages > 1 && effect_descs.size() > 1) {
+    const std::vector<size_t> starts = partition_by_cost(MeasureEffectCosts(env), pipeline_stages);
+    if (starts.size() > 1) {
+      use_spare_chain = false; // spare chains are built for the non-pipelined layout
+      if (spare_chain.valid()) {
+        try { sox_delete_effects_chain(spare_chain.get()); }
+        catch (...) {}
+      }
+      for (size_t i = 0; i + 1 < starts.size(); i++) {
+        auto stage = std::make_unique<pipeline_stage_t>();
+        stage->first_effect = starts[i];
+        stage->last_effect = starts[i + 1];
+        stage->chain = nullptr;
+        // a flow passes at most one libsox buffer to the 'pipe_out' after the step's amount
+        stage->produce_count = sox_globals.bufsiz;
+        stage->produced = 0;
+        stage->queue.set_capacity(4 * sox_globals.bufsiz);
+        stage->worker = std::make_unique<RingProducer<sox_sample_t>>(stage->queue, 2 * sox_globals.bufsiz);
+        pipeline.push_back(std::move(stage));
+      }
+      sox_delete_effects_chain(chain);
+      chain = nullptr;
+      rebuild_effect_chain(false, env);
+    }
+  }
+
+  // Render-ahead: the effect chain runs on a worker thread, keeping up to
+  // 'lookahead' seconds of output ready in front of the consumer.
+  const float lookahead_seconds = args_avs[6].AsFloatf(0.0f);
+  if (lookahead_seconds < 0.0f)
+    env->ThrowError("SoxFilter: lookahead must be positive or zero");
+  render_chunk = 0;
+  ahead_read_position = 0;
+  const int64_t lookahead_samples = (int64_t)(lookahead_seconds * vi.audio_samples_per_second + 0.5);
+  if (lookahead_samples > 0) {
+    // 1/10 sec steps: the first request after a seek does not wait for the whole lookahead
+    render_chunk = std::max((int64_t)1, std::min(lookahead_samples, (int64_t)vi.audio_samples_per_second / 10));
+    const size_t chunk_size = (size_t)render_chunk * vi.AudioChannels();
+    // plus one chunk, the worker renders only when a whole chunk fits in
+    rendered.set_capacity((size_t)lookahead_samples * vi.AudioChannels() + chunk_size);
+    render_buf.resize(chunk_size);
+    renderer = std::make_unique<RingProducer<sox_sample_t>>(rendered, chunk_size);
+  }
 }
 
 
 SoxFilter::~SoxFilter()
 {
+  request_gate.shutdown(); // workers waiting for a request give up
+  if (renderer)
+    renderer->stop(); // before the input, it is the one reading it
+  StopPipeline();
+  if (prefetcher)
+    prefetcher->stop();
+  if (spare_chain.valid()) {
+    try {
+      sox_effects_chain_t* spare = spare_chain.get();
+      sox_delete_effects_chain(spare);
+    }
+    catch (...) {}
+  }
   sox_delete_effects_chain(chain);
+  // the chains are deleted, all counts are in: the final report goes to statslog, and
+  // to the debug output in any case, the request line at least (the effects with stats)
+  if (!stats_log.empty())
+    LogStats();
+  char title[64];
+  snprintf(title, sizeof(title), "SoxFilter stats after %.1f s:\n", stats->seconds());
+  debug_output(title + (effect_timers ? stats->report() : stats->report_requests()));
   // call quit only once for all filter instances
-  if(--sox_init_counter == 0)
-    sox_quit();
+  release_sox();
+}
+
+// Appends the counters to stats_log after a line with the age of the filter:
+// "--- 10.0 s"
+void SoxFilter::LogStats()
+{
+  next_stats_log = std::chrono::steady_clock::now() + stats_interval;
+  FILE* f = fopen(stats_log.c_str(), "a");
+  if (!f)
+    return;
+  fprintf(f, "--- %.1f s\n%s", stats->seconds(), stats->report().c_str());
+  fclose(f);
 }
 
 // Special 'effect': callback to input the samples at the beginning of the effects chain.
@@ -535,7 +2206,7 @@ int input_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
 
   // access the owner Avisynth filter class instance
   avs_privdata_t* privdata = reinterpret_cast<avs_privdata_t*>(effp->priv);
-  avs_in_info_t* avs_in_info = &privdata->caller->avs_in_info;
+  avs_in_info_t* avs_in_info = privdata->in_info;
 
   /*
   _RPT4(0, "input_drain: BEGIN osamp=%d channels=%d next_start=%d input_samples_used=%d\n",
@@ -553,26 +2224,40 @@ int input_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
   // ensure that *osamp is a multiple of the number of channels.
   *osamp -= *osamp % effp->out_signal.channels;
 
-  if (avs_in_info->inputbuf.free_count() == 0) {
+  if (avs_in_info->prefetcher) {
+    if (!avs_in_info->prefetcher->running()) {
+      // no env captured: between requests the worker waits for the next one
+      const size_t chunk = avs_in_info->buffersize_for_samples / avs_in_info->AudioChannels;
+      avs_in_info->prefetcher->start([avs_in_info, chunk]() { input_fetch(*avs_in_info, chunk); });
+    }
+    if (!avs_in_info->prefetcher->wait_for_data()) // read again by the next request
+      throw_error(avs_in_info->env, "%s", error_message(avs_in_info->prefetcher->take_error()).c_str());
+  }
+  else if (avs_in_info->inputbuf.size() == 0) {
     size_t count = avs_in_info->buffersize_for_samples / avs_in_info->AudioChannels;
-    avs_in_info->inputbuf.setdata_info(avs_in_info->inputbuf.next_start(), count, avs_in_info->AudioChannels); // resets internal read_ptr as well
-    avs_in_info->child->GetAudio(&avs_in_info->inputbuf.read_buffer[0], avs_in_info->inputbuf.avs_start, count, avs_in_info->env);
+    input_fetch(*avs_in_info, count);
   }
 
-  size_t samples_available_all_channels = avs_in_info->inputbuf.free_count_all_channels();
+  size_t samples_available_all_channels = avs_in_info->inputbuf.size();
 
   // don't provide more samples than it was requested
   *osamp = std::min(*osamp, samples_available_all_channels);
 
   // Read up to *osamp samples into obuf; update pointers
   avs_in_info->inputbuf.read(obuf, *osamp);
+  avs_in_info->read_start += *osamp / avs_in_info->AudioChannels;
+  if (avs_in_info->prefetcher)
+    avs_in_info->prefetcher->notify_consumed();
+  // float to 32 bit conversion clips are reported as the ones of the 'input' effect
+  if (avs_in_info->convert_input)
+    effp->clips += avs_in_info->clips.exchange(0);
 
   _RPT5(0, "input_drain: _END_ osamp=%d channels=%d next_start=%d input_samples_used=%d samples_available=%d\n",
     (int)*osamp,
     (int)effp->out_signal.channels,
-    (int)avs_in_info->inputbuf.next_start(),
-    (int)avs_in_info->inputbuf.used_count(),
-    (int)avs_in_info->inputbuf.free_count()
+    (int)avs_in_info->read_start + (int)(avs_in_info->inputbuf.size() / avs_in_info->AudioChannels),
+    (int)input_read_start(*avs_in_info),
+    (int)(avs_in_info->inputbuf.size() / avs_in_info->AudioChannels)
   );
 
   return *osamp ? SOX_SUCCESS : SOX_EOF;
@@ -584,11 +2269,14 @@ static int input_stop(sox_effect_t* effp)
   // don't care if called for all flows
 
   avs_privdata_t* privdata = reinterpret_cast<avs_privdata_t*>(effp->priv);
-  avs_in_info_t* avs_in_info = &privdata->caller->avs_in_info;
+  avs_in_info_t* avs_in_info = privdata->in_info;
 
-  // Initialize input filter to force full buffer read.
-  // reset start=0, count=0
-  avs_in_info->inputbuf.setdata_info(0, 0, avs_in_info->AudioChannels);
+  // deleting a spare or segment chain must not disturb the active one
+  if (!privdata->caller->IsActiveChainEffect(effp))
+    return SOX_SUCCESS;
+
+  // Initialize input filter to force full buffer read from start=0
+  input_seek(*avs_in_info, 0);
 
   return SOX_SUCCESS;
 }
@@ -623,100 +2311,641 @@ static int output_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
   // This can handle to flush remaining content of output buffer.
 
   avs_privdata_t* privdata = reinterpret_cast<avs_privdata_t*>(effp->priv);
-  avs_out_info_t* out_info = &privdata->caller->out_info;
+  avs_out_info_t* out_info = privdata->out_info;
+
+  size_t samplecount_for_buffer_full = out_info->sample_count_getaudio - out_info->output_sample_counter;
+  size_t samples_to_copy;
+  
+  _RPT4(0, "output_flow: BEGIN isamp=%d channels=%d samplecount_for_buffer_full=%d output_sample_counter=%d\n",
+    (int)*isamp,
+    (int)effp->in_signal.channels,
+    (int)samplecount_for_buffer_full,
+    (int)out_info->output_sample_counter
+  );
+
+  // If samplecount_for_buffer_full < *isamp then we don't need the whole data yet.
+  // This occurs e.g.when FFMPEG requests only 80 bytes at a time, but *isamp would already
+  // have 4096 bytes pre-processed ready-made in the background.
+  samples_to_copy = std::min(*isamp, samplecount_for_buffer_full);
+
+  size_t remaining_samples = *isamp - samples_to_copy;
+  // When not all pre-processed data is needed now, they are appended to the precalc ring.
+  // If the process has precalculated more data than is needed at the moment, then the
+  // next GetAudio won't start another 'flow', GetAudio will consume data from this
+  // buffer as long as it exists. This is an independent FIFO buffer.
+  // The excess cannot be left unconsumed in the previous effect's buffer: a full
+  // buffer there would make the 'input' drain return nothing, which libsox takes as EOF.
+
+  // Write out *isamp samples from ibuf
+  if (samples_to_copy > 0) {
+    // copy the amount that was requested, straight into the GetAudio buffer
+    output_append(*out_info, ibuf, samples_to_copy);
+  }
+  if (remaining_samples > 0) {
+    // keep the rest in the precalc ring
+    out_info->precalc.write(&ibuf[samples_to_copy], remaining_samples);
+  }
+  _RPT2(0, "output_flow: copying samples %d->[output_sample_buf] %d->[precalc]\n",
+    (int)samples_to_copy,
+    (int)remaining_samples
+  );
+
+  /* Outputting is the last `effect' in the effect chain so always passes
+   * 0 samples on to the next effect (as there isn't one!) */
+  *osamp = 0;
+
+  _RPT4(0, "output_flow: _END_ isamp=%d channels=%d samplecount_for_buffer_full=%d output_sample_counter=%d\n",
+    (int)*isamp,
+    (int)effp->in_signal.channels,
+    (int)samplecount_for_buffer_full,
+    (int)out_info->output_sample_counter
+  );
+
+  // FIXME: return also if greater than? Can we have such case?
+  if (out_info->output_sample_counter == out_info->sample_count_getaudio) {
+    _RPT0(0, "output_flow: _END_ return EOF (buffer ready)\n");
+    // We've filled the whole buffer requested by SoxFilter::GetAudio().
+    // Return EOF to tell effect chain flow (sox_flow_effects) to exit from its loop
+    return SOX_EOF;
+  }
+  _RPT0(0, "output_flow: _END_ return SUCCESS (buffer not ready)\n");
+
+  return SOX_SUCCESS; // All samples output to the buffer successfully, but there remained some
+}
+
+// called once per flow
+static int output_stop(sox_effect_t* effp)
+{
+  avs_privdata_t* privdata = reinterpret_cast<avs_privdata_t*>(effp->priv);
+  avs_out_info_t* out_info = privdata->out_info;
+
+  // deleting a spare chain must not disturb the active one
+  if (!privdata->caller->IsActiveChainEffect(effp))
+    return SOX_SUCCESS;
+
+  // don't care if called for all flows
+  out_info->precalc.reset();
+
+  return SOX_SUCCESS;
+}
+
+// A stub effect handler to handle outputting samples from the effects chain.
+// The only function needed for this is 'flow'
+sox_effect_handler_t const* output_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "output", 
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    NULL, // flow start Called to initialize effect (called once per flow)
+    output_flow, // Called to process samples.
+    NULL, // drain Called to finish getting output after input is complete
+    output_stop, // stop Called to shut down effect (called once per flow)
+    NULL, // kill Called to shut down effect (called once per effect)
+    sizeof(avs_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
+
+// ------------------------ pipeline stage connectors ------------------------------
+
+// Worker step of a pipeline stage: flows its chain until a step's amount is queued.
+// No env, the worker goes on after the request: the child is read through the request gate,
+// errors are reported by the downstream stage.
+static void pipeline_stage_step(pipeline_stage_t& stage)
+{
+  stage.produced = 0;
+  while (stage.produced < stage.produce_count) {
+    int sox_errno = sox_flow_effects(stage.chain, NULL, NULL);
+    if (sox_errno != SOX_SUCCESS && sox_errno != SOX_EOF)
+      throw_error(nullptr, "SoxFilter: sox_flow_effects error in pipeline stage: \n\n%d %s\n", sox_errno, sox_strerror(sox_errno));
+  }
+}
+
+// First effect of a stage's chain: reads the queue of the upstream stage,
+// the upstream worker is started on demand.
+static int pipe_in_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  pipe_privdata_t* privdata = reinterpret_cast<pipe_privdata_t*>(effp->priv);
+  pipeline_stage_t* upstream = privdata->stage;
+  const size_t channels = effp->out_signal.channels;
+
+  if (!upstream->worker->running())
+    upstream->worker->start([upstream]() { pipeline_stage_step(*upstream); });
+  // whole frames only
+  if (!upstream->worker->wait_for_data(channels))
+    throw_error(privdata->caller->avs_in_info.env, "%s", error_message(upstream->worker->take_error()).c_str());
+
+  size_t count = std::min(*osamp, upstream->queue.size());
+  count -= count % channels;
+  upstream->queue.read(obuf, count);
+  upstream->worker->notify_consumed();
+  *osamp = count;
+
+  return *osamp ? SOX_SUCCESS : SOX_EOF;
+}
+
+// Last effect of a stage's chain: its input goes into the stage's queue.
+// A worker step is started only with enough free space for its output, should the queue
+// fill up all the same, the rest stays in the upstream effect's buffer: the step ends,
+// the next one queues it first. Whole frames only, see pipe_in_drain.
+static int pipe_out_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
+  sox_sample_t* obuf LSX_UNUSED, size_t* isamp, size_t* osamp)
+{
+  pipe_privdata_t* privdata = reinterpret_cast<pipe_privdata_t*>(effp->priv);
+  pipeline_stage_t* stage = privdata->stage;
+  const size_t channels = effp->out_signal.channels;
+
+  size_t count = std::min(*isamp, stage->queue.free_space());
+  count -= count % channels;
+  stage->queue.write(ibuf, count);
+  stage->produced += count;
+  const bool full = count < *isamp;
+  *isamp = count;
+  *osamp = 0;
+
+  // EOF: end of the worker step, see output_flow
+  return full || stage->produced >= stage->produce_count ? SOX_EOF : SOX_SUCCESS;
+}
+
+sox_effect_handler_t const* pipe_in_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "pipe_in",
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    NULL, // flow start Called to initialize effect (called once per flow)
+    NULL, // Called to process samples.
+    pipe_in_drain, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    NULL, // kill Called to shut down effect (called once per effect)
+    sizeof(pipe_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
+
+sox_effect_handler_t const* pipe_out_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "pipe_out",
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    NULL, // flow start Called to initialize effect (called once per flow)
+    pipe_out_flow, // Called to process samples.
+    NULL, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    NULL, // kill Called to shut down effect (called once per effect)
+    sizeof(pipe_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
+
+void SoxFilter::add_effect_pipe(sox_effects_chain_t* new_chain, sox_effect_handler_t const* handler, pipeline_stage_t* stage, sox_signalinfo_t& signalinfo, IScriptEnvironment* env)
+{
+  sox_effect_t* e = sox_create_effect(handler);
+  if (!e) {
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "SoxFilter: error creating %s handler\n", handler->name);
+  }
+  pipe_privdata_t priv_for_pipe;
+  priv_for_pipe.caller = this;
+  priv_for_pipe.stage = stage;
+  *reinterpret_cast<pipe_privdata_t*>(e->priv) = priv_for_pipe; // whole struct copy
+
+  int sox_errno = sox_add_effect(new_chain, e, &signalinfo, &signalinfo);
+  free(e);
+  if (sox_errno != SOX_SUCCESS) {
+    sox_delete_effects_chain(new_chain);
+    throw_error(env, "Error in creating effect '%s': %d %s\n", handler->name, sox_errno, sox_strerror(sox_errno));
+  }
+}
+
+// ------------------------ cost probe ------------------------------
+// Both ends of a single effect chain timed by MeasureEffectCosts:
+// as the first effect it generates noise, as the last one it drops everything.
+
+static int probe_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  probe_privdata_t* probe = reinterpret_cast<probe_privdata_t*>(effp->priv);
+  *osamp = std::min(*osamp, probe->remaining);
+  *osamp -= *osamp % effp->out_signal.channels;
+  for (size_t i = 0; i < *osamp; i++) {
+    // xorshift, -12 dB
+    probe->seed ^= probe->seed << 13;
+    probe->seed ^= probe->seed >> 17;
+    probe->seed ^= probe->seed << 5;
+    obuf[i] = (sox_sample_t)probe->seed >> 2;
+  }
+  probe->remaining -= *osamp;
+  return *osamp ? SOX_SUCCESS : SOX_EOF;
+}
+
+static int probe_flow(sox_effect_t* effp LSX_UNUSED, sox_sample_t const* ibuf LSX_UNUSED,
+  sox_sample_t* obuf LSX_UNUSED, size_t* isamp LSX_UNUSED, size_t* osamp)
+{
+  *osamp = 0;
+  return SOX_SUCCESS;
+}
+
+sox_effect_handler_t const* probe_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "probe",
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    NULL, // flow start Called to initialize effect (called once per flow)
+    probe_flow, // Called to process samples.
+    probe_drain, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    NULL, // kill Called to shut down effect (called once per effect)
+    sizeof(probe_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
+
+// ------------------------ effect timers ------------------------------
+// Counting stand-ins of an effect's flow, drain and kill, see instrument_effects.
+// The counts are summed in the timer of the chain's effect, and added to the effect's
+// shared counters once a millisecond of processing is reached, and when it is deleted:
+// a few atomic adds per millisecond, two clock reads and a map lookup per call.
+
+typedef struct effect_timer_t {
+  effect_stats_t* stats;
+  sox_effect_handler_flow flow;
+  sox_effect_handler_drain drain;
+  sox_effect_handler_kill kill;
+  // not added to stats yet
+  uint64_t calls;
+  uint64_t samples_in;
+  uint64_t samples_out;
+  uint64_t ns;
+  uint64_t clips;
+} effect_timer_t;
+
+// The timer of each flow of the instrumented effects of all instances: the stand-ins get
+// nothing but the flow's sox_effect_t, whose address is fixed until the effect is deleted.
+static std::mutex effect_timer_lock;
+static std::unordered_map<const sox_effect_t*, effect_timer_t*> effect_timer_map;
+
+static effect_timer_t* get_effect_timer(const sox_effect_t* effp)
+{
+  std::lock_guard<std::mutex> lock(effect_timer_lock);
+  return effect_timer_map.at(effp);
+}
+
+static void flush_effect_timer(effect_timer_t* timer)
+{
+  effect_stats_t* stats = timer->stats;
+  stats->calls.fetch_add(timer->calls, std::memory_order_relaxed);
+  stats->samples_in.fetch_add(timer->samples_in, std::memory_order_relaxed);
+  stats->samples_out.fetch_add(timer->samples_out, std::memory_order_relaxed);
+  stats->ns.fetch_add(timer->ns, std::memory_order_relaxed);
+  stats->clips.fetch_add(timer->clips, std::memory_order_relaxed);
+  timer->calls = timer->samples_in = timer->samples_out = timer->ns = timer->clips = 0;
+}
+
+// the flows of an effect without SOX_EFF_MCHAN are called one after another with
+// a channel each: one call is counted for all of them
+static void count_effect_call(effect_timer_t* timer, const sox_effect_t* effp, size_t in, size_t out,
+  sox_uint64_t clips, std::chrono::steady_clock::duration time)
+{
+  if (effp->flow == 0)
+    timer->calls++;
+  timer->samples_in += in;
+  timer->samples_out += out;
+  timer->clips += clips;
+  timer->ns += (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+  if (timer->ns >= 1000000)
+    flush_effect_timer(timer);
+}
+
+static int timed_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
+  sox_sample_t* obuf, size_t* isamp, size_t* osamp)
+{
+  effect_timer_t* timer = get_effect_timer(effp);
+  const sox_uint64_t clips = effp->clips;
+  const auto t0 = std::chrono::steady_clock::now();
+  const int status = timer->flow(effp, ibuf, obuf, isamp, osamp);
+  const auto t1 = std::chrono::steady_clock::now();
+  count_effect_call(timer, effp, *isamp, *osamp, effp->clips - clips, t1 - t0);
+  return status;
+}
+
+static int timed_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  effect_timer_t* timer = get_effect_timer(effp);
+  const sox_uint64_t clips = effp->clips;
+  const auto t0 = std::chrono::steady_clock::now();
+  const int status = timer->drain(effp, obuf, osamp);
+  const auto t1 = std::chrono::steady_clock::now();
+  count_effect_call(timer, effp, 0, *osamp, effp->clips - clips, t1 - t0);
+  return status;
+}
+
+// called once per effect (with its first flow), the last call libsox makes
+static int timed_kill(sox_effect_t* effp)
+{
+  effect_timer_t* timer = get_effect_timer(effp);
+  const int status = timer->kill ? timer->kill(effp) : SOX_SUCCESS;
+  flush_effect_timer(timer);
+  {
+    std::lock_guard<std::mutex> lock(effect_timer_lock);
+    for (size_t f = 0; f < effp->flows; f++)
+      effect_timer_map.erase(&effp[f]);
+  }
+  delete timer;
+  return status;
+}
+
+// The chain's effects from 'first' on are counted in 'stats'. All flows of an effect share one timer.
+static void instrument_effects(sox_effects_chain_t* chain, size_t first, effect_stats_t* stats)
+{
+  for (size_t i = first; i < chain->length; i++) {
+    sox_effect_t* effp = chain->effects[i];
+    effect_timer_t* timer = new effect_timer_t();
+    timer->stats = stats;
+    timer->flow = effp->handler.flow;
+    timer->drain = effp->handler.drain;
+    timer->kill = effp->handler.kill;
+    std::lock_guard<std::mutex> lock(effect_timer_lock);
+    for (size_t f = 0; f < effp->flows; f++) {
+      effect_timer_map[&effp[f]] = timer;
+      effp[f].handler.flow = timed_flow;
+      effp[f].handler.drain = timed_drain;
+      effp[f].handler.kill = timed_kill;
+    }
+  }
+}
+
+// ------------------------ parallel flows ------------------------------
+// Multichannel stand-in of an effect without SOX_EFF_MCHAN, see add_effect_parallel.
+// Does what libsox' flow_effect does with the flows, but the flows run concurrently.
+
+static int parallel_start(sox_effect_t* effp)
+{
+  parallel_flows_t* state = reinterpret_cast<parallel_privdata_t*>(effp->priv)->state;
+  const sox_effect_t* flows = state->host->effects[0];
+  const size_t n = flows->flows;
+  // the most a flow or drain call gets in or out is one libsox buffer, all channels
+  const size_t size = sox_globals.bufsiz / n + 1;
+  state->ibufc.assign(n, std::vector<sox_sample_t>(size));
+  state->obufc.assign(n, std::vector<sox_sample_t>(size));
+  state->idonec.resize(n);
+  state->odonec.resize(n);
+  state->statuses.resize(n);
+  effp->out_signal = flows->out_signal;
+  return SOX_SUCCESS;
+}
+
+// Interleaves the flows' output, like libsox, the flows must have produced the same amount
+static int parallel_collect(parallel_flows_t* state, sox_sample_t* obuf, size_t* isamp, size_t* osamp)
+{
+  const size_t n = state->host->effects[0]->flows;
+  int status = SOX_SUCCESS;
+  for (size_t f = 0; f < n; f++) {
+    if (state->statuses[f] != SOX_SUCCESS)
+      status = SOX_EOF;
+    if (state->idonec[f] != state->idonec[0] || state->odonec[f] != state->odonec[0]) {
+      _RPT1(0, "parallel: %s flowed asymmetrically!\n", state->host->effects[0]->handler.name);
+      status = SOX_EOF;
+    }
+  }
+  const size_t odone = state->odonec[0];
+  for (size_t i = 0; i < odone; i++)
+    for (size_t f = 0; f < n; f++)
+      *obuf++ = state->obufc[f][i];
+  if (isamp)
+    *isamp = state->idonec[0] * n;
+  *osamp = odone * n;
+  return status;
+}
+
+static int parallel_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
+  sox_sample_t* obuf, size_t* isamp, size_t* osamp)
+{
+  parallel_flows_t* state = reinterpret_cast<parallel_privdata_t*>(effp->priv)->state;
+  sox_effect_t* flows = state->host->effects[0];
+  const size_t n = flows->flows;
+  const size_t ilen = *isamp / n;
+  const size_t olen = *osamp / n;
+
+  // each channel is deinterleaved by its own task
+  state->pool->run(n, [state, flows, n, ibuf, ilen, olen](size_t f) {
+    sox_sample_t* ibufc = state->ibufc[f].data();
+    for (size_t i = 0; i < ilen; i++)
+      ibufc[i] = ibuf[i * n + f];
+    state->idonec[f] = ilen;
+    state->odonec[f] = olen;
+    state->statuses[f] = flows[f].handler.flow(&flows[f], ibufc, state->obufc[f].data(), &state->idonec[f], &state->odonec[f]);
+    });
+
+  return parallel_collect(state, obuf, isamp, osamp);
+}
+
+static int parallel_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  parallel_flows_t* state = reinterpret_cast<parallel_privdata_t*>(effp->priv)->state;
+  sox_effect_t* flows = state->host->effects[0];
+  const size_t n = flows->flows;
+  const size_t olen = *osamp / n;
+
+  state->pool->run(n, [state, flows, olen](size_t f) {
+    state->idonec[f] = 0;
+    state->odonec[f] = olen;
+    state->statuses[f] = flows[f].handler.drain(&flows[f], state->obufc[f].data(), &state->odonec[f]);
+    });
+
+  return parallel_collect(state, obuf, nullptr, osamp);
+}
+
+// called once per effect; stops and deletes the effect in the host chain as well
+static int parallel_kill(sox_effect_t* effp)
+{
+  parallel_flows_t* state = reinterpret_cast<parallel_privdata_t*>(effp->priv)->state;
+  sox_delete_effects_chain(state->host);
+  delete state;
+  return SOX_SUCCESS;
+}
+
+// name and flags are overwritten with the ones of the effect it stands for
+sox_effect_handler_t const* parallel_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "parallel",
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    parallel_start, // flow start Called to initialize effect (called once per flow)
+    parallel_flow, // Called to process samples.
+    parallel_drain, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    parallel_kill, // kill Called to shut down effect (called once per effect)
+    sizeof(parallel_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
+
+// ------------------------ biquad engine ------------------------------
+// Multichannel stand-in of the biquad family effects, see add_effect_biquad.
+
+static int biquads_start(sox_effect_t* effp)
+{
+  biquads_privdata_t* p = reinterpret_cast<biquads_privdata_t*>(effp->priv);
+  std::fill_n(biquads_state(p), biquad_state_size(p->sections, p->channels), 0.0);
+  return SOX_SUCCESS;
+}
+
+static int biquads_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
+  sox_sample_t* obuf, size_t* isamp, size_t* osamp)
+{
+  biquads_privdata_t* p = reinterpret_cast<biquads_privdata_t*>(effp->priv);
+  const size_t frames = std::min(*isamp, *osamp) / p->channels;
+  effp->clips += biquad_process(p->kernels, biquads_coefs(p), p->sections, biquads_state(p),
+    ibuf, obuf, frames, p->channels);
+  *isamp = *osamp = frames * p->channels;
+  return SOX_SUCCESS;
+}
+
+// name, flags and priv_size are set for each instance
+sox_effect_handler_t const* biquads_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "biquads",
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    biquads_start, // flow start Called to initialize effect (called once per flow)
+    biquads_flow, // Called to process samples.
+    NULL, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    NULL, // kill Called to shut down effect (called once per effect)
+    sizeof(biquads_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
 
-  size_t samplecount_for_buffer_full = out_info->sample_count_getaudio - out_info->output_sample_counter;
-  size_t samples_to_copy;
-  
-  _RPT4(0, "output_flow: BEGIN isamp=%d channels=%d samplecount_for_buffer_full=%d output_sample_counter=%d\n",
-    (int)*isamp,
-    (int)effp->in_signal.channels,
-    (int)samplecount_for_buffer_full,
-    (int)out_info->output_sample_counter
-  );
+// ------------------------ FFT convolver ------------------------------
+// Multichannel stand-in of sinc and fir, see add_effect_fftconv.
 
-  // If samplecount_for_buffer_full < *isamp then we don't need the whole data yet.
-  // This occurs e.g.when FFMPEG requests only 80 bytes at a time, but *isamp would already
-  // have 4096 bytes pre-processed ready-made in the background.
-  samples_to_copy = std::min(*isamp, samplecount_for_buffer_full);
+static int fftconv_start(sox_effect_t* effp)
+{
+  fftconv_privdata_t* p = reinterpret_cast<fftconv_privdata_t*>(effp->priv);
+  p->conv->reset();
+  p->flushed = false;
+  return SOX_SUCCESS;
+}
 
-  size_t remaining_samples = *isamp - samples_to_copy;
-  // When not all pre-processed data is needed now, they are copied into a precalc_buf.
-  // If the process has precalculated more data than is needed at the moment, then the
-  // next GetAudio won't start another 'flow', GetAudio will consume data from this
-  // buffer as long as it exists. This is an independent FIFO buffer.
+// Like libsox' dft_filter: all input is taken, the output is what is filtered already
+static int fftconv_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
+  sox_sample_t* obuf, size_t* isamp, size_t* osamp)
+{
+  fftconv_privdata_t* p = reinterpret_cast<fftconv_privdata_t*>(effp->priv);
+  const size_t channels = effp->out_signal.channels;
+  const size_t iframes = *isamp / channels;
+  p->conv->write(ibuf, iframes, p->pool);
+  const size_t odone = p->conv->read(obuf, *osamp / channels, effp->clips);
+  *isamp = iframes * channels;
+  *osamp = odone * channels;
+  return SOX_SUCCESS;
+}
 
-  // Write out *isamp samples from ibuf
-  if (samples_to_copy > 0) {
-    // copy the amount that was requested
-    memcpy(&out_info->output_sample_buf[out_info->output_sample_counter], ibuf, samples_to_copy * sizeof(sox_sample_t));
-    // copy the rest into the precalc buffer
-    memcpy(&out_info->precalc_buf[0], &ibuf[samples_to_copy], remaining_samples * sizeof(sox_sample_t));
-    _RPT2(0, "output_flow: copying samples %d->[output_sample_buf] %d->[output_excess_sample_buffer]\n", 
-      (int)samples_to_copy,
-      (int)remaining_samples
-    );
-    out_info->remaining_precalculated_samples = remaining_samples;
-    out_info->precalc_ptr = 0;
-    out_info->output_sample_counter += samples_to_copy;
-  }
-  else {
-    _RPT0(0, "output_flow: NOTHING TO COPY, reset excess counters (no excess)\n");
-    out_info->precalc_ptr = 0;
-    out_info->remaining_precalculated_samples = 0;
+static int fftconv_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  fftconv_privdata_t* p = reinterpret_cast<fftconv_privdata_t*>(effp->priv);
+  if (!p->flushed) {
+    p->conv->flush(p->pool);
+    p->flushed = true;
   }
+  const size_t channels = effp->out_signal.channels;
+  *osamp = p->conv->read(obuf, *osamp / channels, effp->clips) * channels;
+  return p->conv->available() ? SOX_SUCCESS : SOX_EOF;
+}
 
-  /* Outputting is the last `effect' in the effect chain so always passes
-   * 0 samples on to the next effect (as there isn't one!) */
-  *osamp = 0;
+// called once per effect
+static int fftconv_kill(sox_effect_t* effp)
+{
+  fftconv_privdata_t* p = reinterpret_cast<fftconv_privdata_t*>(effp->priv);
+  delete p->conv;
+  return SOX_SUCCESS;
+}
 
-  _RPT4(0, "output_flow: _END_ isamp=%d channels=%d samplecount_for_buffer_full=%d output_sample_counter=%d\n",
-    (int)*isamp,
-    (int)effp->in_signal.channels,
-    (int)samplecount_for_buffer_full,
-    (int)out_info->output_sample_counter
-  );
+// name and flags are set for each instance
+sox_effect_handler_t const* fftconv_handler(void)
+{
+  static sox_effect_handler_t handler = {
+    "fftconv",
+    NULL, // short usage text
+    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    NULL, // getopts Called to parse command-line arguments (called once per effect).
+    fftconv_start, // flow start Called to initialize effect (called once per flow)
+    fftconv_flow, // Called to process samples.
+    fftconv_drain, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    fftconv_kill, // kill Called to shut down effect (called once per effect)
+    sizeof(fftconv_privdata_t) // Size of private data SoX should pre-allocate for effect
+  };
+  return &handler;
+}
 
-  // FIXME: return also if greater than? Can we have such case?
-  if (out_info->output_sample_counter == out_info->sample_count_getaudio) {
-    _RPT0(0, "output_flow: _END_ return EOF (buffer ready)\n");
-    // We've filled the whole buffer requested by SoxFilter::GetAudio().
-    // Return EOF to tell effect chain flow (sox_flow_effects) to exit from its loop
-    return SOX_EOF;
-  }
-  _RPT0(0, "output_flow: _END_ return SUCCESS (buffer not ready)\n");
+// ------------------------ polyphase resampler ------------------------------
+// Multichannel stand-in of rate, see add_effect_polyphase.
 
-  return SOX_SUCCESS; // All samples output to the buffer successfully, but there remained some
+static int polyphase_start(sox_effect_t* effp)
+{
+  polyphase_privdata_t* p = reinterpret_cast<polyphase_privdata_t*>(effp->priv);
+  p->resampler->reset();
+  return SOX_SUCCESS;
 }
 
-// called once per flow
-static int output_stop(sox_effect_t* effp)
+// Like libsox' rate: all input is taken, the output is what is resampled already
+static int polyphase_flow(sox_effect_t* effp, sox_sample_t const* ibuf,
+  sox_sample_t* obuf, size_t* isamp, size_t* osamp)
 {
-  avs_privdata_t* privdata = reinterpret_cast<avs_privdata_t*>(effp->priv);
-  avs_out_info_t* out_info = &privdata->caller->out_info;
+  polyphase_privdata_t* p = reinterpret_cast<polyphase_privdata_t*>(effp->priv);
+  const size_t channels = effp->out_signal.channels;
+  const size_t iframes = *isamp / channels;
+  p->resampler->write(ibuf, iframes);
+  const size_t odone = p->resampler->read(obuf, *osamp / channels, effp->clips);
+  *isamp = iframes * channels;
+  *osamp = odone * channels;
+  return SOX_SUCCESS;
+}
 
-  // don't care if called for all flows
-  out_info->precalc_ptr = 0;
-  out_info->remaining_precalculated_samples = 0;
+static int polyphase_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  polyphase_privdata_t* p = reinterpret_cast<polyphase_privdata_t*>(effp->priv);
+  p->resampler->flush();
+  const size_t channels = effp->out_signal.channels;
+  *osamp = p->resampler->read(obuf, *osamp / channels, effp->clips) * channels;
+  return p->resampler->ended() ? SOX_EOF : SOX_SUCCESS;
+}
 
+// called once per effect
+static int polyphase_kill(sox_effect_t* effp)
+{
+  polyphase_privdata_t* p = reinterpret_cast<polyphase_privdata_t*>(effp->priv);
+  delete p->resampler;
   return SOX_SUCCESS;
 }
 
-// A stub effect handler to handle outputting samples from the effects chain.
-// The only function needed for this is 'flow'
-sox_effect_handler_t const* output_handler(void)
+// name and flags are set for each instance
+sox_effect_handler_t const* polyphase_handler(void)
 {
   static sox_effect_handler_t handler = {
-    "output", 
+    "polyphase",
     NULL, // short usage text
-    SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
+    SOX_EFF_RATE | SOX_EFF_MCHAN, // Combination of SOX_EFF_* flags
     NULL, // getopts Called to parse command-line arguments (called once per effect).
-    NULL, // flow start Called to initialize effect (called once per flow)
-    output_flow, // Called to process samples.
-    NULL, // drain Called to finish getting output after input is complete
-    output_stop, // stop Called to shut down effect (called once per flow)
-    NULL, // kill Called to shut down effect (called once per effect)
-    sizeof(avs_privdata_t) // Size of private data SoX should pre-allocate for effect
+    polyphase_start, // flow start Called to initialize effect (called once per flow)
+    polyphase_flow, // Called to process samples.
+    polyphase_drain, // drain Called to finish getting output after input is complete
+    NULL, // stop Called to shut down effect (called once per flow)
+    polyphase_kill, // kill Called to shut down effect (called once per effect)
+    sizeof(polyphase_privdata_t) // Size of private data SoX should pre-allocate for effect
   };
   return &handler;
 }
@@ -788,9 +3017,23 @@ void SoxFilter::RestartEffects(IScriptEnvironment* env)
   if (true)
   {
     // this works for "compand" as well
+    sox_effects_chain_t* spare = nullptr;
+    if (spare_chain.valid()) {
+      // waits if it is not finished yet, still not slower than building one now
+      try { spare = spare_chain.get(); }
+      catch (const std::exception& e) {
+        env->ThrowError("SoxFilter: building the spare chain failed: %s", e.what());
+      }
+    }
+    StopPipeline();
     sox_delete_effects_chain(chain);
     chain = NULL;
-    rebuild_effect_chain(false, env); // false: not the first time
+    if (spare)
+      chain = spare; // just swap
+    else
+      rebuild_effect_chain(false, env); // false: not the first time
+    if (use_spare_chain)
+      StartSpareChain();
   }
   else {
     // this does not work, e.g. compand is not initalized 100%
@@ -798,27 +3041,320 @@ void SoxFilter::RestartEffects(IScriptEnvironment* env)
   }
 
   restarted = true;
+  next_output_start = 0;
+  stats->requests.restarts.fetch_add(1, std::memory_order_relaxed);
 
   _RPT0(0, "RESTART EFFECTS done!\n");
 }
 
+// Builds the next spare chain on a worker thread, so that the expensive
+// construction is done off the request path. The request's env is not used there,
+// an error is thrown when the chain is taken, see RestartEffects.
+void SoxFilter::StartSpareChain()
+{
+  spare_chain = std::async(std::launch::async, [this]() {
+    return build_effect_chain(false, nullptr); // false: not the first time
+    });
+}
+
+void SoxFilter::SaveCheckpoint(int64_t position)
+{
+  chain_checkpoint_t cp;
+  cp.position = position;
+
+  cp.input_position = input_read_start(avs_in_info);
+
+  for (size_t i = 0; i < chain->length; i++) {
+    sox_effect_t* effp = chain->effects[i];
+    // output buffer is owned by the first flow
+    cp.obegs.push_back(effp->obeg);
+    cp.oends.push_back(effp->oend);
+    cp.imins.push_back(effp->imin);
+    if (effp->oend > effp->obeg)
+      cp.obufs.insert(cp.obufs.end(), effp->obuf + effp->obeg, effp->obuf + effp->oend);
+    for (size_t flow = 0; flow < effp->flows; flow++) {
+      sox_effect_t* flow_effp = &chain->effects[i][flow];
+      cp.clips.push_back(flow_effp->clips);
+      const uint8_t* priv = reinterpret_cast<const uint8_t*>(flow_effp->priv);
+      if (priv)
+        cp.privs.insert(cp.privs.end(), priv, priv + flow_effp->handler.priv_size);
+    }
+  }
+
+  cp.precalc.resize(out_info.precalc.size());
+  out_info.precalc.peek(cp.precalc.data(), cp.precalc.size());
+
+  _RPT2(0, "SaveCheckpoint: position=%d checkpoints=%d\n", (int)position, (int)checkpoints.size() + 1);
+
+  checkpoints.push_back(std::move(cp));
+
+  if (checkpoints.size() > MAX_CHECKPOINTS) {
+    // thin out: keep the even ones (the one at zero as well), double the interval
+    size_t kept = 0;
+    for (size_t i = 0; i < checkpoints.size(); i += 2)
+      checkpoints[kept++] = std::move(checkpoints[i]);
+    checkpoints.resize(kept);
+    checkpoint_interval *= 2;
+  }
+}
+
+// Checkpoints are only restored into the chain instance they were saved from,
+// so pointers held in the private areas remain valid.
+void SoxFilter::RestoreCheckpoint(const chain_checkpoint_t& cp, IScriptEnvironment* env)
+{
+  _RPT1(0, "RestoreCheckpoint: position=%d\n", (int)cp.position);
+  stats->requests.restores.fetch_add(1, std::memory_order_relaxed);
+
+  size_t obuf_pos = 0;
+  size_t flow_index = 0;
+  size_t priv_pos = 0;
+  for (size_t i = 0; i < chain->length; i++) {
+    sox_effect_t* effp = chain->effects[i];
+    const size_t pending = cp.oends[i] - cp.obegs[i];
+    effp->obeg = cp.obegs[i];
+    effp->oend = cp.oends[i];
+    effp->imin = cp.imins[i];
+    if (pending > 0)
+      std::copy(cp.obufs.data() + obuf_pos, cp.obufs.data() + obuf_pos + pending, effp->obuf + effp->obeg);
+    obuf_pos += pending;
+    for (size_t flow = 0; flow < effp->flows; flow++) {
+      sox_effect_t* flow_effp = &chain->effects[i][flow];
+      flow_effp->clips = cp.clips[flow_index++];
+      if (flow_effp->priv) {
+        memcpy(flow_effp->priv, cp.privs.data() + priv_pos, flow_effp->handler.priv_size);
+        priv_pos += flow_effp->handler.priv_size;
+      }
+    }
+  }
+
+  // continue reading from where the input effect was
+  input_seek(avs_in_info, cp.input_position);
+
+  out_info.precalc.reset();
+  out_info.precalc.write(cp.precalc.data(), cp.precalc.size());
+
+  next_output_start = cp.position;
+}
+
+// Out-of-order request: continue from the nearest saved chain state which
+// precedes 'start', then render and drop the samples up to 'start'.
+// Seek cost is bounded by the checkpoint interval instead of the position.
+void SoxFilter::SeekToCheckpoint(int64_t start, IScriptEnvironment* env)
+{
+  auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), start,
+    [](int64_t pos, const chain_checkpoint_t& cp) { return pos < cp.position; });
+  if (it == checkpoints.begin()) {
+    // cannot happen, there is always one at zero
+    RestartEffects(env);
+  }
+  else {
+    --it;
+    // when going forward, restore only if it brings us closer
+    if (start < next_output_start || it->position > next_output_start)
+      RestoreCheckpoint(*it, env);
+  }
+  SkipAudio(start - next_output_start, env);
+}
+
+// Out-of-order request for a chain of effects with bounded history:
+// rebuild the chain, feed it from 'preroll_samples' before 'start' and drop
+// the warm-up output. Needs no replay from zero.
+// With rate changes the chain starts at an input position where every effect's output
+// position is exact (see input_period): a bit earlier than the pre-roll asks.
+void SoxFilter::SeekWithPreroll(int64_t start, IScriptEnvironment* env)
+{
+  // a short jump forward: just render through it
+  if (start > next_output_start && start - next_output_start <= preroll_samples) {
+    SkipAudio(start - next_output_start, env);
+    return;
+  }
+
+  RestartEffects(env);
+
+  const int64_t prime_input = GetPrimeInputPosition(std::max((int64_t)0, start - preroll_samples));
+  const int64_t prime_start = rational_scale_round(prime_input, rate_ratio);
+  // the first input drain reads from there
+  input_seek(avs_in_info, prime_input);
+  next_output_start = prime_start;
+
+  SkipAudio(start - prime_start, env);
+}
+
+// Flows the chain until 'samples' (all channels) are written to buf:
+// first the excess of the previous flows, then the new output. See output_flow.
+static void render_chain(sox_effects_chain_t* chain, avs_out_info_t& out, sox_sample_t* buf, size_t samples, IScriptEnvironment* env)
+{
+  out.sample_count_getaudio = samples;
+  out.output_sample_buf = buf;
+  out.output_sample_counter = 0;
+  output_append_precalc(out, samples);
+  while (out.output_sample_counter < out.sample_count_getaudio) {
+    int sox_errno = sox_flow_effects(chain, NULL, NULL);
+    if (sox_errno != SOX_SUCCESS && sox_errno != SOX_EOF)
+      throw_error(env, "SoxFilter: sox_flow_effects error: \n\n%d %s\n", sox_errno, sox_strerror(sox_errno));
+    if (sox_errno == SOX_EOF && out.output_sample_counter != out.sample_count_getaudio)
+      throw_error(env, "SoxFilter: sox_flow_effects error EOF received but buffer for GetAudio is not finished:\n");
+  }
+}
+
+// Renders segment 'index' with a chain of its own: the chain is fed from
+// 'preroll_samples' before the segment, the warm-up output is dropped, like
+// in SeekWithPreroll. Runs on a worker thread, concurrently with other segments.
+// 'replay': the segment was rendered before, all of the work is wasted.
+// No env on the workers: the child is read through request_gate, errors are std::runtime_error.
+void SoxFilter::RenderSegment(segment_renderer_t& segment, int64_t index, bool replay)
+{
+  const size_t channels = vi.AudioChannels();
+  const int64_t start = index * segment_samples;
+  const int64_t prime_input = GetPrimeInputPosition(std::max((int64_t)0, start - preroll_samples));
+  const int64_t prime_start = rational_scale_round(prime_input, rate_ratio);
+
+  segment.index = -1;
+  sox_signalinfo_t signalinfo_in;
+  sox_signalinfo_t signalinfo_out;
+  sox_encodinginfo_t encodinginfo_in;
+  sox_encodinginfo_t encodinginfo_out;
+  init_signalinfos(signalinfo_in, signalinfo_out, encodinginfo_in, encodinginfo_out);
+  sox_effects_chain_t* segment_chain = build_effect_chain_part(false, 0, effect_descs.size(), nullptr, nullptr, &segment, signalinfo_in, nullptr);
+
+  input_seek(segment.in_info, prime_input);
+  segment.out_info.precalc.reset();
+  try {
+    const int64_t chunk = avs_in_info.buffersize_for_samples / avs_in_info.AudioChannels; // 1 sec
+    int64_t skip = start - prime_start;
+    const auto t0 = std::chrono::steady_clock::now();
+    segment.samples.resize((size_t)std::max(segment_samples, std::min(skip, chunk)) * channels);
+    while (skip > 0) {
+      const int64_t n = std::min(skip, chunk);
+      render_chain(segment_chain, segment.out_info, segment.samples.data(), (size_t)n * channels, nullptr);
+      skip -= n;
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    segment.samples.resize((size_t)segment_samples * channels);
+    render_chain(segment_chain, segment.out_info, segment.samples.data(), segment.samples.size(), nullptr);
+    // the pre-roll is wasted, and all of it when the segment is rendered again
+    const auto t2 = std::chrono::steady_clock::now();
+    stats->requests.skipped.fetch_add((uint64_t)(start - prime_start), std::memory_order_relaxed);
+    if (replay)
+      stats->requests.replayed.fetch_add((uint64_t)segment_samples, std::memory_order_relaxed);
+    stats->requests.wasted_ns.fetch_add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>((replay ? t2 : t1) - t0).count(), std::memory_order_relaxed);
+  }
+  catch (...) {
+    sox_delete_effects_chain(segment_chain);
+    throw;
+  }
+  sox_delete_effects_chain(segment_chain);
+  segment.index = index;
+}
+
+// Renders the missing ones of the segments from 'first_index' on, as many at once as there are workers.
+// Rendered segments are kept until their renderer is needed for a new one.
+void SoxFilter::RenderSegments(int64_t first_index, IScriptEnvironment* env)
+{
+  const int64_t last_index = first_index + (int64_t)segments.size();
+  const int64_t end_index = (vi.num_audio_samples + segment_samples - 1) / segment_samples; // no rendering after the end
+  std::vector<int64_t> missing;
+  std::vector<segment_renderer_t*> renderers;
+  for (int64_t index = first_index; index < last_index && (index < end_index || index == first_index); index++) {
+    if (std::none_of(segments.begin(), segments.end(), [index](const auto& segment) { return segment->index == index; }))
+      missing.push_back(index);
+  }
+  for (auto& segment : segments) {
+    if (segment->index < first_index || segment->index >= last_index)
+      renderers.push_back(segment.get());
+  }
+
+  _RPT2(0, "RenderSegments: first=%d count=%d\n", (int)first_index, (int)missing.size());
+
+  // a segment rendered before was dropped since: rendered again
+  std::vector<char> replay(missing.size());
+  for (size_t i = 0; i < missing.size(); i++) {
+    if ((size_t)missing[i] >= segments_rendered.size())
+      segments_rendered.resize((size_t)missing[i] + 1);
+    replay[i] = segments_rendered[(size_t)missing[i]];
+    segments_rendered[(size_t)missing[i]] = true;
+  }
+
+  std::vector<std::exception_ptr> errors(missing.size());
+  segment_pool->run(missing.size(), [this, &missing, &renderers, &replay, &errors](size_t i) {
+    try {
+      RenderSegment(*renderers[i], missing[i], replay[i] != 0);
+    }
+    catch (...) {
+      errors[i] = std::current_exception();
+    }
+    });
+  for (auto& error : errors) {
+    if (error)
+      env->ThrowError("%s", error_message(error).c_str());
+  }
+}
+
+// GetAudio in segment mode: any request is served from the rendered segments
+void SoxFilter::GetSegmentedAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env)
+{
+  const size_t channels = vi.AudioChannels();
+  sox_sample_t* target = (sox_sample_t*)buf;
+  while (count > 0) {
+    const int64_t index = start / segment_samples;
+    auto find_segment = [this, index]() {
+      for (auto& segment : segments)
+        if (segment->index == index)
+          return segment.get();
+      return (segment_renderer_t*)nullptr;
+    };
+    segment_renderer_t* segment = find_segment();
+    if (!segment) {
+      RenderSegments(index, env);
+      segment = find_segment();
+    }
+    const int64_t offset = start - index * segment_samples;
+    const int64_t n = std::min(count, segment_samples - offset);
+    memcpy(target, segment->samples.data() + (size_t)offset * channels, (size_t)n * channels * sizeof(sox_sample_t));
+    target += (size_t)n * channels;
+    start += n;
+    count -= n;
+  }
+}
+
+// Renders and drops 'count' samples
+void SoxFilter::SkipAudio(int64_t count, IScriptEnvironment* env)
+{
+  if (count <= 0)
+    return;
+  const int64_t chunk = avs_in_info.buffersize_for_samples / vi.AudioChannels(); // 1 sec
+  std::vector<sox_sample_t> scratch((size_t)std::min(count, chunk) * vi.AudioChannels());
+  // the part rendered before is counted as replayed by RenderAudio
+  const int64_t skipped = std::max((int64_t)0, next_output_start + count - std::max(next_output_start, rendered_end));
+  const auto t0 = std::chrono::steady_clock::now();
+  const int64_t total = count;
+  while (count > 0) {
+    const int64_t n = std::min(count, chunk);
+    RenderAudio(scratch.data(), n, env);
+    count -= n;
+  }
+  if (skipped > 0) {
+    const auto t1 = std::chrono::steady_clock::now();
+    stats->requests.skipped.fetch_add((uint64_t)skipped, std::memory_order_relaxed);
+    stats->requests.wasted_ns.fetch_add((uint64_t)(std::chrono::duration<double, std::nano>(t1 - t0).count() * skipped / total), std::memory_order_relaxed);
+  }
+}
+
 // Debugging (avsmeter does not use audio): ffmpeg  -i s2.avs -c:a copy valami2.wav
 void __stdcall SoxFilter::GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env)
 {
-  // Everything in SOX is single samples, not accounting for channels.
-  out_info.sample_count_getaudio = (size_t)count * vi.AudioChannels();
-  out_info.output_sample_counter = 0;
-  out_info.output_sample_buf = (sox_sample_t*)buf; // int32_t *
-
   _RPT4(0, "\nSoxFilter::GetAudio: start=%d, count=%d, samplecount_mul_chn=%d next_start=%d\n",
     (int)start,
     (int)count,
-    (int)out_info.sample_count_getaudio,
-    (int)avs_in_info.inputbuf.next_start()
+    (int)(count * vi.AudioChannels()),
+    (int)avs_in_info.read_start
   );
 
   // DebugFilterInfos();
 
+  // the workers may call the child until this request returns
+  RequestScope request_scope(request_gate, env);
+
 /*
     // Illustrating the issue w/o Avisynth Audio Cache.
     // For such an Avisynth script, without audio cache, SoxFilter is called 4 times, with the same parameter!
@@ -867,8 +3403,104 @@ void __stdcall SoxFilter::GetAudio(void* buf, int64_t start, int64_t count, IScr
       then the one that was really needed (82000-82999)
 */
 
+  stats->requests.requests.fetch_add(1, std::memory_order_relaxed);
+  if (start != next_request_start)
+    stats->requests.nonsequential.fetch_add(1, std::memory_order_relaxed);
+  next_request_start = start + count;
+  if (stats_interval.count() > 0 && !stats_log.empty() && std::chrono::steady_clock::now() >= next_stats_log)
+    LogStats();
+
+  // Before the clip start (DelayAudio, Trim with audio offsets): silence, the chain starts at 0
+  if (start < 0) {
+    const int64_t n = std::min(count, -start);
+    memset(buf, 0, (size_t)n * vi.BytesPerAudioSample());
+    buf = (char*)buf + (size_t)n * vi.BytesPerAudioSample();
+    start += n;
+    count -= n;
+    if (count == 0)
+      return;
+  }
+
+  if (segment_samples > 0) {
+    GetSegmentedAudio(buf, start, count, env);
+    return;
+  }
+
+  if (renderer) {
+    // Already rendered ahead: drop what is skipped
+    const int64_t rendered_end = ahead_read_position + (int64_t)(rendered.size() / vi.AudioChannels());
+    if (start > ahead_read_position && start <= rendered_end) {
+      rendered.commit_read((size_t)(start - ahead_read_position) * vi.AudioChannels());
+      renderer->notify_consumed();
+      ahead_read_position = start;
+    }
+    if (start != ahead_read_position) {
+      // seek: stop the worker, the chain is then at next_output_start again
+      renderer->stop();
+      rendered.reset();
+      avs_in_info.env = env;
+      PositionChain(start, env);
+      ahead_read_position = start;
+    }
+    if (!renderer->running()) {
+      // Not this request's env: the worker goes on after the request has returned,
+      // it reads the child through request_gate only
+      avs_in_info.env = nullptr;
+      renderer->start([this]() { RenderAhead(); });
+    }
+
+    sox_sample_t* target = (sox_sample_t*)buf;
+    size_t needed = (size_t)count * vi.AudioChannels();
+    while (needed > 0) {
+      if (!renderer->wait_for_data()) {
+        // The chain stopped in the failed chunk, the next request goes on from there
+        // like after an error without render-ahead
+        const std::string error = error_message(renderer->take_error());
+        rendered.reset();
+        ahead_read_position = next_output_start;
+        env->ThrowError("%s", error.c_str());
+      }
+      const size_t got = rendered.read(target, needed);
+      target += got;
+      needed -= got;
+      renderer->notify_consumed();
+    }
+    ahead_read_position = start + count;
+    return;
+  }
+
+  // Save env for GetAudio which is invoked in 'input' effect 
+  // which is called from sox_flow_effects main loop.
+  avs_in_info.env = env; // to be able to use env->GetAudio in input drain
+
+  PositionChain(start, env);
+
+  RenderAudio(buf, count, env);
+
+#if 0
+  if (start == 0 && count > 0) {
+    if (restarted)
+      saveBufToFile("after.bin", buf, (int)count);
+    else
+      saveBufToFile("before.bin", buf, (int)count);
+  }
+#endif
+}
+
+// Brings the chain to 'start', if it is not there already
+void SoxFilter::PositionChain(int64_t start, IScriptEnvironment* env)
+{
   // First we check if we should reinitialize filters.
-  if (start <= 0 && avs_in_info.inputbuf.next_start()>0) {
+  if (checkpoint_interval > 0) {
+    // No EnsureVBRMp3Sync is used in this mode, any request can arrive.
+    if (start != next_output_start)
+      SeekToCheckpoint(start, env);
+  }
+  else if (preroll_samples > 0) {
+    if (start != next_output_start)
+      SeekWithPreroll(start, env);
+  }
+  else if (start <= 0 && next_output_start > 0) {
     // The stream is restarted every time when a sample previous to the last one is requested.
     // Q: or start != prev_start+prev_count ?
     // A: no, in such cases EnsureVBRMp3Sync requests samples from zero: start=0
@@ -883,78 +3515,171 @@ void __stdcall SoxFilter::GetAudio(void* buf, int64_t start, int64_t count, IScr
     */
     // DebugFilterInfos()
   }
+}
+
+// Worker step of render-ahead: renders the next chunk into the 'rendered' ring.
+// Called only when a whole chunk fits in; the chain is owned by the worker
+// until the renderer is stopped. No env: errors are reported by the next request.
+void SoxFilter::RenderAhead()
+{
+  const size_t chunk_size = (size_t)render_chunk * vi.AudioChannels();
+  size_t span;
+  sox_sample_t* target = rendered.write_span(span);
+  if (span >= chunk_size) {
+    RenderAudio(target, render_chunk, nullptr);
+    rendered.commit_write(chunk_size);
+  }
+  else {
+    // would wrap
+    RenderAudio(render_buf.data(), render_chunk, nullptr);
+    rendered.write(render_buf.data(), chunk_size);
+  }
+}
+
+// Sequential rendering of the next 'count' samples into buf.
+// env: nullptr on the render-ahead worker, errors are std::runtime_error then
+void SoxFilter::RenderAudio(void* buf, int64_t count, IScriptEnvironment* env)
+{
+  const int64_t render_start = next_output_start;
+  next_output_start += count;
+  // output rendered before, e.g. after a restart, is wasted work
+  const int64_t replayed = std::max((int64_t)0, std::min(next_output_start, rendered_end) - render_start);
+  rendered_end = std::max(rendered_end, next_output_start);
+  const auto t0 = std::chrono::steady_clock::now();
+
+  // Everything in SOX is single samples, not accounting for channels.
+  out_info.sample_count_getaudio = (size_t)count * vi.AudioChannels();
+  out_info.output_sample_counter = 0;
+  out_info.output_sample_buf = (sox_sample_t*)buf; // int32_t * or float *
 
   // While there are precalculated output samples in our output buffer, consume them up.
   // See remarks in 'output_flow' as well.
   // Effect flow is not started while precalculated samples still exist.
-  if (out_info.remaining_precalculated_samples > 0) {
+  if (out_info.precalc.size() > 0) {
     
     _RPT3(0, "SoxFilter::GetAudio: BEFORE excess: samplecount=%d samplecount_mul_chn=%d mod=%d\n",
-      (int)out_info.remaining_precalculated_samples / vi.AudioChannels(),
-      (int)out_info.remaining_precalculated_samples,
-      (int)out_info.remaining_precalculated_samples % vi.AudioChannels());
+      (int)out_info.precalc.size() / vi.AudioChannels(),
+      (int)out_info.precalc.size(),
+      (int)out_info.precalc.size() % vi.AudioChannels());
     
-    size_t samplecount_to_copy_from_precalc_buf = std::min((size_t)count * vi.AudioChannels(), out_info.remaining_precalculated_samples);
-    memcpy(
-      &out_info.output_sample_buf[out_info.output_sample_counter], 
-      &out_info.precalc_buf[out_info.precalc_ptr], 
-      samplecount_to_copy_from_precalc_buf * sizeof(sox_sample_t));
-    out_info.output_sample_counter += samplecount_to_copy_from_precalc_buf;
-    out_info.precalc_ptr += samplecount_to_copy_from_precalc_buf;
-    out_info.remaining_precalculated_samples -= samplecount_to_copy_from_precalc_buf;
-    count -= samplecount_to_copy_from_precalc_buf / vi.AudioChannels();
+    output_append_precalc(out_info, out_info.sample_count_getaudio);
+    stats->requests.precalc.fetch_add(out_info.output_sample_counter / vi.AudioChannels(), std::memory_order_relaxed);
     
     _RPT3(0, "SoxFilter::GetAudio: AFTER excess: samplecount=%d samplecount_mul_chn=%d mod=%d\n",
-      (int)out_info.remaining_precalculated_samples / vi.AudioChannels(),
-      (int)out_info.remaining_precalculated_samples,
-      (int)out_info.remaining_precalculated_samples % vi.AudioChannels());
+      (int)out_info.precalc.size() / vi.AudioChannels(),
+      (int)out_info.precalc.size(),
+      (int)out_info.precalc.size() % vi.AudioChannels());
   }
 
-  // Save env for GetAudio which is invoked in 'input' effect 
-  // which is called from sox_flow_effects main loop.
-  avs_in_info.env = env; // to be able to use env->GetAudio in input drain
-
   // output_sample_counter is increased in the output 'effect'
   while (out_info.output_sample_counter < out_info.sample_count_getaudio)
   {
     _RPT4(0, "SoxFilter::GetAudio: BEFORE flow: output_sample_counter_mul_chn=%d total_needed_sample_count_mul_chn=%d next_start=%d\n",
       (int)out_info.output_sample_counter,
       (int)out_info.sample_count_getaudio,
-      (int)out_info.remaining_precalculated_samples % vi.AudioChannels(),
-      (int)avs_in_info.inputbuf.next_start());
+      (int)out_info.precalc.size() % vi.AudioChannels(),
+      (int)avs_in_info.read_start);
 
     int sox_errno = sox_flow_effects(chain, NULL, NULL);
 
     _RPT3(0, "SoxFilter::GetAudio: AFTER flow debug1/2: output_sample_counter_mul_chn=%d total_needed_sample_count_mul_chn=%d next_start=%d\n",
       (int)out_info.output_sample_counter,
       (int)out_info.sample_count_getaudio,
-      (int)out_info.remaining_precalculated_samples % vi.AudioChannels());
+      (int)out_info.precalc.size() % vi.AudioChannels());
     _RPT4(0, "SoxFilter::GetAudio: AFTER flow debug2/2: samplecount=%d samplecount_mul_chn=%d mod=%d\n",
-      (int)out_info.remaining_precalculated_samples / vi.AudioChannels(),
-      (int)out_info.remaining_precalculated_samples,
-      (int)out_info.remaining_precalculated_samples % vi.AudioChannels(),
-      (int)avs_in_info.inputbuf.next_start());
+      (int)out_info.precalc.size() / vi.AudioChannels(),
+      (int)out_info.precalc.size(),
+      (int)out_info.precalc.size() % vi.AudioChannels(),
+      (int)avs_in_info.read_start);
     // EOF: a buffer is fully exported into Avisynth's GetAudio buffer
     // EOF means that output_sample_counter == sample_count_getaudio, so we'll exit from this loop
     // SUCCESS: buffer is not filled 100% yet, output_sample_counter is still < sample_count_getaudio
     // EOF and SUCCESS are set by 'output_flow' return value
     if (sox_errno != SOX_SUCCESS && sox_errno != SOX_EOF)
-      env->ThrowError("SoxFilter: sox_flow_effects error: \n\n%d %s\n", sox_errno, sox_strerror(sox_errno));
+      throw_error(env, "SoxFilter: sox_flow_effects error: \n\n%d %s\n", sox_errno, sox_strerror(sox_errno));
+
+    // Between two flows the chain is in a consistent state, it can be saved.
+    if (checkpoint_interval > 0) {
+      const int64_t position = render_start + out_info.output_sample_counter / vi.AudioChannels();
+      if (position >= next_checkpoint_position && position > checkpoints.back().position) {
+        SaveCheckpoint(position);
+        next_checkpoint_position = position + checkpoint_interval;
+      }
+    }
+
     if (sox_errno == SOX_EOF) {
       if (out_info.output_sample_counter != out_info.sample_count_getaudio)
-        env->ThrowError("SoxFilter: sox_flow_effects error EOF received but buffer for GetAudio is not finished:\n");
+        throw_error(env, "SoxFilter: sox_flow_effects error EOF received but buffer for GetAudio is not finished:\n");
       break;
     }
   }
 
-#if 0
-  if (start == 0 && count > 0) {
-    if (restarted)
-      saveBufToFile("after.bin", buf, (int)count);
-    else
-      saveBufToFile("before.bin", buf, (int)count);
+  if (replayed > 0) {
+    const auto t1 = std::chrono::steady_clock::now();
+    stats->requests.replayed.fetch_add((uint64_t)replayed, std::memory_order_relaxed);
+    stats->requests.wasted_ns.fetch_add((uint64_t)(std::chrono::duration<double, std::nano>(t1 - t0).count() * replayed / count), std::memory_order_relaxed);
   }
-#endif
+}
+
+// Parameters of SoxFilter(), for AddFunction and for the header of request traces
+static const char* const soxfilter_params = "cs+[checkpoint]f[preroll]f[spare]b[prefetch]f[lookahead]f[pipeline]i[threads]i[segment]f[nativefloat]b[biquad]b[fftconv]i[stats]f[statslog]s[trace]s[segmentthreads]i";
+
+// Records the requests of the script into a file, one "start count" line each: host_bench --replay
+// runs them again. It is the outermost clip, before EnsureVBRMp3Sync, to see the requests
+// of the consumers as they are. Its cache hints are the ones of the SoxFilter instance (MT mode,
+// audio cache), not the ones of its child, which may be EnsureVBRMp3Sync.
+class TraceAudioRequests : public GenericVideoFilter
+{
+private:
+  FILE* file;
+  std::mutex lock;
+  PClip soxfilter; // answers the cache hints
+
+public:
+  TraceAudioRequests(PClip _child, PClip _soxfilter, FILE* _file) : GenericVideoFilter(_child), file(_file), soxfilter(_soxfilter) {}
+  ~TraceAudioRequests() { fclose(file); }
+
+  void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) override
+  {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      fprintf(file, "%lld %lld\n", (long long)start, (long long)count);
+    }
+    child->GetAudio(buf, start, count, env);
+  }
+
+  int __stdcall SetCacheHints(int cachehints, int frame_range) override { return soxfilter->SetCacheHints(cachehints, frame_range); }
+};
+
+// Opens a request trace and writes its header: the source clip, the effects and the parameters given, e.g.
+// "source 48000 2 16 2884481" (rate, channels, SAMPLE_INT16, samples), "effect lowpass 120", "param preroll=0.5"
+static FILE* open_request_trace(const char* path, const AVSValue& args, const VideoInfo& source_vi, IScriptEnvironment* env)
+{
+  FILE* f = fopen(path, "w");
+  if (!f)
+    env->ThrowError("SoxFilter: cannot create trace file '%s'", path);
+  fprintf(f, "# SoxFilter request trace: header, then the requests: start count\n");
+  fprintf(f, "source %d %d %d %lld\n", source_vi.audio_samples_per_second, source_vi.AudioChannels(), source_vi.SampleType(),
+    (long long)source_vi.num_audio_samples);
+  for (int i = 0; i < args[1].ArraySize(); i++)
+    fprintf(f, "effect %s\n", args[1][i].AsString(""));
+  // named parameters "[name]t" from argument #2 on, the trace itself is not repeated
+  const char* p = soxfilter_params;
+  for (int i = 2; (p = strchr(p, '[')) != nullptr; i++) {
+    const char* end = strchr(p, ']');
+    const std::string name(p + 1, end);
+    const char type = end[1];
+    p = end;
+    if (!args[i].Defined() || name == "trace")
+      continue;
+    switch (type) {
+    case 'f': fprintf(f, "param %s=%.9g\n", name.c_str(), args[i].AsFloat()); break;
+    case 'i': fprintf(f, "param %s=%d\n", name.c_str(), args[i].AsInt()); break;
+    case 'b': fprintf(f, "param %s=%s\n", name.c_str(), args[i].AsBool() ? "true" : "false"); break;
+    default: fprintf(f, "param %s=%s\n", name.c_str(), args[i].AsString("")); break;
+    }
+  }
+  return f;
 }
 
 // Example:
@@ -962,19 +3687,36 @@ void __stdcall SoxFilter::GetAudio(void* buf, int64_t start, int64_t count, IScr
 AVSValue __cdecl Create_SoxFilter(AVSValue args, void* user_data, IScriptEnvironment* env)
 {
   // sox works with 32 bit integers: sox_sample_t = int32_t
-  // Any input must be converted into that
+  // Any input must be converted into that.
+  // 16 and 24 bit input (and float input in nativefloat mode) is converted by SoxFilter
+  // itself while reading it, 8 bit and float with ConvertAudio.
   PClip clip = args[0].AsClip();
-  AVSValue new_args[3] = { clip, AvsSampleType::SAMPLE_INT32, AvsSampleType::SAMPLE_INT32 };
-  clip = env->Invoke("ConvertAudio", AVSValue(new_args, 3)).AsClip();
+  const VideoInfo source_vi = clip->GetVideoInfo();
+  const bool native_float = args[10].AsBool(false);
+  const int sample_type = clip->GetVideoInfo().SampleType();
+  if (!(sample_type == SAMPLE_INT16 || sample_type == SAMPLE_INT24 || sample_type == SAMPLE_INT32 ||
+    (native_float && sample_type == SAMPLE_FLOAT))) {
+    AVSValue new_args[3] = { clip, AvsSampleType::SAMPLE_INT32, AvsSampleType::SAMPLE_INT32 };
+    clip = env->Invoke("ConvertAudio", AVSValue(new_args, 3)).AsClip();
+  }
 
-  clip = new SoxFilter(clip, args, env);
+  SoxFilter* filter = new SoxFilter(clip, args, env);
+  clip = filter;
+  const PClip soxfilter = clip;
   
   // This filter is inserted in the chain for strict sequential access, 
   // but gives big penalty for any out-of-sequence sample request;
   // restarts audio read from the very beginning sample if such condition
   // is encountered.
-  AVSValue Ia[1] = { clip }; 
-  clip = env->Invoke("EnsureVBRMp3Sync", AVSValue(Ia, 1)).AsClip();
+  // Not needed when checkpoints or pre-roll are used, SoxFilter handles seeking itself.
+  if (!filter->HandlesSeeking()) {
+    AVSValue Ia[1] = { clip };
+    clip = env->Invoke("EnsureVBRMp3Sync", AVSValue(Ia, 1)).AsClip();
+  }
+
+  const char* trace = args[15].AsString("");
+  if (*trace)
+    clip = new TraceAudioRequests(clip, soxfilter, open_request_trace(trace, args, source_vi, env));
   
   return clip;
 
@@ -1003,8 +3745,7 @@ AVSValue SoxFilter_ListEffects(AVSValue args, void*, IScriptEnvironment* env)
       s += std::string(eh->name) + "\n";
   }
 
-  if (--sox_init_counter == 0)
-    sox_quit();
+  release_sox();
   return env->SaveString(s.c_str());
 }
 
@@ -1052,8 +3793,7 @@ AVSValue SoxFilter_GetAllEffects(AVSValue args, void*, IScriptEnvironment* env)
     result[i] = AVSValue(aEffect.data(), 2);
   }
 
-  if (--sox_init_counter == 0)
-    sox_quit();
+  release_sox();
   return AVSValue(result.data(), size);
 }
 
@@ -1086,22 +3826,53 @@ AVSValue SoxFilter_GetEffectUsage(AVSValue args, void*, IScriptEnvironment* env)
   }
   // not found is not an error, just returns empty string
 
-  if (--sox_init_counter == 0)
-    sox_quit();
+  release_sox();
 
   return result;
 }
 
+// Hit and miss counts of the filter caches shared by all SoxFilter instances, LF separated
+// e.g. SubTitle(ReplaceStr(SoxFilter_CacheStats(), e"\n", "\n"), lsp = 0)
+AVSValue SoxFilter_CacheStats(AVSValue args, void*, IScriptEnvironment* env)
+{
+  const SharedCache<effect_design_t>::stats_t designs = design_cache.stats();
+  const SharedCache<conv_filter_t>::stats_t filters = conv_filter_cache.stats();
+  const SharedCache<poly_filter_t>::stats_t phases = poly_filter_cache.stats();
+  char s[768];
+  snprintf(s, sizeof(s),
+    "designs: %llu hits, %llu misses, %llu evictions, %u entries, %u KB\n"
+    "fftconv filters: %llu hits, %llu misses, %llu evictions, %u entries, %u KB\n"
+    "polyphase tables: %llu hits, %llu misses, %llu evictions, %u entries, %u KB",
+    (unsigned long long)designs.hits, (unsigned long long)designs.misses, (unsigned long long)designs.evictions,
+    (unsigned)designs.entries, (unsigned)((designs.size + 1023) / 1024),
+    (unsigned long long)filters.hits, (unsigned long long)filters.misses, (unsigned long long)filters.evictions,
+    (unsigned)filters.entries, (unsigned)((filters.size + 1023) / 1024),
+    (unsigned long long)phases.hits, (unsigned long long)phases.misses, (unsigned long long)phases.evictions,
+    (unsigned)phases.entries, (unsigned)((phases.size + 1023) / 1024));
+  return env->SaveString(s);
+}
+
+// The counters of every SoxFilter instance alive, LF separated: its requests and engines,
+// with stats > 0 one line per effect as well, e.g.
+// "#1 sinc: calls=120 in=960000 out=960000 ms=80.213 clips=0"
+// #1 is the instance, in the order of creation. See FilterStats::report.
+AVSValue SoxFilter_Stats(AVSValue args, void*, IScriptEnvironment* env)
+{
+  return env->SaveString(FilterStats::report_all().c_str());
+}
+
 const AVS_Linkage* AVS_linkage;
 
 extern "C" __declspec(dllexport)
 const char* __stdcall AvisynthPluginInit3(IScriptEnvironment * env, const AVS_Linkage* const vectors)
 {
   AVS_linkage = vectors;
-  env->AddFunction("SoxFilter", "cs+", Create_SoxFilter, NULL);
+  env->AddFunction("SoxFilter", soxfilter_params, Create_SoxFilter, NULL);
   env->AddFunction("SoxFilter_ListEffects", "", SoxFilter_ListEffects, NULL);
   env->AddFunction("SoxFilter_GetAllEffects", "", SoxFilter_GetAllEffects, NULL);
   env->AddFunction("SoxFilter_GetEffectUsage", "s", SoxFilter_GetEffectUsage, NULL);
+  env->AddFunction("SoxFilter_CacheStats", "", SoxFilter_CacheStats, NULL);
+  env->AddFunction("SoxFilter_Stats", "", SoxFilter_Stats, NULL);
   return "SoxFilter";
 }
 
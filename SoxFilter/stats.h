@@ -0,0 +1,164 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Request and per-effect processing counters of the filter instances
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_STATS_H__
+#define __SOXFILTER_STATS_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+
+// Counters of one effect of a filter instance, summed over all the chains built for it:
+// restarted ones, the spare chain, pipeline stages and segments, which can flow concurrently.
+typedef struct effect_stats_t {
+  std::string name;
+  bool active; // the effect is in the chain, see FilterStats
+  std::atomic<uint64_t> calls; // flow and drain calls, all channels at once
+  std::atomic<uint64_t> samples_in; // all channels
+  std::atomic<uint64_t> samples_out;
+  std::atomic<uint64_t> ns; // time spent in flow and drain
+  std::atomic<uint64_t> clips;
+
+  explicit effect_stats_t(const std::string& _name) :
+    name(_name), active(false), calls(0), samples_in(0), samples_out(0), ns(0), clips(0) {}
+} effect_stats_t;
+
+// Counters of the requests of a filter instance and of the work they waste: output
+// rendered again (replayed) or rendered and dropped (skipped). Samples are per channel.
+typedef struct request_stats_t {
+  std::atomic<uint64_t> requests;
+  std::atomic<uint64_t> nonsequential; // not starting where the previous one ended
+  std::atomic<uint64_t> restarts; // the chain is started again from zero (or from a pre-roll)
+  std::atomic<uint64_t> restores; // a checkpoint is restored
+  std::atomic<uint64_t> precalc; // served from the excess output of a previous flow
+  std::atomic<uint64_t> replayed; // rendered once more: seeking back, re-requests
+  std::atomic<uint64_t> skipped; // rendered and dropped: pre-roll, seeking forward
+  std::atomic<uint64_t> wasted_ns; // time spent on replayed and skipped samples
+
+  request_stats_t() :
+    requests(0), nonsequential(0), restarts(0), restores(0), precalc(0), replayed(0), skipped(0), wasted_ns(0) {}
+} request_stats_t;
+
+// The counters of a filter instance: the requests, and one entry per effect in the chain, 'input' and 'output'
+// included, in chain order. Entries are made at filter creation, the chain builds set 'active'
+// and the name of the effects they add on the first build only, later builds just count.
+// The first build also notes the effects run by SoxFilter's own engines instead of libsox.
+// Once published, the instance is listed by FilterStats::report_all (SoxFilter_Stats)
+// while it is alive.
+class FilterStats {
+private:
+  std::vector<std::unique_ptr<effect_stats_t>> effects;
+  std::vector<std::string> engines; // see add_engine
+  int id;
+  std::chrono::steady_clock::time_point created;
+  int rate; // output, for the wasted seconds
+
+  static std::mutex& registry_lock() {
+    static std::mutex lock;
+    return lock;
+  }
+  static std::vector<const FilterStats*>& registry() {
+    static std::vector<const FilterStats*> filters;
+    return filters;
+  }
+
+public:
+  request_stats_t requests;
+
+  explicit FilterStats(const std::vector<std::string>& names) : rate(0) {
+    for (const auto& name : names)
+      effects.push_back(std::make_unique<effect_stats_t>(name));
+    static std::atomic<int> next_id(1);
+    id = next_id++;
+    created = std::chrono::steady_clock::now();
+  }
+  ~FilterStats() {
+    std::lock_guard<std::mutex> lock(registry_lock());
+    auto& filters = registry();
+    filters.erase(std::remove(filters.begin(), filters.end(), this), filters.end());
+  }
+  FilterStats(const FilterStats&) = delete;
+  FilterStats& operator=(const FilterStats&) = delete;
+
+  effect_stats_t* effect(size_t index) { return effects[index].get(); }
+
+  // Before publish: effects run by an engine of SoxFilter, e.g. "highpass,equalizer,vol -> biquads sections=3"
+  void add_engine(const std::string& note) { engines.push_back(note); }
+
+  // names, 'active' and the engines are not changed any more
+  void publish(int _rate) {
+    rate = _rate;
+    std::lock_guard<std::mutex> lock(registry_lock());
+    registry().push_back(this);
+  }
+
+  double seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count(); }
+
+  // The line of the requests, e.g.
+  // "#1 requests=300 nonsequential=2 restarts=2 restores=0 precalc=1200 replayed=96000 skipped=0 wasted=96000 wasted_audio_s=2.000 wasted_ms=8.021"
+  std::string report_requests() const {
+    char line[512];
+    const uint64_t wasted = requests.replayed.load(std::memory_order_relaxed) + requests.skipped.load(std::memory_order_relaxed);
+    snprintf(line, sizeof(line), "#%d requests=%llu nonsequential=%llu restarts=%llu restores=%llu precalc=%llu replayed=%llu skipped=%llu wasted=%llu wasted_audio_s=%.3f wasted_ms=%.3f\n", id,
+      (unsigned long long)requests.requests.load(std::memory_order_relaxed),
+      (unsigned long long)requests.nonsequential.load(std::memory_order_relaxed),
+      (unsigned long long)requests.restarts.load(std::memory_order_relaxed),
+      (unsigned long long)requests.restores.load(std::memory_order_relaxed),
+      (unsigned long long)requests.precalc.load(std::memory_order_relaxed),
+      (unsigned long long)requests.replayed.load(std::memory_order_relaxed),
+      (unsigned long long)requests.skipped.load(std::memory_order_relaxed),
+      (unsigned long long)wasted, rate ? (double)wasted / rate : 0.0,
+      requests.wasted_ns.load(std::memory_order_relaxed) / 1e6);
+    return line;
+  }
+
+  // The requests, the engines, then one line per active effect, e.g.
+  // "#1 requests=300 nonsequential=2 ..." (see report_requests)
+  // "#1 engine: sinc -> fftconv taps=4095"
+  // "#1 sinc: calls=120 in=960000 out=960000 ms=80.213 clips=0"
+  std::string report() const {
+    std::string s = report_requests();
+    char line[512];
+    for (const auto& note : engines) {
+      snprintf(line, sizeof(line), "#%d engine: %s\n", id, note.c_str());
+      s += line;
+    }
+    for (const auto& e : effects) {
+      if (!e->active)
+        continue;
+      snprintf(line, sizeof(line), "#%d %s: calls=%llu in=%llu out=%llu ms=%.3f clips=%llu\n", id, e->name.c_str(),
+        (unsigned long long)e->calls.load(std::memory_order_relaxed),
+        (unsigned long long)e->samples_in.load(std::memory_order_relaxed),
+        (unsigned long long)e->samples_out.load(std::memory_order_relaxed),
+        e->ns.load(std::memory_order_relaxed) / 1e6,
+        (unsigned long long)e->clips.load(std::memory_order_relaxed));
+      s += line;
+    }
+    return s;
+  }
+
+  // The report of every instance alive, in creation order
+  static std::string report_all() {
+    std::lock_guard<std::mutex> lock(registry_lock());
+    std::string s;
+    for (const FilterStats* filter : registry())
+      s += filter->report();
+    return s;
+  }
+};
+
+#endif // __SOXFILTER_STATS_H__
@@ -0,0 +1,128 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Fork-join thread pool
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_THREADPOOL_H__
+#define __SOXFILTER_THREADPOOL_H__
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Runs 'count' independent tasks of a job on persistent worker threads.
+// The calling thread works on its own job as well, then waits until all of
+// its tasks are finished. Several threads may run jobs at the same time
+// (e.g. pipeline stages), the workers take tasks from any pending job.
+// Tasks must not throw.
+class ThreadPool {
+private:
+  struct job_t {
+    std::function<void(size_t)> task;
+    size_t count;
+    std::atomic<size_t> next; // next task index to take
+    std::atomic<size_t> done; // finished task count
+    size_t workers_on_it; // guarded by mutex
+  };
+
+  std::vector<std::thread> workers;
+  std::deque<job_t*> jobs; // with tasks not taken yet
+  std::mutex mutex;
+  std::condition_variable cv_work; // new job or stop
+  std::condition_variable cv_done; // a worker left a job
+  bool stop_requested;
+
+  // runs tasks of the job until none is left to take
+  static void work_on(job_t& job) {
+    size_t i;
+    while ((i = job.next.fetch_add(1)) < job.count) {
+      job.task(i);
+      job.done.fetch_add(1);
+    }
+  }
+
+  // a job is referenced by a worker only while it is in the queue or counted in workers_on_it
+  void remove_job(job_t* job) {
+    auto it = std::find(jobs.begin(), jobs.end(), job);
+    if (it != jobs.end())
+      jobs.erase(it);
+  }
+
+  void worker_loop() {
+    while (true) {
+      job_t* job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv_work.wait(lock, [&] { return stop_requested || !jobs.empty(); });
+        if (stop_requested)
+          return;
+        job = jobs.front();
+        if (job->next.load() >= job->count) {
+          jobs.pop_front(); // every task is taken already
+          continue;
+        }
+        job->workers_on_it++;
+      }
+      work_on(*job);
+      std::lock_guard<std::mutex> lock(mutex);
+      remove_job(job);
+      job->workers_on_it--;
+      cv_done.notify_all();
+    }
+  }
+
+public:
+  // thread_count: number of threads working on a job, the calling one included
+  explicit ThreadPool(size_t thread_count) : stop_requested(false) {
+    for (size_t i = 1; i < thread_count; i++)
+      workers.emplace_back(&ThreadPool::worker_loop, this);
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop_requested = true;
+    }
+    cv_work.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  size_t thread_count() const { return workers.size() + 1; }
+
+  // Calls task(0) .. task(count - 1), returns when all of them are finished
+  void run(size_t count, const std::function<void(size_t)>& task) {
+    job_t job;
+    job.task = task;
+    job.count = count;
+    job.next = 0;
+    job.done = 0;
+    job.workers_on_it = 0;
+    if (count > 1 && !workers.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+      }
+      cv_work.notify_all();
+    }
+    work_on(job);
+    std::unique_lock<std::mutex> lock(mutex);
+    remove_job(&job);
+    cv_done.wait(lock, [&] { return job.done.load() == job.count && job.workers_on_it == 0; });
+  }
+};
+
+#endif // __SOXFILTER_THREADPOOL_H__
@@ -0,0 +1,149 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Helpers shared by the benchmark programs: test noise, timing, the --isa option
+ * and, built with libsox (SOXFILTER_BENCH_LIBSOX), running one of its effects
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_BENCH_UTIL_H__
+#define __SOXFILTER_BENCH_UTIL_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+#include <sox.h>
+#endif
+
+// xorshift32: the next value of 'state', which must not be 0
+inline uint32_t xorshift32(uint32_t& state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// The noise of the micro-benchmarks, the same sequence in every run
+inline uint32_t noise()
+{
+  static uint32_t state = 1;
+  return xorshift32(state);
+}
+
+// Calls f once to warm it up, then 'repeat' times.
+// Returns million units per second, 'units' is the work of one call (samples, frames).
+template<typename F>
+double measure(F f, int repeat, double units)
+{
+  f();
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < repeat; i++)
+    f();
+  const auto t1 = std::chrono::steady_clock::now();
+  return units * repeat / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+}
+
+// The value of --isa a,b,c: the instruction sets to run, 'all' when it is not given
+inline std::string parse_isa_option(int argc, char** argv, const char* all)
+{
+  std::string isas = all;
+  for (int i = 1; i + 1 < argc; i++)
+    if (!strcmp(argv[i], "--isa"))
+      isas = argv[i + 1];
+  return isas;
+}
+
+// 'name' is in the comma separated list of parse_isa_option
+inline bool isa_selected(const std::string& isas, const char* name)
+{
+  return ("," + isas + ",").find(std::string(",") + name + ",") != std::string::npos;
+}
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+// ------------------------ libsox ------------------------------
+
+typedef struct bench_io_t {
+  const std::vector<sox_sample_t>* in;
+  size_t pos;
+  size_t channels;
+  std::vector<sox_sample_t>* out;
+} bench_io_t;
+
+inline int bench_input_drain(sox_effect_t* effp, sox_sample_t* obuf, size_t* osamp)
+{
+  bench_io_t* io = *reinterpret_cast<bench_io_t**>(effp->priv);
+  size_t n = std::min(*osamp, io->in->size() - io->pos);
+  n -= n % io->channels;
+  std::copy(io->in->begin() + io->pos, io->in->begin() + io->pos + n, obuf);
+  io->pos += n;
+  *osamp = n;
+  return n ? SOX_SUCCESS : SOX_EOF;
+}
+
+inline int bench_output_flow(sox_effect_t* effp, sox_sample_t const* ibuf, sox_sample_t* obuf, size_t* isamp, size_t* osamp)
+{
+  (void)obuf;
+  bench_io_t* io = *reinterpret_cast<bench_io_t**>(effp->priv);
+  io->out->insert(io->out->end(), ibuf, ibuf + *isamp);
+  *osamp = 0;
+  return SOX_SUCCESS;
+}
+
+// Runs the interleaved samples 'in' through the libsox effect 'name' with its options.
+// out_rate: the output rate of a rate changing effect, 0 for the input rate.
+// Returns its whole output, empty when the effect is not there or cannot be added.
+inline std::vector<sox_sample_t> run_libsox_effect(const char* name, int argc, char** argv,
+  double rate, size_t channels, double out_rate, const std::vector<sox_sample_t>& in)
+{
+  const sox_effect_handler_t* handler = sox_find_effect(name);
+  if (!handler)
+    return std::vector<sox_sample_t>();
+
+  static sox_effect_handler_t bench_input = {
+    "input", NULL, SOX_EFF_MCHAN, NULL, NULL, NULL, bench_input_drain, NULL, NULL, sizeof(bench_io_t*)
+  };
+  static sox_effect_handler_t bench_output = {
+    "output", NULL, SOX_EFF_MCHAN, NULL, NULL, bench_output_flow, NULL, NULL, NULL, sizeof(bench_io_t*)
+  };
+
+  std::vector<sox_sample_t> out;
+  bench_io_t io = { &in, 0, channels, &out };
+  sox_signalinfo_t signal = { rate, (unsigned)channels, 32, in.size(), NULL };
+  sox_signalinfo_t out_signal = signal;
+  if (out_rate > 0)
+    out_signal.rate = out_rate;
+  sox_encodinginfo_t encoding = { SOX_ENCODING_SIGN2, 32, 0, sox_option_default, sox_option_default, sox_option_default, sox_false };
+  sox_effects_chain_t* chain = sox_create_effects_chain(&encoding, &encoding);
+
+  sox_effect_t* e = sox_create_effect(&bench_input);
+  *reinterpret_cast<bench_io_t**>(e->priv) = &io;
+  sox_add_effect(chain, e, &signal, &signal);
+  free(e);
+
+  e = sox_create_effect(handler);
+  const bool added = sox_effect_options(e, argc, argv) == SOX_SUCCESS && sox_add_effect(chain, e, &signal, &out_signal) == SOX_SUCCESS;
+  free(e);
+
+  if (added) {
+    e = sox_create_effect(&bench_output);
+    *reinterpret_cast<bench_io_t**>(e->priv) = &io;
+    sox_add_effect(chain, e, &signal, &signal);
+    free(e);
+    sox_flow_effects(chain, NULL, NULL);
+  }
+  sox_delete_effects_chain(chain);
+  return out;
+}
+#endif
+
+#endif // __SOXFILTER_BENCH_UTIL_H__
@@ -0,0 +1,184 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Micro-benchmark of the biquad engine (biquad.h)
+ *
+ * A cascade of five sections (highpass 30, equalizer 100 1q -2, equalizer 3000 2q 1.5,
+ * lowpass 16000, and vol 3dB as a gain section) is run by every kernel set, and the output
+ * and the clip count are checked to be bit-exact with libsox' per-channel biquad flows and
+ * vol's flow (truncating), implemented here the same way.
+ * Timed on one second of 48 kHz audio for mono, stereo, 5.1 and 7.1, as one section
+ * per pass (one libsox effect) and as the whole cascade in one pass.
+ * Instruction sets the CPU does not support must be skipped: --isa c,sse2,avx2
+ * Output is one line per case: isa channels sections Mframes/s
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "biquad.h"
+#include "bench_util.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+
+static const size_t FRAMES = 48000;
+static const double RATE = 48000.0;
+static const int REPEAT = 50;
+// the effects get at most one libsox buffer at once
+static const size_t BLOCK_SAMPLES = 8192;
+
+// RBJ cookbook designs as in libsox' biquads.c, normalized by a0
+static biquad_coefs_t normalize(double b0, double b1, double b2, double a0, double a1, double a2)
+{
+  return biquad_coefs_t{ b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+}
+
+static biquad_coefs_t design_pass(bool high, double fc, double q)
+{
+  const double w0 = 2 * M_PI * fc / RATE;
+  const double alpha = sin(w0) / (2 * q);
+  const double c = cos(w0);
+  if (high)
+    return normalize((1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+  return normalize((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+}
+
+static biquad_coefs_t design_peak(double fc, double q, double gain_db)
+{
+  const double A = exp(gain_db / 40 * log(10.));
+  const double w0 = 2 * M_PI * fc / RATE;
+  const double alpha = sin(w0) / (2 * q);
+  const double c = cos(w0);
+  return normalize(1 + alpha * A, -2 * c, 1 - alpha * A, 1 + alpha / A, -2 * c, 1 - alpha / A);
+}
+
+// lsx_biquad_flow with SOX_ROUND_CLIP_COUNT, one channel of interleaved audio;
+// a 'truncate' section is vol's flow: SOX_SAMPLE_CLIP_COUNT, then truncated
+struct reference_biquad_t {
+  biquad_coefs_t c;
+  sample32_t i1, i2;
+  double o1, o2;
+};
+
+static uint64_t reference_flow(reference_biquad_t& p, const sample32_t* ibuf, sample32_t* obuf, size_t len, size_t step)
+{
+  uint64_t clips = 0;
+  for (size_t n = 0; n < len; n++, ibuf += step, obuf += step) {
+    if (p.c.truncate) {
+      double sample = p.c.b0 * *ibuf;
+      if (sample > 2147483647.0)
+        sample = 2147483647.0, ++clips;
+      else if (sample < -2147483648.0)
+        sample = -2147483648.0, ++clips;
+      *obuf = (sample32_t)sample;
+      continue;
+    }
+    const double o0 = *ibuf * p.c.b0 + p.i1 * p.c.b1 + p.i2 * p.c.b2 - p.o1 * p.c.a1 - p.o2 * p.c.a2;
+    p.i2 = p.i1, p.i1 = *ibuf;
+    p.o2 = p.o1, p.o1 = o0;
+    *obuf = o0 < 0 ? o0 <= -2147483648.0 - 0.5 ? ++clips, INT32_MIN : (sample32_t)(o0 - 0.5)
+      : o0 >= 2147483647.0 + 0.5 ? ++clips, INT32_MAX : (sample32_t)(o0 + 0.5);
+  }
+  return clips;
+}
+
+int main(int argc, char** argv)
+{
+  const std::string isas = parse_isa_option(argc, argv, "c,sse2,avx2");
+
+  const std::vector<biquad_coefs_t> coefs = {
+    design_pass(true, 30, sqrt(0.5)),
+    design_peak(100, 1, -2),
+    design_peak(3000, 2, 1.5),
+    design_pass(false, 16000, sqrt(0.5)),
+    biquad_coefs_t{ exp(3 * M_LN10 * 0.05), 0, 0, 0, 0, true }, // vol's flow: the other terms are zero
+  };
+  const size_t sections = coefs.size();
+
+  static const struct { const char* name; biquad_isa_t isa; } all[] = {
+    { "c", BIQUAD_C }, { "sse2", BIQUAD_SSE2 }, { "avx2", BIQUAD_AVX2 }
+  };
+  static const size_t channel_counts[] = { 1, 2, 6, 8 };
+
+  int errors = 0;
+  for (size_t channels : channel_counts) {
+    // noise, some of it near full scale so that a few samples clip
+    std::vector<sample32_t> in(FRAMES * channels);
+    for (auto& v : in)
+      v = (sample32_t)noise() / ((noise() & 255) ? 4 : 1);
+
+    // reference: effect after effect, channel by channel, in libsox buffer sized blocks
+    const size_t block_frames = BLOCK_SAMPLES / channels;
+    std::vector<sample32_t> ref(in);
+    uint64_t ref_clips = 0;
+    std::vector<reference_biquad_t> flows(sections * channels, reference_biquad_t{});
+    for (size_t s = 0; s < sections; s++)
+      for (size_t ch = 0; ch < channels; ch++)
+        flows[s * channels + ch].c = coefs[s];
+    for (size_t f = 0; f < FRAMES; f += block_frames) {
+      const size_t n = std::min(block_frames, FRAMES - f);
+      for (size_t s = 0; s < sections; s++)
+        for (size_t ch = 0; ch < channels; ch++)
+          ref_clips += reference_flow(flows[s * channels + ch], &ref[f * channels + ch], &ref[f * channels + ch], n, channels);
+    }
+
+    for (const auto& entry : all) {
+      if (!isa_selected(isas, entry.name))
+        continue;
+      const biquad_kernels_t* kernels = get_biquad_kernels_isa(entry.isa);
+      if (!kernels)
+        continue;
+
+      std::vector<double> state(biquad_state_size(sections, channels));
+      std::vector<sample32_t> out(in.size());
+      auto run_cascade = [&]() {
+        uint64_t clips = 0;
+        std::fill(state.begin(), state.end(), 0.0);
+        for (size_t f = 0; f < FRAMES; f += block_frames) {
+          const size_t n = std::min(block_frames, FRAMES - f);
+          clips += biquad_process(kernels, coefs.data(), sections, state.data(), &in[f * channels], &out[f * channels], n, channels);
+        }
+        return clips;
+      };
+      const uint64_t clips = run_cascade();
+      if (out != ref || clips != ref_clips) {
+        printf("%s: %d channels: MISMATCH (clips %llu, expected %llu)\n", kernels->name, (int)channels,
+          (unsigned long long)clips, (unsigned long long)ref_clips);
+        errors++;
+        continue;
+      }
+
+      const double single = measure([&]() {
+        std::fill(state.begin(), state.end(), 0.0);
+        for (size_t f = 0; f < FRAMES; f += block_frames) {
+          const size_t n = std::min(block_frames, FRAMES - f);
+          biquad_process(kernels, coefs.data(), 1, state.data(), &in[f * channels], &out[f * channels], n, channels);
+        }
+        }, REPEAT, (double)FRAMES);
+      const double cascade = measure(run_cascade, REPEAT, (double)FRAMES);
+      printf("%s %d 1 %.1f\n", kernels->name, (int)channels, single);
+      printf("%s %d %d %.1f\n", kernels->name, (int)channels, (int)sections, cascade);
+    }
+
+    // the libsox way: one pass per effect and channel
+    std::vector<sample32_t> out(in);
+    const double libsox = measure([&]() {
+      for (auto& p : flows)
+        p.i1 = p.i2 = 0, p.o1 = p.o2 = 0;
+      std::copy(in.begin(), in.end(), out.begin());
+      for (size_t f = 0; f < FRAMES; f += block_frames) {
+        const size_t n = std::min(block_frames, FRAMES - f);
+        for (size_t s = 0; s < sections; s++)
+          for (size_t ch = 0; ch < channels; ch++)
+            reference_flow(flows[s * channels + ch], &out[f * channels + ch], &out[f * channels + ch], n, channels);
+      }
+      }, REPEAT, (double)FRAMES);
+    printf("libsox %d %d %.1f\n", (int)channels, (int)sections, libsox);
+  }
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Micro-benchmark of the partitioned FFT convolver (convolver.h)
+ *
+ * Windowed sinc lowpass filters of 255 to 32767 taps filter two seconds of 48 kHz noise.
+ * The output is checked against the same convolution done in double: directly for the
+ * shortest filter, by a single FFT per block otherwise (the libsox way: dft_filter, as used by
+ * sinc and fir, with the FFT size of lsx_set_dft_length). The convolver works in float,
+ * the largest difference must stay below 1e-6 of full scale (-120 dB).
+ * Timed for stereo and 5.1, on one thread and with one thread per channel pair, against
+ * that single FFT convolution in double (row 'single-fft', a stand-in of libsox, not libsox)
+ * and, when built with libsox (SOXFILTER_BENCH_LIBSOX), against libsox' fir given the same
+ * taps (row 'libsox'), whose output is checked the same way.
+ * The threshold of the fftconv parameter in the README comes from these rows.
+ * Instruction sets the CPU does not support must be skipped: --isa c,avx2
+ * Output is one line per case: isa channels taps threads Mframes/s
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convolver.h"
+#include "bench_util.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+
+static const size_t FRAMES = 96000;
+static const int REPEAT = 5;
+// the effects get at most one libsox buffer at once
+static const size_t BLOCK_SAMPLES = 8192;
+static const double MAX_ERROR = 1e-6;
+
+// lowpass at a quarter of the sample rate, Blackman window
+static std::vector<double> design(size_t taps)
+{
+  std::vector<double> h(taps);
+  const double c = (taps - 1) / 2.0;
+  for (size_t i = 0; i < taps; i++) {
+    const double x = i - c;
+    const double sinc = x == 0 ? 0.5 : sin(M_PI * 0.5 * x) / (M_PI * x);
+    const double w = 0.42 - 0.5 * cos(2 * M_PI * i / (taps - 1)) + 0.08 * cos(4 * M_PI * i / (taps - 1));
+    h[i] = sinc * w;
+  }
+  return h;
+}
+
+// libsox' dft_filter alignment: out[n] = sum h[i] * in[n + delay - i]
+static size_t filter_delay(size_t taps)
+{
+  return taps - 1 - taps / 2;
+}
+
+static std::vector<double> reference_direct(const std::vector<double>& h, const std::vector<sample32_t>& in, size_t channels)
+{
+  const size_t taps = h.size(), delay = filter_delay(taps);
+  std::vector<double> out(in.size());
+  for (size_t ch = 0; ch < channels; ch++)
+    for (size_t n = 0; n < FRAMES; n++) {
+      double sum = 0;
+      for (size_t i = 0; i < taps; i++)
+        if (n + delay >= i && n + delay - i < FRAMES)
+          sum += h[i] * in[(n + delay - i) * channels + ch];
+      out[n * channels + ch] = sum;
+    }
+  return out;
+}
+
+// lsx_set_dft_length
+static size_t dft_length(size_t taps)
+{
+  size_t result = 8;
+  for (size_t n = taps; n > 2; n >>= 1)
+    result <<= 1;
+  return std::min<size_t>(std::max<size_t>(result, 4096), 131072);
+}
+
+// Overlap-save with one FFT of dft_length per block, two channels per complex FFT:
+// as many operations per channel as libsox' real FFT, in double
+static std::vector<double> reference_fft(const std::vector<double>& h, const std::vector<sample32_t>& in, size_t channels)
+{
+  const size_t taps = h.size(), delay = filter_delay(taps);
+  const size_t n = dft_length(taps), step = n - taps + 1;
+  const FFT<double> fft(n);
+  std::vector<double> h_re(n), h_im(n);
+  for (size_t i = 0; i < taps; i++)
+    h_re[i] = h[i] / n;
+  fft.forward(h_re.data(), h_im.data());
+
+  std::vector<double> out(in.size());
+  std::vector<double> re(n), im(n);
+  for (size_t ch = 0; ch < channels; ch += 2) {
+    const bool pair = ch + 1 < channels;
+    for (size_t s = 0; s < FRAMES + delay; s += step) {
+      for (size_t j = 0; j < n; j++) {
+        const size_t x = s + j; // input frame + taps - 1
+        const bool inside = x >= taps - 1 && x - (taps - 1) < FRAMES;
+        re[j] = inside ? in[(x - (taps - 1)) * channels + ch] : 0;
+        im[j] = inside && pair ? in[(x - (taps - 1)) * channels + ch + 1] : 0;
+      }
+      fft.forward(re.data(), im.data());
+      for (size_t k = 0; k < n; k++) {
+        const double r = re[k] * h_re[k] - im[k] * h_im[k];
+        im[k] = re[k] * h_im[k] + im[k] * h_re[k];
+        re[k] = r;
+      }
+      fft.inverse_unscaled(re.data(), im.data());
+      for (size_t j = 0; j < step; j++) {
+        const size_t m = s + j; // output frame + delay
+        if (m < delay || m - delay >= FRAMES)
+          continue;
+        out[(m - delay) * channels + ch] = re[taps - 1 + j];
+        if (pair)
+          out[(m - delay) * channels + ch + 1] = im[taps - 1 + j];
+      }
+    }
+  }
+  return out;
+}
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+// libsox' fir with the taps on its command line: dft_filter, the engine of sinc and fir
+static std::vector<sample32_t> run_libsox_fir(const std::vector<double>& h, const std::vector<sample32_t>& in, size_t channels)
+{
+  std::vector<std::string> coefs(h.size());
+  std::vector<char*> args(h.size());
+  for (size_t i = 0; i < h.size(); i++) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.17g", h[i]);
+    coefs[i] = text;
+    args[i] = &coefs[i][0];
+  }
+  return run_libsox_effect("fir", (int)args.size(), args.data(), 48000, channels, 0, in);
+}
+#endif
+
+static double max_error_of(const std::vector<sample32_t>& out, const std::vector<double>& ref)
+{
+  double max_error = out.size() == ref.size() ? 0 : 2147483648.0;
+  for (size_t i = 0; i < out.size() && i < ref.size(); i++)
+    max_error = std::max(max_error, fabs(out[i] - ref[i]));
+  return max_error / 2147483648.0;
+}
+
+static void run_convolver(PartitionedConvolver& conv, ThreadPool* pool, const std::vector<sample32_t>& in, std::vector<sample32_t>& out, size_t channels)
+{
+  uint64_t clips = 0;
+  const size_t block_frames = BLOCK_SAMPLES / channels;
+  size_t done = 0;
+  conv.reset();
+  for (size_t f = 0; f < FRAMES; f += block_frames) {
+    conv.write(&in[f * channels], std::min(block_frames, FRAMES - f), pool);
+    done += conv.read(&out[done * channels], FRAMES - done, clips);
+  }
+  conv.flush(pool);
+  done += conv.read(&out[done * channels], FRAMES - done, clips);
+}
+
+int main(int argc, char** argv)
+{
+  const std::string isas = parse_isa_option(argc, argv, "c,avx2");
+
+  static const struct { const char* name; conv_isa_t isa; } all[] = {
+    { "c", CONV_C }, { "avx2", CONV_AVX2 }
+  };
+  static const size_t channel_counts[] = { 2, 6 };
+  static const size_t tap_counts[] = { 255, 1023, 2047, 4095, 16383, 32767 };
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+  sox_init();
+#endif
+
+  int errors = 0;
+  for (size_t channels : channel_counts) {
+    // noise at -6 dB
+    std::vector<sample32_t> in(FRAMES * channels);
+    for (auto& v : in)
+      v = (sample32_t)noise() / 2;
+    ThreadPool pool((channels + 1) / 2);
+
+    for (size_t taps : tap_counts) {
+      const std::vector<double> h = design(taps);
+      const std::vector<double> ref = taps < 1000 ? reference_direct(h, in, channels) : reference_fft(h, in, channels);
+      const std::shared_ptr<const conv_filter_t> filter = make_conv_filter(h.data(), taps);
+
+      for (const auto& entry : all) {
+        if (!isa_selected(isas, entry.name))
+          continue;
+        const conv_kernels_t* kernels = get_conv_kernels_isa(entry.isa);
+        if (!kernels)
+          continue;
+
+        PartitionedConvolver conv(filter, channels, filter_delay(taps), kernels);
+        std::vector<sample32_t> out(in.size());
+        run_convolver(conv, nullptr, in, out, channels);
+        const double max_error = max_error_of(out, ref);
+        if (max_error > MAX_ERROR) {
+          printf("%s: %d channels %d taps: MISMATCH (max error %.3g of full scale)\n", kernels->name, (int)channels, (int)taps, max_error);
+          errors++;
+          continue;
+        }
+
+        const double single = measure([&]() { run_convolver(conv, nullptr, in, out, channels); }, REPEAT, (double)FRAMES);
+        const double threaded = measure([&]() { run_convolver(conv, &pool, in, out, channels); }, REPEAT, (double)FRAMES);
+        printf("%s %d %d 1 %.1f\n", kernels->name, (int)channels, (int)taps, single);
+        printf("%s %d %d %d %.1f\n", kernels->name, (int)channels, (int)taps, (int)pool.thread_count(), threaded);
+      }
+
+      const double single_fft = measure([&]() { reference_fft(h, in, channels); }, REPEAT, (double)FRAMES);
+      printf("single-fft %d %d 1 %.1f\n", (int)channels, (int)taps, single_fft);
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+      const double max_error = max_error_of(run_libsox_fir(h, in, channels), ref);
+      if (max_error > MAX_ERROR) {
+        printf("libsox: %d channels %d taps: MISMATCH (max error %.3g of full scale)\n", (int)channels, (int)taps, max_error);
+        errors++;
+        continue;
+      }
+      const double libsox = measure([&]() { run_libsox_fir(h, in, channels); }, REPEAT, (double)FRAMES);
+      printf("libsox %d %d 1 %.1f\n", (int)channels, (int)taps, libsox);
+#endif
+    }
+  }
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+  sox_quit();
+#endif
+  return errors ? 1 : 0;
+}
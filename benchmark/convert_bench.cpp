@@ -0,0 +1,87 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Micro-benchmark of the sample format conversion kernels (convert.h)
+ *
+ * Every kernel of every compiled-in instruction set is checked against the
+ * C version, then timed on one second of 7.1 audio at 48 kHz.
+ * Instruction sets the CPU does not support must be skipped: --isa c,sse2,avx2,avx512
+ * Output is one line per kernel: isa kernel Msamples/s
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "convert.h"
+#include "bench_util.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static const size_t SAMPLES = 48000 * 8;
+static const int REPEAT = 200;
+
+int main(int argc, char** argv)
+{
+  const std::string isas = parse_isa_option(argc, argv, "c,sse2,avx2,avx512");
+
+  // input: noise, the float one with some samples over full scale
+  std::vector<int16_t> in16(SAMPLES);
+  std::vector<uint8_t> in24(SAMPLES * 3);
+  std::vector<float> in_float(SAMPLES);
+  std::vector<sample32_t> in32(SAMPLES);
+  for (size_t i = 0; i < SAMPLES; i++) {
+    in16[i] = (int16_t)noise();
+    const uint32_t v = noise();
+    in24[i * 3] = (uint8_t)v;
+    in24[i * 3 + 1] = (uint8_t)(v >> 8);
+    in24[i * 3 + 2] = (uint8_t)(v >> 16);
+    in_float[i] = ((int32_t)noise() / 2147483648.0f) * 1.1f;
+    in32[i] = (sample32_t)noise();
+  }
+
+  const sample_converters_t* ref = get_sample_converters_isa(CONVERT_C);
+  std::vector<sample32_t> out32(SAMPLES), ref32(SAMPLES);
+  std::vector<float> out_float(SAMPLES), ref_float(SAMPLES);
+
+  static const struct { const char* name; converter_isa_t isa; } all[] = {
+    { "c", CONVERT_C }, { "sse2", CONVERT_SSE2 }, { "avx2", CONVERT_AVX2 }, { "avx512", CONVERT_AVX512 }
+  };
+  int errors = 0;
+  for (const auto& entry : all) {
+    if (!isa_selected(isas, entry.name))
+      continue;
+    const sample_converters_t* conv = get_sample_converters_isa(entry.isa);
+    if (!conv)
+      continue;
+
+    // odd counts exercise the scalar tails as well
+    const size_t check = SAMPLES - 7;
+    ref->int16_to_sample(in16.data(), ref32.data(), check);
+    conv->int16_to_sample(in16.data(), out32.data(), check);
+    errors += memcmp(ref32.data(), out32.data(), check * sizeof(sample32_t)) != 0;
+    ref->int24_to_sample(in24.data(), ref32.data(), check);
+    conv->int24_to_sample(in24.data(), out32.data(), check);
+    errors += memcmp(ref32.data(), out32.data(), check * sizeof(sample32_t)) != 0;
+    const uint64_t ref_clips = ref->float_to_sample(in_float.data(), ref32.data(), check);
+    const uint64_t clips = conv->float_to_sample(in_float.data(), out32.data(), check);
+    errors += memcmp(ref32.data(), out32.data(), check * sizeof(sample32_t)) != 0 || clips != ref_clips;
+    ref->sample_to_float(in32.data(), ref_float.data(), check);
+    conv->sample_to_float(in32.data(), out_float.data(), check);
+    errors += memcmp(ref_float.data(), out_float.data(), check * sizeof(float)) != 0;
+    if (errors) {
+      fprintf(stderr, "%s: output differs from the C version\n", conv->name);
+      return 1;
+    }
+
+    printf("%s int16_to_sample %.1f\n", entry.name, measure([&] { conv->int16_to_sample(in16.data(), out32.data(), SAMPLES); }, REPEAT, (double)SAMPLES));
+    printf("%s int24_to_sample %.1f\n", entry.name, measure([&] { conv->int24_to_sample(in24.data(), out32.data(), SAMPLES); }, REPEAT, (double)SAMPLES));
+    printf("%s float_to_sample %.1f\n", entry.name, measure([&] { conv->float_to_sample(in_float.data(), out32.data(), SAMPLES); }, REPEAT, (double)SAMPLES));
+    printf("%s sample_to_float %.1f\n", entry.name, measure([&] { conv->sample_to_float(in32.data(), out_float.data(), SAMPLES); }, REPEAT, (double)SAMPLES));
+  }
+  return 0;
+}
@@ -0,0 +1,446 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Output regression check of the effects in a mock Avisynth host (mock_host.h)
+ *
+ * Every effect of SoxFilter_usages.txt that can run in SoxFilter, and the chains of its own
+ * kernels and parameters, runs on a deterministic source (a sine sweep) in five request
+ * patterns: quarter seconds, the 80 bytes ffmpeg asks for, sizes of 1 to 10007 frames,
+ * half of the clip followed by all of it from 0 again (a restart), and a first request
+ * starting before the clip (negative start, silent up to 0). Checked:
+ * - the patterns give the same output,
+ * - the output is the one of plain libsox: the same effects run in the same process with
+ *   SoxFilter's engines off (biquad=false, fftconv=0, no rate -P) and no other parameter,
+ *   bit-exact or within the plain tolerance of the case,
+ * - a case with a reference (e.g. pipeline against none) gives the output of the reference,
+ * - the engines SoxFilter runs the effects on (see SoxFilter_Stats) are the expected ones,
+ * - the output is the stored golden one: --record DIR stores the outputs (DIR/<case>.raw,
+ *   or DIR/<case>.err with the error message), --compare DIR compares to them. The goldens
+ *   follow libsox: record them with the libsox release SoxFilter is built with.
+ * Same means bit-exact, or within a tolerance of full scale for SoxFilter's float kernels
+ * (fftconv, rate -P, float output). An effect failing the same way as when recorded is not
+ * a failure, the golden output records which effects are supported.
+ * Left out: input, output (SoxFilter's), noiseprof, noisered, firfit (files), mcompand
+ * (its arguments have spaces, SoxFilter cannot pass them), dither (random), stat and stats
+ * (analysis only).
+ *
+ *   --cases name,name  --seconds 1  --cpu c|sse2|avx2|avx512  --list
+ * Output is one line per case and check (golden, plain, engine, reference, pattern):
+ * case check result max_error, result is ok, MISMATCH, error (same as recorded, or nothing
+ * recorded), new (recorded now), missing (--compare without a golden of the case, a mismatch).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "mock_host.h"
+#include "bench_util.h"
+#include "stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+typedef struct golden_case_t {
+  const char* name;
+  const char* effects; // ';' separated
+  const char* params; // ',' separated SoxFilter parameters
+  const char* reference; // a case before this one, with the same output
+  double tolerance; // of full scale, 0: bit-exact
+  int sample_type; // source, 0: 16 bit
+  int rate; // 0: 48000
+  int channels; // 0: 2
+  const char* engine; // expected in the "engine:" lines of the stats report, e.g. the fused effects
+  double plain_tolerance; // of full scale against plain libsox, 0: bit-exact, NOT_COMPARED
+} golden_case_t;
+
+static const double FLOAT_TOLERANCE = 1e-6;
+// segments of recursive filters: their state differs by rounding only, see SoxFilter's segment
+static const double SEGMENT_TOLERANCE = 16.0 / 2147483648.0;
+// rate -P against libsox' rate: another filter design, the same passband and rejection;
+// its passband ripple and libsox' roll-off (its bandwidth is the -3 dB point) differ below -60 dB
+static const double RATE_TOLERANCE = 1e-3;
+// the output is not the one of plain libsox, e.g. the sweep reaches the transition band of a resampler
+static const double NOT_COMPARED = -1;
+
+static const golden_case_t golden_cases[] = {
+  // libsox' effects, in the order of SoxFilter_usages.txt
+  { "allpass", "allpass 1000 0.5q", "", nullptr, 0 },
+  { "band", "band 1000 200h", "", nullptr, 0 },
+  { "bandpass", "bandpass 1000 200h", "", nullptr, 0 },
+  { "bandreject", "bandreject 1000 200h", "", nullptr, 0 },
+  { "bass", "bass 6", "", nullptr, 0 },
+  { "bend", "bend 0.2,300,0.3", "", nullptr, 0 },
+  { "biquad", "biquad 0.2 0.4 0.2 1 -0.3 0.1", "", nullptr, 0 },
+  { "chorus", "chorus 0.7 0.9 55 0.4 0.25 2 -t", "", nullptr, 0 },
+  { "channels", "channels 1", "", nullptr, 0 },
+  { "compand", "compand 0.3,1 6:-70,-60,-20 -5 -90 0.2", "", nullptr, 0 },
+  { "contrast", "contrast 75", "", nullptr, 0 },
+  { "dcshift", "dcshift 0.1", "", nullptr, 0 },
+  { "deemph", "deemph", "", nullptr, 0, 0, 44100 },
+  { "delay", "delay 0.01 0.02", "", nullptr, 0 },
+  { "divide", "divide", "", nullptr, 0 },
+  { "downsample", "downsample 2", "", nullptr, 0 },
+  { "earwax", "earwax", "", nullptr, 0, 0, 44100 },
+  { "echo", "echo 0.8 0.9 100 0.3", "", nullptr, 0 },
+  { "echos", "echos 0.8 0.7 100 0.25 200 0.3", "", nullptr, 0 },
+  { "equalizer", "equalizer 1000 1q -6", "", nullptr, 0 },
+  { "fade", "fade h 0.2", "", nullptr, 0 },
+  { "fir", "fir 0.0195 -0.082 0.234 0.891 -0.145 0.043", "", nullptr, 0 },
+  { "flanger", "flanger", "", nullptr, 0 },
+  { "gain", "gain -3", "", nullptr, 0 },
+  { "highpass", "highpass 100", "", nullptr, 0 },
+  { "hilbert", "hilbert -n 255", "", nullptr, 0 },
+  { "loudness", "loudness -10", "", nullptr, 0 },
+  { "lowpass", "lowpass 5000", "", nullptr, 0 },
+  { "norm", "norm -3", "", nullptr, 0 },
+  { "oops", "oops", "", nullptr, 0 },
+  { "overdrive", "overdrive 20", "", nullptr, 0 },
+  { "pad", "pad 0.1 0.2", "", nullptr, 0 },
+  { "phaser", "phaser 0.8 0.74 3 0.4 0.5 -t", "", nullptr, 0 },
+  { "pitch", "pitch 200", "", nullptr, 0 },
+  { "rate", "rate 44100", "", nullptr, 0 },
+  { "rate_v", "rate -v 96000", "", nullptr, 0 },
+  { "remix", "remix 2 1", "", nullptr, 0 },
+  { "repeat", "repeat 1", "", nullptr, 0 },
+  { "reverb", "reverb 50", "", nullptr, 0 },
+  { "reverse", "reverse", "", nullptr, 0 },
+  { "riaa", "riaa", "", nullptr, 0 },
+  { "silence", "silence 1 0.01 1%", "", nullptr, 0 },
+  { "sinc", "sinc 100-5000", "", nullptr, 0 },
+  { "speed", "speed 1.1", "", nullptr, 0 },
+  { "splice", "splice 0.5", "", nullptr, 0 },
+  { "stretch", "stretch 1.2", "", nullptr, 0 },
+  { "swap", "swap", "", nullptr, 0 },
+  { "synth", "synth sine 440", "", nullptr, 0 },
+  { "tempo", "tempo 1.2", "", nullptr, 0 },
+  { "treble", "treble -6", "", nullptr, 0 },
+  { "tremolo", "tremolo 6 50", "", nullptr, 0 },
+  { "trim", "trim 0.1 0.5", "", nullptr, 0 },
+  { "upsample", "upsample 2", "", nullptr, 0 },
+  { "vad", "vad", "", nullptr, 0 },
+  { "vol", "vol 0.5", "", nullptr, 0 },
+  { "vol_db", "vol -3dB", "", nullptr, 0 },
+
+  // SoxFilter's kernels against libsox
+  { "biquads_libsox", "highpass 40;equalizer 1000 1q -3;lowpass 16000;vol 0.8", "biquad=false", nullptr, 0 },
+  { "biquads", "highpass 40;equalizer 1000 1q -3;lowpass 16000;vol 0.8", "biquad=true", "biquads_libsox", 0, 0, 0, 0,
+    "engine: highpass,equalizer,lowpass,vol -> biquads sections=4" },
+  { "biquads_6ch", "highpass 40;lowpass 12000", "biquad=true", nullptr, 0, 0, 0, 6, "engine: highpass,lowpass -> biquads sections=2" },
+  { "biquads_6ch_libsox", "highpass 40;lowpass 12000", "biquad=false", "biquads_6ch", 0, 0, 0, 6 },
+  { "biquads_clip_libsox", "highpass 40;vol 3;lowpass 12000;gain 4", "biquad=false", nullptr, 0 },
+  { "biquads_clip", "highpass 40;vol 3;lowpass 12000;gain 4", "biquad=true", "biquads_clip_libsox", 0, 0, 0, 0,
+    "engine: highpass,vol,lowpass,gain -> biquads sections=4" },
+  { "biquads_checkpoint", "highpass 40;equalizer 1000 1q -3;lowpass 16000;vol 0.8", "biquad=true,checkpoint=0.25", "biquads", 0 },
+  // every effect of the biquad family on the engine (off by default), against plain libsox
+  { "biquads_family", "allpass 1000 0.5q;band 1000 200h;bandpass 1000 200h;bandreject 3000 200h;bass 6;treble -6;equalizer 1000 1q -3;highpass 40;lowpass 16000;biquad 0.2 0.4 0.2 1 -0.3 0.1;riaa",
+    "biquad=true", nullptr, 0, 0, 0, 0, "engine: allpass,band,bandpass,bandreject,bass,treble,equalizer,highpass,lowpass,biquad,riaa -> biquads" },
+  { "biquads_deemph", "deemph", "biquad=true", nullptr, 0, 0, 44100, 0, "engine: deemph -> biquads" },
+  { "sinc_long", "sinc -n 4095 100-5000", "", nullptr, 0 },
+  { "sinc_fftconv", "sinc -n 4095 100-5000", "fftconv=1024", "sinc_long", FLOAT_TOLERANCE, 0, 0, 0, "engine: sinc -> fftconv taps=4095",
+    FLOAT_TOLERANCE },
+  // the sweep ends at 21.6 kHz, beyond the passbands of both resamplers
+  { "rate_P", "rate -P 44100", "", nullptr, FLOAT_TOLERANCE, 0, 0, 0, "engine: rate -> polyphase 147/160", NOT_COMPARED },
+  { "rate_P_up", "rate -P -v 96000", "", nullptr, FLOAT_TOLERANCE, 0, 0, 0, nullptr, RATE_TOLERANCE },
+
+  // input and output formats
+  { "vol_int8", "vol 0.5", "", nullptr, 0, SAMPLE_INT8 },
+  { "vol_int24", "vol 0.5", "", nullptr, 0, SAMPLE_INT24 },
+  { "vol_int32", "vol 0.5", "", nullptr, 0, SAMPLE_INT32 },
+  { "vol_float", "vol 0.5", "", nullptr, 0, SAMPLE_FLOAT },
+  { "vol_nativefloat", "vol 0.5", "nativefloat=true", nullptr, FLOAT_TOLERANCE, SAMPLE_FLOAT, 0, 0, nullptr, FLOAT_TOLERANCE },
+  { "vol_nativefloat_int16", "vol 0.5", "nativefloat=true", "vol", 0 },
+
+  // parameters that must not change the output
+  { "mix", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "", nullptr, 0 },
+  { "mix_spare", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "spare=true", "mix", 0 },
+  { "mix_prefetch", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "prefetch=0.5", "mix", 0 },
+  { "mix_lookahead", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "lookahead=0.5", "mix", 0 },
+  { "mix_pipeline", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "pipeline=2", "mix", 0 },
+  { "mix_threads", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "threads=2", "mix", 0 },
+  { "mix_stats", "highpass 40;compand 0.3,1 6:-70,-60,-20 -5 -90 0.2;reverb 30", "stats=1", "mix", 0 },
+  { "eq", "highpass 40;equalizer 1000 1q -3;lowpass 16000", "", nullptr, 0 },
+  { "eq_segment", "highpass 40;equalizer 1000 1q -3;lowpass 16000", "preroll=0.5,segment=0.25", "eq", SEGMENT_TOLERANCE, 0, 0, 0, nullptr,
+    SEGMENT_TOLERANCE },
+  { "sinc_preroll", "sinc -n 4095 100-5000", "preroll=0.5", "sinc_long", 0 },
+  { "sinc_segment", "sinc -n 4095 100-5000", "preroll=0.5,segment=0.25,segmentthreads=3", "sinc_long", 0 },
+};
+
+typedef struct golden_output_t {
+  bool failed;
+  std::string error;
+  int sample_type; // SAMPLE_INT32 or SAMPLE_FLOAT
+  std::vector<uint8_t> data;
+  std::string report; // SoxFilter_Stats
+} golden_output_t;
+
+static std::vector<std::string> split(const std::string& s, char separator)
+{
+  std::vector<std::string> parts;
+  if (s.empty())
+    return parts;
+  size_t begin = 0;
+  for (size_t end; (end = s.find(separator, begin)) != std::string::npos; begin = end + 1)
+    parts.push_back(s.substr(begin, end - begin));
+  parts.push_back(s.substr(begin));
+  return parts;
+}
+
+enum request_pattern_t {
+  PATTERN_QUARTER, // a quarter second each
+  PATTERN_80B, // 80 bytes each
+  PATTERN_ODD, // 1 to 10007 frames, pseudo-random
+  PATTERN_RESTART, // half of the clip in 4096 frames, then all of it from 0
+  PATTERN_NEGATIVE, // 4096 frames from 1000 frames before the start, silent up to 0, then the rest
+};
+
+static const char* const pattern_names[] = { "quarter", "80B", "odd", "restart", "negative" };
+
+// The case run by plain libsox: the same effects without rate's -P, SoxFilter's engines off
+static golden_case_t plain_case(const golden_case_t& c, std::string& effects)
+{
+  effects.clear();
+  for (const std::string& effect : split(c.effects, ';')) {
+    std::string plain;
+    for (const std::string& word : split(effect, ' '))
+      if (word != "-P")
+        plain += (plain.empty() ? "" : " ") + word;
+    effects += (effects.empty() ? "" : ";") + plain;
+  }
+  golden_case_t plain = c;
+  plain.effects = effects.c_str();
+  plain.params = "biquad=false,fftconv=0";
+  return plain;
+}
+
+static golden_output_t run_pattern(const golden_case_t& c, request_pattern_t pattern, double seconds, MockEnvironment& env)
+{
+  golden_output_t out;
+  out.failed = false;
+  try {
+    source_format_t format = { SIGNAL_SWEEP, c.sample_type ? c.sample_type : SAMPLE_INT16, c.rate ? c.rate : 48000, c.channels ? c.channels : 2, 0, 1 };
+    format.frames = (int64_t)(seconds * format.rate);
+    const PClip source = new MockAudioSource(format);
+    PClip filter = create_soxfilter(source, split(c.effects, ';'), split(c.params, ','), &env);
+    const VideoInfo& vi = filter->GetVideoInfo();
+    const int64_t length = vi.num_audio_samples;
+    const size_t frame_bytes = (size_t)vi.BytesPerAudioSample();
+    out.sample_type = vi.SampleType();
+    out.data.resize((size_t)length * frame_bytes);
+
+    int64_t start = 0;
+    if (pattern == PATTERN_NEGATIVE) {
+      const int64_t lead = 1000, count = std::min(length + lead, (int64_t)4096);
+      std::vector<uint8_t> first((size_t)count * frame_bytes);
+      filter->GetAudio(first.data(), -lead, count, &env);
+      if (std::any_of(first.begin(), first.begin() + (size_t)lead * frame_bytes, [](uint8_t b) { return b != 0; }))
+        env.ThrowError("golden_check: output before the clip start is not silent");
+      std::copy(first.begin() + (size_t)lead * frame_bytes, first.end(), out.data.begin());
+      start = count - lead;
+    }
+    if (pattern == PATTERN_RESTART) {
+      std::vector<uint8_t> discard(4096 * frame_bytes);
+      for (; start < length / 2; start += 4096)
+        filter->GetAudio(discard.data(), start, std::min((int64_t)4096, length - start), &env);
+      start = 0;
+    }
+    uint32_t seed = 1;
+    while (start < length) {
+      int64_t count;
+      switch (pattern) {
+      case PATTERN_QUARTER: count = vi.audio_samples_per_second / 4; break;
+      case PATTERN_80B: count = std::max((int64_t)1, (int64_t)(80 / frame_bytes)); break;
+      case PATTERN_ODD:
+        count = 1 + xorshift32(seed) % 10007;
+        break;
+      default: count = 4096; break;
+      }
+      count = std::min(count, length - start);
+      filter->GetAudio(&out.data[(size_t)start * frame_bytes], start, count, &env);
+      start += count;
+    }
+    out.report = FilterStats::report_all();
+  }
+  catch (const AvisynthError& e) {
+    out.failed = true;
+    out.error = e.msg;
+    out.data.clear();
+  }
+  return out;
+}
+
+// Sample i of an output in full scale
+static double sample_value(const golden_output_t& out, size_t i)
+{
+  if (out.sample_type == SAMPLE_FLOAT) {
+    float f;
+    memcpy(&f, &out.data[i * 4], 4);
+    return f;
+  }
+  int32_t v;
+  memcpy(&v, &out.data[i * 4], 4);
+  return v / 2147483648.0;
+}
+
+// The largest difference of two outputs in full scale, 1 if their lengths or errors differ.
+// Float and 32 bit integer outputs are compared by value (nativefloat against plain libsox).
+static double max_error(const golden_output_t& a, const golden_output_t& b)
+{
+  if (a.failed || b.failed)
+    return a.failed && b.failed ? 0 : 1;
+  if (a.data.size() != b.data.size())
+    return 1;
+  double error = 0;
+  const size_t n = a.data.size() / 4;
+  for (size_t i = 0; i < n; i++)
+    error = std::max(error, fabs(sample_value(a, i) - sample_value(b, i)));
+  return error;
+}
+
+static bool read_golden(const std::string& dir, const golden_case_t& c, golden_output_t& out)
+{
+  std::ifstream err(dir + "/" + c.name + ".err");
+  if (err) {
+    std::stringstream s;
+    s << err.rdbuf();
+    out.failed = true;
+    out.error = s.str();
+    return true;
+  }
+  std::ifstream raw(dir + "/" + c.name + ".raw", std::ios::binary);
+  if (!raw)
+    return false;
+  out.failed = false;
+  // the first four bytes are the sample type
+  int32_t sample_type = 0;
+  raw.read((char*)&sample_type, sizeof(sample_type));
+  out.sample_type = sample_type;
+  out.data.assign(std::istreambuf_iterator<char>(raw), std::istreambuf_iterator<char>());
+  return true;
+}
+
+static bool write_golden(const std::string& dir, const golden_case_t& c, const golden_output_t& out)
+{
+  remove((dir + "/" + c.name + ".err").c_str());
+  remove((dir + "/" + c.name + ".raw").c_str());
+  if (out.failed) {
+    std::ofstream err(dir + "/" + c.name + ".err");
+    err << out.error;
+    return (bool)err;
+  }
+  std::ofstream raw(dir + "/" + c.name + ".raw", std::ios::binary);
+  const int32_t sample_type = out.sample_type;
+  raw.write((const char*)&sample_type, sizeof(sample_type));
+  raw.write((const char*)out.data.data(), (std::streamsize)out.data.size());
+  return (bool)raw;
+}
+
+int main(int argc, char** argv)
+{
+  std::string record, compare, cases, cpu;
+  double seconds = 1;
+  bool list = false;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (arg == "--list") {
+      list = true;
+      continue;
+    }
+    if (!value || (arg != "--record" && arg != "--compare" && arg != "--cases" && arg != "--seconds" && arg != "--cpu")) {
+      fprintf(stderr, "golden_check: invalid option %s\n", arg.c_str());
+      return 2;
+    }
+    if (arg == "--record")
+      record = value;
+    else if (arg == "--compare")
+      compare = value;
+    else if (arg == "--cases")
+      cases = value;
+    else if (arg == "--seconds")
+      seconds = atof(value);
+    else
+      cpu = value;
+    i++;
+  }
+  if (list) {
+    for (const auto& c : golden_cases)
+      printf("%s \"%s\" %s\n", c.name, c.effects, c.params);
+    return 0;
+  }
+
+  MockEnvironment env(mock_cpu_flags(cpu));
+  std::map<std::string, golden_output_t> outputs; // of the first pattern, for the references
+  const std::vector<std::string> selected = split(cases, ',');
+  int failures = 0, errors = 0, count = 0;
+  printf("# case pattern result max_error\n");
+  for (const auto& c : golden_cases) {
+    if (!selected.empty() && std::find(selected.begin(), selected.end(), c.name) == selected.end())
+      continue;
+    count++;
+    const golden_output_t out = run_pattern(c, PATTERN_QUARTER, seconds, env);
+    outputs[c.name] = out;
+
+    golden_output_t golden;
+    const char* result = "ok";
+    double error = 0;
+    if (!record.empty()) {
+      if (!write_golden(record, c, out)) {
+        fprintf(stderr, "golden_check: cannot write to %s\n", record.c_str());
+        return 2;
+      }
+      result = out.failed ? "error" : "new";
+    }
+    else if (!compare.empty() && read_golden(compare, c, golden)) {
+      error = max_error(out, golden);
+      result = error > c.tolerance ? "MISMATCH" : out.failed ? "error" : "ok";
+    }
+    else if (!compare.empty())
+      result = "missing"; // a case added since the goldens were recorded
+    else if (out.failed)
+      result = "error";
+    printf("%s golden %s %.3g%s%s\n", c.name, result, error, out.failed ? " " : "", out.failed ? out.error.c_str() : "");
+    if (!strcmp(result, "MISMATCH") || !strcmp(result, "missing"))
+      failures++;
+    if (out.failed) {
+      errors++;
+      continue;
+    }
+
+    if (c.plain_tolerance != NOT_COMPARED) {
+      std::string effects;
+      error = max_error(out, run_pattern(plain_case(c, effects), PATTERN_QUARTER, seconds, env));
+      printf("%s plain %s %.3g\n", c.name, error > c.plain_tolerance ? "MISMATCH" : "ok", error);
+      failures += error > c.plain_tolerance;
+    }
+    if (c.engine) {
+      const bool found = out.report.find(c.engine) != std::string::npos;
+      printf("%s engine %s 0\n", c.name, found ? "ok" : "MISMATCH");
+      failures += !found;
+    }
+    if (c.reference) {
+      const auto ref = outputs.find(c.reference);
+      if (ref != outputs.end()) {
+        error = max_error(out, ref->second);
+        printf("%s %s %s %.3g\n", c.name, c.reference, error > c.tolerance ? "MISMATCH" : "ok", error);
+        failures += error > c.tolerance;
+      }
+    }
+    for (int p = PATTERN_80B; p <= PATTERN_NEGATIVE; p++) {
+      error = max_error(run_pattern(c, (request_pattern_t)p, seconds, env), out);
+      printf("%s %s %s %.3g\n", c.name, pattern_names[p], error > c.tolerance ? "MISMATCH" : "ok", error);
+      failures += error > c.tolerance;
+    }
+    fflush(stdout);
+  }
+  printf("# %d cases, %d not supported, %d mismatches\n", count, errors, failures);
+  return failures ? 1 : 0;
+}
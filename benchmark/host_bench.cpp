@@ -0,0 +1,346 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Speed of the whole filter in a mock Avisynth host (mock_host.h), per effect chain and request size
+ *
+ * Each case creates SoxFilter through Create_SoxFilter on a synthetic source, like a script
+ * would, then requests the whole clip sequentially in requests of the given size, down to
+ * the 80 bytes ffmpeg asks for (see output_flow). The requests go through EnsureVBRMp3Sync
+ * when SoxFilter invokes it, there is no audio cache.
+ * Measured: filter creation, throughput of the sequential pass (million output frames per
+ * second and times real time), latency of the requests (median, 99th percentile, maximum),
+ * the request at 0 after the pass (restart), then the one in the middle of the clip (seek).
+ *
+ *   --chain name:effect[;effect...]   instead of the built-in chains, repeatable,
+ *                                     e.g. --chain eq:"highpass 40;lowpass 12000"
+ *   --param name=value                SoxFilter parameter for all chains, repeatable, e.g. --param preroll=0.5
+ *   --sizes 80B,4096,1s               request sizes: frames, bytes of output (B) or seconds (s)
+ *   --source noise|sweep|sine  --type int8|int16|int24|int32|float  --channels 2  --rate 48000  --seconds 10
+ *   --cpu c|sse2|avx2|avx512          instruction sets up to this one only
+ *   --stats                           the counters of each instance (SoxFilter_Stats) as # lines
+ * Output is a # header, then one line per case:
+ * chain request_frames create_ms Mframes/s realtime latency_p50_us latency_p99_us latency_max_us restart_ms seek_ms
+ *
+ *   --replay trace.txt                runs the requests of a script recorded by SoxFilter(..., trace="trace.txt")
+ *                                     instead, on a source of the same format: with the effects and parameters
+ *                                     of the script, or the --chain ones; --param ones are added
+ * Output is one line per chain:
+ * trace chain sync requests requested_frames source_frames total_ms latency_p50_us latency_p99_us latency_max_us restarts restores replayed skipped wasted_ms
+ * sync is 1 when the requests go through EnsureVBRMp3Sync, source_frames is the input read by the filter, replayed and skipped are the output frames rendered
+ * in vain (see SoxFilter_Stats), total_ms is the time of all requests.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "mock_host.h"
+#include "stats.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+typedef struct bench_chain_t {
+  std::string name;
+  std::vector<std::string> effects;
+} bench_chain_t;
+
+static const bench_chain_t default_chains[] = {
+  { "vol", { "vol 0.5" } },
+  { "eq", { "highpass 40", "equalizer 1000 1q -3", "lowpass 16000" } },
+  { "sinc", { "sinc 20-16000" } },
+  { "rate", { "rate 44100" } },
+  { "rate_P", { "rate -P 44100" } },
+  { "compand", { "compand 0.3,1 6:-70,-60,-20 -5 -90 0.2" } },
+  { "reverb", { "reverb 50" } },
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double ms_since(bench_clock::time_point t0)
+{
+  return std::chrono::duration<double, std::milli>(bench_clock::now() - t0).count();
+}
+
+static std::vector<std::string> split(const std::string& s, char separator)
+{
+  std::vector<std::string> parts;
+  size_t begin = 0;
+  for (size_t end; (end = s.find(separator, begin)) != std::string::npos; begin = end + 1)
+    parts.push_back(s.substr(begin, end - begin));
+  parts.push_back(s.substr(begin));
+  return parts;
+}
+
+// "4096" frames, "80B" bytes of output, "0.5s" seconds of output
+static int64_t request_frames(const std::string& size, const VideoInfo& vi)
+{
+  const double value = atof(size.c_str());
+  int64_t frames = (int64_t)value;
+  if (!size.empty() && size.back() == 'B')
+    frames = (int64_t)value / vi.BytesPerAudioSample();
+  else if (!size.empty() && size.back() == 's')
+    frames = (int64_t)(value * vi.audio_samples_per_second);
+  return std::max(frames, (int64_t)1);
+}
+
+static double percentile(std::vector<double>& v, double p)
+{
+  if (v.empty())
+    return 0;
+  const size_t i = std::min(v.size() - 1, (size_t)(p * (double)v.size()));
+  std::nth_element(v.begin(), v.begin() + i, v.end());
+  return v[i];
+}
+
+static void run_case(const bench_chain_t& chain, const std::string& size, const source_format_t& format,
+  const std::vector<std::string>& params, bool stats, MockEnvironment& env)
+{
+  const PClip source = new MockAudioSource(format);
+  const auto t0 = bench_clock::now();
+  PClip filter = create_soxfilter(source, chain.effects, params, &env);
+  const double create_ms = ms_since(t0);
+
+  const VideoInfo& vi = filter->GetVideoInfo();
+  const int64_t count = request_frames(size, vi), length = vi.num_audio_samples;
+  std::vector<uint8_t> buf((size_t)count * vi.BytesPerAudioSample());
+  std::vector<double> latencies;
+  latencies.reserve((size_t)(length / count + 1));
+
+  const auto t1 = bench_clock::now();
+  for (int64_t start = 0; start < length; start += count) {
+    const auto r0 = bench_clock::now();
+    filter->GetAudio(buf.data(), start, std::min(count, length - start), &env);
+    latencies.push_back(ms_since(r0) * 1000);
+  }
+  const double seconds = ms_since(t1) / 1000;
+
+  auto r0 = bench_clock::now();
+  filter->GetAudio(buf.data(), 0, std::min(count, length), &env);
+  const double restart_ms = ms_since(r0);
+  r0 = bench_clock::now();
+  filter->GetAudio(buf.data(), length / 2, std::min(count, length - length / 2), &env);
+  const double seek_ms = ms_since(r0);
+
+  const double realtime = (double)length / vi.audio_samples_per_second / seconds;
+  const double max_latency = *std::max_element(latencies.begin(), latencies.end());
+  const double p50 = percentile(latencies, 0.5), p99 = percentile(latencies, 0.99);
+  printf("%s %lld %.3f %.3f %.1f %.1f %.1f %.1f %.3f %.3f\n", chain.name.c_str(), (long long)count, create_ms,
+    (double)length / seconds / 1e6, realtime, p50, p99, max_latency, restart_ms, seek_ms);
+  if (stats) {
+    const std::string report = FilterStats::report_all();
+    for (const auto& line : split(report, '\n'))
+      if (!line.empty())
+        printf("# %s %s\n", chain.name.c_str(), line.c_str());
+  }
+  fflush(stdout);
+}
+
+// ------------------------ replay ------------------------------
+
+typedef struct request_trace_t {
+  source_format_t format; // but the signal
+  std::vector<std::string> effects;
+  std::vector<std::string> params;
+  std::vector<std::pair<int64_t, int64_t>> requests; // start, count
+} request_trace_t;
+
+// The format written by open_request_trace of soxfilter.cpp
+static bool read_trace(const char* path, request_trace_t& trace)
+{
+  std::ifstream file(path);
+  if (!file)
+    return false;
+  bool has_source = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    if (line.compare(0, 7, "source ") == 0) {
+      long long frames;
+      has_source = sscanf(line.c_str() + 7, "%d %d %d %lld", &trace.format.rate, &trace.format.channels, &trace.format.sample_type, &frames) == 4;
+      trace.format.frames = frames;
+    }
+    else if (line.compare(0, 7, "effect ") == 0)
+      trace.effects.push_back(line.substr(7));
+    else if (line.compare(0, 6, "param ") == 0)
+      trace.params.push_back(line.substr(6));
+    else {
+      long long start, count;
+      if (sscanf(line.c_str(), "%lld %lld", &start, &count) != 2)
+        return false;
+      trace.requests.emplace_back(start, count);
+    }
+  }
+  return has_source;
+}
+
+// "key=value" of the line of the report (SoxFilter_Stats) containing 'marker', 0 if there is none
+static double report_value(const std::string& report, const char* marker, const char* key)
+{
+  const size_t at = report.find(marker);
+  if (at == std::string::npos)
+    return 0;
+  const size_t end = report.find('\n', at);
+  const size_t k = report.find(std::string(" ") + key + "=", at);
+  return k < end ? atof(report.c_str() + k + strlen(key) + 2) : 0;
+}
+
+static void replay_trace(const char* name, const request_trace_t& trace, const bench_chain_t& chain,
+  const std::vector<std::string>& params, bool stats, MockEnvironment& env)
+{
+  MockAudioSource* mock_source = new MockAudioSource(trace.format);
+  const PClip source = mock_source;
+  const int syncs = env.sync_invocations();
+  PClip filter = create_soxfilter(source, chain.effects, params, &env);
+  const bool sync = env.sync_invocations() > syncs;
+
+  const VideoInfo& vi = filter->GetVideoInfo();
+  int64_t max_count = 0, requested = 0;
+  for (const auto& request : trace.requests) {
+    max_count = std::max(max_count, request.second);
+    requested += request.second;
+  }
+  std::vector<uint8_t> buf((size_t)max_count * vi.BytesPerAudioSample());
+  std::vector<double> latencies;
+  latencies.reserve(trace.requests.size());
+
+  const auto t0 = bench_clock::now();
+  for (const auto& request : trace.requests) {
+    const auto r0 = bench_clock::now();
+    filter->GetAudio(buf.data(), request.first, request.second, &env);
+    latencies.push_back(ms_since(r0) * 1000);
+  }
+  const double total_ms = ms_since(t0);
+
+  // the only instance alive
+  const std::string report = FilterStats::report_all();
+  const double max_latency = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+  const double p50 = percentile(latencies, 0.5), p99 = percentile(latencies, 0.99);
+  printf("%s %s %d %zu %lld %.0f %.3f %.1f %.1f %.1f %.0f %.0f %.0f %.0f %.3f\n", name, chain.name.c_str(), sync ? 1 : 0, trace.requests.size(),
+    (long long)requested, (double)mock_source->read_frames(), total_ms, p50, p99, max_latency,
+    report_value(report, " requests=", "restarts"), report_value(report, " requests=", "restores"),
+    report_value(report, " requests=", "replayed"), report_value(report, " requests=", "skipped"),
+    report_value(report, " requests=", "wasted_ms"));
+  if (stats)
+    for (const auto& line : split(report, '\n'))
+      if (!line.empty())
+        printf("# %s %s\n", chain.name.c_str(), line.c_str());
+  fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<bench_chain_t> chains;
+  std::vector<std::string> params;
+  std::string sizes = "80B,4096,65536,1s", cpu, replay;
+  source_format_t format = { SIGNAL_NOISE, SAMPLE_INT16, 48000, 2, 0, 1 };
+  double seconds = 10;
+  bool stats = false;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool valid = value != nullptr;
+    if (arg == "--stats") {
+      stats = true;
+      continue;
+    }
+    if (!valid)
+      ;
+    else if (arg == "--chain") {
+      const std::string s = value;
+      const size_t colon = s.find(':');
+      valid = colon != std::string::npos;
+      if (valid)
+        chains.push_back({ s.substr(0, colon), split(s.substr(colon + 1), ';') });
+    }
+    else if (arg == "--param")
+      params.push_back(value);
+    else if (arg == "--sizes")
+      sizes = value;
+    else if (arg == "--source")
+      valid = parse_signal(value, format.signal);
+    else if (arg == "--type")
+      valid = parse_sample_type(value, format.sample_type);
+    else if (arg == "--channels")
+      valid = (format.channels = atoi(value)) > 0;
+    else if (arg == "--rate")
+      valid = (format.rate = atoi(value)) > 0;
+    else if (arg == "--seconds")
+      valid = (seconds = atof(value)) > 0;
+    else if (arg == "--cpu")
+      cpu = value;
+    else if (arg == "--replay")
+      replay = value;
+    else
+      valid = false;
+    if (!valid) {
+      fprintf(stderr, "host_bench: invalid option %s\n", arg.c_str());
+      return 2;
+    }
+    i++;
+  }
+  MockEnvironment env(mock_cpu_flags(cpu));
+
+  if (!replay.empty()) {
+    request_trace_t trace;
+    if (!read_trace(replay.c_str(), trace)) {
+      fprintf(stderr, "host_bench: cannot read trace %s\n", replay.c_str());
+      return 2;
+    }
+    trace.format.signal = format.signal;
+    trace.format.seed = format.seed;
+    if (chains.empty())
+      chains.push_back({ "trace", trace.effects });
+    // the parameters of the script, then the ones given here: the last one counts
+    std::vector<std::string> all_params = trace.params;
+    all_params.insert(all_params.end(), params.begin(), params.end());
+    printf("# trace %s %s %d channels %d Hz %lld samples, params", replay.c_str(), sample_type_name(trace.format.sample_type),
+      trace.format.channels, trace.format.rate, (long long)trace.format.frames);
+    for (const auto& param : all_params)
+      printf(" %s", param.c_str());
+    printf("\n# trace chain sync requests requested_frames source_frames total_ms latency_p50_us latency_p99_us latency_max_us restarts restores replayed skipped wasted_ms\n");
+    int errors = 0;
+    for (const auto& chain : chains) {
+      try {
+        replay_trace(replay.c_str(), trace, chain, all_params, stats, env);
+      }
+      catch (const AvisynthError& e) {
+        printf("# %s: error: %s\n", chain.name.c_str(), e.msg);
+        errors++;
+      }
+    }
+    return errors ? 1 : 0;
+  }
+
+  if (chains.empty())
+    chains.assign(std::begin(default_chains), std::end(default_chains));
+  format.frames = (int64_t)(seconds * format.rate);
+
+  printf("# source %s %s %d channels %d Hz %.1f s, params", format.signal == SIGNAL_NOISE ? "noise" : format.signal == SIGNAL_SWEEP ? "sweep" : "sine",
+    sample_type_name(format.sample_type), format.channels, format.rate, seconds);
+  for (const auto& param : params)
+    printf(" %s", param.c_str());
+  printf("\n# chain request_frames create_ms Mframes/s realtime latency_p50_us latency_p99_us latency_max_us restart_ms seek_ms\n");
+
+  int errors = 0;
+  for (const auto& chain : chains)
+    for (const auto& size : split(sizes, ',')) {
+      try {
+        run_case(chain, size, format, params, stats, env);
+      }
+      catch (const AvisynthError& e) {
+        printf("# %s %s: error: %s\n", chain.name.c_str(), size.c_str(), e.msg);
+        errors++;
+      }
+    }
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,603 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Mock Avisynth host for the benchmark programs: runs SoxFilter without Avisynth
+ * The parts of the Avisynth core SoxFilter uses, synthetic sources, the environment
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "mock_host.h"
+#include "bench_util.h"
+#include <avs/cpuid.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// soxfilter.cpp
+AVSValue __cdecl Create_SoxFilter(AVSValue args, void* user_data, IScriptEnvironment* env);
+
+// ------------------------ core ------------------------------
+// The way the Avisynth core implements them: reference counted clips,
+// arrays copied deeply, strings borrowed (they are saved in the environment).
+
+static long atomic_add(volatile long* value, long delta)
+{
+#ifdef _MSC_VER
+  return _InterlockedExchangeAdd(value, delta) + delta;
+#else
+  return __atomic_add_fetch(value, delta, __ATOMIC_ACQ_REL);
+#endif
+}
+
+void IClip::AddRef() { atomic_add(&refcnt, 1); }
+void IClip::Release() { if (atomic_add(&refcnt, -1) == 0) delete this; }
+
+void PClip::Init(IClip* x) { if (x) x->AddRef(); p = x; }
+void PClip::Set(IClip* x) { if (x) x->AddRef(); if (p) p->Release(); p = x; }
+IClip* PClip::GetPointerWithAddRef() const { if (p) p->AddRef(); return p; }
+PClip::PClip() { p = nullptr; }
+PClip::PClip(const PClip& x) { Init(x.p); }
+PClip::PClip(IClip* x) { Init(x); }
+void PClip::operator=(IClip* x) { Set(x); }
+void PClip::operator=(const PClip& x) { Set(x.p); }
+PClip::~PClip() { if (p) p->Release(); }
+
+// no frames: the sources have no video
+PVideoFrame::PVideoFrame() { p = nullptr; }
+PVideoFrame::PVideoFrame(const PVideoFrame& x) { p = x.p; }
+PVideoFrame::PVideoFrame(VideoFrame* x) { p = x; }
+void PVideoFrame::operator=(VideoFrame* x) { p = x; }
+void PVideoFrame::operator=(const PVideoFrame& x) { p = x.p; }
+PVideoFrame::~PVideoFrame() {}
+
+AVSValue::AVSValue() { type = 'v'; array_size = 0; clip = nullptr; }
+AVSValue::AVSValue(IClip* c) { type = 'c'; array_size = 0; clip = c; if (c) c->AddRef(); }
+AVSValue::AVSValue(const PClip& c) { type = 'c'; array_size = 0; clip = c.GetPointerWithAddRef(); }
+AVSValue::AVSValue(bool b) { type = 'b'; array_size = 0; clip = nullptr; boolean = b; }
+AVSValue::AVSValue(int i) { type = 'i'; array_size = 0; clip = nullptr; integer = i; }
+AVSValue::AVSValue(float f) { type = 'f'; array_size = 0; clip = nullptr; floating_pt = f; }
+AVSValue::AVSValue(double f) { type = 'f'; array_size = 0; clip = nullptr; floating_pt = float(f); }
+AVSValue::AVSValue(const char* s) { type = 's'; array_size = 0; clip = nullptr; string = s; }
+AVSValue::AVSValue(const AVSValue* a, int size)
+{
+  type = 'v';
+  array_size = 0;
+  clip = nullptr;
+  AVSValue v;
+  v.type = 'a';
+  v.array_size = (short)size;
+  v.array = a;
+  Assign(&v, true);
+  v.type = 'v'; // borrowed
+}
+AVSValue::AVSValue(const AVSValue& a, int size) : AVSValue(&a, size) {}
+AVSValue::AVSValue(const AVSValue& v) { type = 'v'; array_size = 0; clip = nullptr; Assign(&v, true); }
+
+AVSValue::~AVSValue()
+{
+  if (type == 'c' && clip)
+    clip->Release();
+  else if (type == 'a')
+    delete[] array;
+}
+
+AVSValue& AVSValue::operator=(const AVSValue& v)
+{
+  Assign(&v, false);
+  return *this;
+}
+
+void AVSValue::Assign(const AVSValue* src, bool init)
+{
+  if (src == this)
+    return;
+  // the copy first: src may be an element of this one's array
+  IClip* new_clip = src->type == 'c' ? src->clip : nullptr;
+  if (new_clip)
+    new_clip->AddRef();
+  AVSValue* new_array = nullptr;
+  if (src->type == 'a' && src->array_size > 0) {
+    new_array = new AVSValue[src->array_size];
+    for (int i = 0; i < src->array_size; i++)
+      new_array[i] = src->array[i];
+  }
+  if (!init) {
+    if (type == 'c' && clip)
+      clip->Release();
+    else if (type == 'a')
+      delete[] array;
+  }
+  type = src->type;
+  array_size = src->array_size;
+  if (type == 'c')
+    clip = new_clip;
+  else if (type == 'a')
+    array = new_array;
+  else
+    memcpy(&string, &src->string, sizeof(string)); // the whole union
+}
+
+bool AVSValue::Defined() const { return type != 'v'; }
+bool AVSValue::IsClip() const { return type == 'c'; }
+bool AVSValue::IsBool() const { return type == 'b'; }
+bool AVSValue::IsInt() const { return type == 'i'; }
+bool AVSValue::IsFloat() const { return type == 'f' || type == 'i'; }
+bool AVSValue::IsString() const { return type == 's'; }
+bool AVSValue::IsArray() const { return type == 'a'; }
+bool AVSValue::IsFunction() const { return type == 'n'; }
+
+PClip AVSValue::AsClip() const { return IsClip() ? clip : nullptr; }
+bool AVSValue::AsBool() const { return boolean; }
+int AVSValue::AsInt() const { return integer; }
+const char* AVSValue::AsString() const { return IsString() ? string : nullptr; }
+double AVSValue::AsFloat() const { return IsInt() ? integer : floating_pt; }
+float AVSValue::AsFloatf() const { return float(AsFloat()); }
+
+bool AVSValue::AsBool(bool def) const { return IsBool() ? boolean : def; }
+int AVSValue::AsInt(int def) const { return IsInt() ? integer : def; }
+double AVSValue::AsDblDef(double def) const { return IsInt() ? integer : type == 'f' ? floating_pt : def; }
+double AVSValue::AsFloat(float def) const { return IsInt() ? integer : type == 'f' ? floating_pt : def; }
+float AVSValue::AsFloatf(float def) const { return float(AsFloat(def)); }
+const char* AVSValue::AsString(const char* def) const { return IsString() ? string : def; }
+
+int AVSValue::ArraySize() const { return IsArray() ? array_size : 1; }
+
+const AVSValue& AVSValue::operator[](int index) const
+{
+  return IsArray() && index >= 0 && index < array_size ? array[index] : *this;
+}
+
+AvsValueType AVSValue::GetType() const { return (AvsValueType)type; }
+
+bool VideoInfo::HasAudio() const { return audio_samples_per_second != 0; }
+int VideoInfo::AudioChannels() const { return HasAudio() ? nchannels : 0; }
+int VideoInfo::SampleType() const { return sample_type; }
+int VideoInfo::SamplesPerSecond() const { return audio_samples_per_second; }
+
+int VideoInfo::BytesPerChannelSample() const
+{
+  switch (sample_type) {
+  case SAMPLE_INT8: return 1;
+  case SAMPLE_INT16: return 2;
+  case SAMPLE_INT24: return 3;
+  case SAMPLE_INT32: return 4;
+  case SAMPLE_FLOAT: return 4;
+  default: return 0;
+  }
+}
+
+int VideoInfo::BytesPerAudioSample() const { return nchannels * BytesPerChannelSample(); }
+int64_t VideoInfo::AudioSamplesFromBytes(int64_t bytes) const { return HasAudio() ? bytes / BytesPerAudioSample() : 0; }
+int64_t VideoInfo::BytesFromAudioSamples(int64_t samples) const { return samples * BytesPerAudioSample(); }
+
+bool VideoInfo::IsChannelMaskKnown() const { return (image_type & IT_HAS_CHANNELMASK) != 0; }
+
+void VideoInfo::SetChannelMask(bool isChannelMaskKnown, unsigned int dwChannelMask)
+{
+  if (!isChannelMaskKnown) {
+    image_type &= ~IT_HAS_CHANNELMASK;
+    return;
+  }
+  image_type = (image_type & ~IT_SPEAKER_BITS_MASK) | IT_HAS_CHANNELMASK;
+  if (dwChannelMask == MASK_SPEAKER_ALL)
+    image_type |= IT_SPEAKER_ALL;
+  else
+    image_type |= (dwChannelMask & MASK_SPEAKER_DEFINED) << 4;
+}
+
+unsigned int VideoInfo::GetChannelMask() const
+{
+  if (!IsChannelMaskKnown())
+    return 0;
+  if (image_type & IT_SPEAKER_ALL)
+    return MASK_SPEAKER_ALL;
+  return (image_type & (MASK_SPEAKER_DEFINED << 4)) >> 4;
+}
+
+// ------------------------ sources ------------------------------
+
+bool parse_signal(const char* name, source_signal_t& signal)
+{
+  if (!strcmp(name, "noise"))
+    signal = SIGNAL_NOISE;
+  else if (!strcmp(name, "sweep"))
+    signal = SIGNAL_SWEEP;
+  else if (!strcmp(name, "sine"))
+    signal = SIGNAL_SINE;
+  else
+    return false;
+  return true;
+}
+
+static const struct { const char* name; int sample_type; } sample_types[] = {
+  { "int8", SAMPLE_INT8 }, { "int16", SAMPLE_INT16 }, { "int24", SAMPLE_INT24 },
+  { "int32", SAMPLE_INT32 }, { "float", SAMPLE_FLOAT }
+};
+
+bool parse_sample_type(const char* name, int& sample_type)
+{
+  for (const auto& t : sample_types)
+    if (!strcmp(name, t.name)) {
+      sample_type = t.sample_type;
+      return true;
+    }
+  return false;
+}
+
+const char* sample_type_name(int sample_type)
+{
+  for (const auto& t : sample_types)
+    if (t.sample_type == sample_type)
+      return t.name;
+  return "?";
+}
+
+static const double PI = 3.14159265358979323846;
+
+// x in [-1, 1) of full scale
+static void store_sample(uint8_t* dst, int sample_type, double x)
+{
+  switch (sample_type) {
+  case SAMPLE_INT8:
+    *dst = (uint8_t)(std::min(std::max(lrint(x * 128.0), -128L), 127L) + 128);
+    break;
+  case SAMPLE_INT16: {
+    const int16_t v = (int16_t)std::min(std::max(lrint(x * 32768.0), -32768L), 32767L);
+    memcpy(dst, &v, sizeof(v));
+    break;
+  }
+  case SAMPLE_INT24: {
+    const int32_t v = (int32_t)std::min(std::max(lrint(x * 8388608.0), -8388608L), 8388607L);
+    dst[0] = (uint8_t)v;
+    dst[1] = (uint8_t)(v >> 8);
+    dst[2] = (uint8_t)(v >> 16);
+    break;
+  }
+  case SAMPLE_INT32: {
+    const int32_t v = (int32_t)std::min(std::max(llrint(x * 2147483648.0), -2147483648LL), 2147483647LL);
+    memcpy(dst, &v, sizeof(v));
+    break;
+  }
+  case SAMPLE_FLOAT: {
+    const float v = (float)x;
+    memcpy(dst, &v, sizeof(v));
+    break;
+  }
+  }
+}
+
+MockAudioSource::MockAudioSource(const source_format_t& format) : frames_read(0)
+{
+  memset(&vi, 0, sizeof(vi));
+  vi.audio_samples_per_second = format.rate;
+  vi.sample_type = format.sample_type;
+  vi.num_audio_samples = format.frames;
+  vi.nchannels = format.channels;
+
+  const size_t bytes = (size_t)vi.BytesPerChannelSample();
+  const size_t channels = (size_t)format.channels;
+  samples.resize((size_t)format.frames * channels * bytes);
+
+  const double f0 = 20, f1 = 0.45 * format.rate;
+  const double duration = (double)format.frames / format.rate;
+  const double k = log(f1 / f0);
+  for (size_t c = 0; c < channels; c++) {
+    uint32_t seed = format.seed * 0x9E3779B9u + (uint32_t)c * 0x85EBCA6Bu + 1;
+    const double level = 0.5 * pow(10.0, -(double)c / 20), shift = PI * c / 7;
+    uint8_t* dst = &samples[c * bytes];
+    for (int64_t i = 0; i < format.frames; i++, dst += channels * bytes) {
+      const double t = (double)i / format.rate;
+      double x;
+      switch (format.signal) {
+      case SIGNAL_NOISE:
+        // half of full scale
+        x = (double)(int32_t)xorshift32(seed) / 4294967296.0;
+        break;
+      case SIGNAL_SWEEP:
+        x = level * sin(2 * PI * f0 * duration / k * (exp(t / duration * k) - 1) + shift);
+        break;
+      default:
+        x = level * sin(2 * PI * 997 * t + shift);
+        break;
+      }
+      store_sample(dst, format.sample_type, x);
+    }
+  }
+}
+
+PVideoFrame __stdcall MockAudioSource::GetFrame(int n, IScriptEnvironment* env)
+{
+  return PVideoFrame();
+}
+
+void __stdcall MockAudioSource::GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env)
+{
+  frames_read += count;
+  const size_t frame_bytes = (size_t)vi.BytesPerAudioSample();
+  uint8_t* dst = (uint8_t*)buf;
+  const int64_t begin = std::max(start, (int64_t)0), end = std::min(start + count, vi.num_audio_samples);
+  if (begin >= end) {
+    memset(dst, 0, (size_t)count * frame_bytes);
+    return;
+  }
+  memset(dst, 0, (size_t)(begin - start) * frame_bytes);
+  memcpy(dst + (begin - start) * frame_bytes, &samples[(size_t)begin * frame_bytes], (size_t)(end - begin) * frame_bytes);
+  memset(dst + (end - start) * frame_bytes, 0, (size_t)(start + count - end) * frame_bytes);
+}
+
+// ConvertAudio to 32 bit integer, of 8 bit integer and float input
+class MockConvertAudio : public GenericVideoFilter {
+private:
+  std::vector<uint8_t> buffer;
+
+public:
+  explicit MockConvertAudio(PClip _child) : GenericVideoFilter(_child) { vi.sample_type = SAMPLE_INT32; }
+
+  void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) override
+  {
+    const VideoInfo& child_vi = child->GetVideoInfo();
+    const size_t n = (size_t)count * vi.AudioChannels();
+    buffer.resize((size_t)count * child_vi.BytesPerAudioSample());
+    child->GetAudio(buffer.data(), start, count, env);
+    int32_t* dst = (int32_t*)buf;
+    if (child_vi.SampleType() == SAMPLE_INT8) {
+      for (size_t i = 0; i < n; i++)
+        dst[i] = ((int32_t)buffer[i] - 128) * (1 << 24);
+    }
+    else {
+      const float* src = (const float*)buffer.data();
+      for (size_t i = 0; i < n; i++)
+        dst[i] = (int32_t)std::min(std::max(llrint(src[i] * 2147483648.0), -2147483648LL), 2147483647LL);
+    }
+  }
+};
+
+// EnsureVBRMp3Sync of Avisynth+: a request not starting where the previous one ended is
+// served by reading from the start (or from the previous end when it is ahead), in
+// blocks of the request size.
+class MockEnsureVBRMp3Sync : public GenericVideoFilter {
+private:
+  int64_t last_end;
+  std::vector<uint8_t> buffer;
+
+public:
+  explicit MockEnsureVBRMp3Sync(PClip _child) : GenericVideoFilter(_child), last_end(0) {}
+
+  void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) override
+  {
+    if (start != last_end) {
+      int64_t offset = start > last_end ? last_end : 0;
+      buffer.resize((size_t)count * vi.BytesPerAudioSample());
+      while (offset + count < start) {
+        child->GetAudio(buffer.data(), offset, count, env);
+        offset += count;
+      }
+      if (offset < start)
+        child->GetAudio(buffer.data(), offset, start - offset, env);
+    }
+    child->GetAudio(buf, start, count, env);
+    last_end = start + count;
+  }
+};
+
+// ------------------------ environment ------------------------------
+
+int mock_cpu_flags(const std::string& max_isa)
+{
+  int flags = 0;
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    flags |= CPUF_MMX | CPUF_SSE | CPUF_SSE2;
+  if (__builtin_cpu_supports("sse3"))
+    flags |= CPUF_SSE3;
+  if (__builtin_cpu_supports("ssse3"))
+    flags |= CPUF_SSSE3;
+  if (__builtin_cpu_supports("sse4.1"))
+    flags |= CPUF_SSE4_1;
+  if (__builtin_cpu_supports("sse4.2"))
+    flags |= CPUF_SSE4_2;
+  if (__builtin_cpu_supports("avx"))
+    flags |= CPUF_AVX;
+  if (__builtin_cpu_supports("avx2"))
+    flags |= CPUF_AVX2;
+  if (__builtin_cpu_supports("fma"))
+    flags |= CPUF_FMA3;
+  if (__builtin_cpu_supports("avx512f"))
+    flags |= CPUF_AVX512F;
+  if (__builtin_cpu_supports("avx512bw"))
+    flags |= CPUF_AVX512BW;
+  if (__builtin_cpu_supports("avx512dq"))
+    flags |= CPUF_AVX512DQ;
+  if (__builtin_cpu_supports("avx512vl"))
+    flags |= CPUF_AVX512VL;
+#elif defined(_M_X64)
+  flags |= CPUF_MMX | CPUF_SSE | CPUF_SSE2; // the x64 baseline, the rest is not detected here
+#endif
+  const int avx512 = CPUF_AVX512F | CPUF_AVX512BW | CPUF_AVX512DQ | CPUF_AVX512VL;
+  if (max_isa == "c")
+    flags = 0;
+  else if (max_isa == "sse2")
+    flags &= ~(CPUF_AVX | CPUF_AVX2 | CPUF_FMA3 | avx512);
+  else if (max_isa == "avx2")
+    flags &= ~avx512;
+  return flags;
+}
+
+static std::mutex strings_lock;
+
+[[noreturn]] static void unsupported(const char* name)
+{
+  fprintf(stderr, "mock host: IScriptEnvironment::%s is not supported\n", name);
+  abort();
+}
+
+char* __stdcall MockEnvironment::SaveString(const char* s, int length)
+{
+  std::lock_guard<std::mutex> lock(strings_lock);
+  strings.emplace_back(s, length < 0 ? strlen(s) : (size_t)length);
+  return &strings.back()[0];
+}
+
+char* MockEnvironment::Sprintf(const char* fmt, ...)
+{
+  va_list val;
+  va_start(val, fmt);
+  char* s = VSprintf(fmt, val);
+  va_end(val);
+  return s;
+}
+
+char* __stdcall MockEnvironment::VSprintf(const char* fmt, va_list val)
+{
+  va_list copy;
+  va_copy(copy, val);
+  const int length = vsnprintf(nullptr, 0, fmt, copy);
+  va_end(copy);
+  std::vector<char> s((size_t)std::max(length, 0) + 1);
+  vsnprintf(s.data(), s.size(), fmt, val);
+  return SaveString(s.data());
+}
+
+void MockEnvironment::ThrowError(const char* fmt, ...)
+{
+  va_list val;
+  va_start(val, fmt);
+  const char* msg = VSprintf(fmt, val);
+  va_end(val);
+  throw AvisynthError(msg);
+}
+
+bool __stdcall MockEnvironment::FunctionExists(const char* name)
+{
+  return !strcmp(name, "ConvertAudio") || !strcmp(name, "EnsureVBRMp3Sync");
+}
+
+AVSValue __stdcall MockEnvironment::Invoke(const char* name, const AVSValue args, const char* const* arg_names)
+{
+  if (!strcmp(name, "ConvertAudio")) {
+    const int sample_type = args[0].AsClip()->GetVideoInfo().SampleType();
+    if (args[1].AsInt() != SAMPLE_INT32 || (sample_type != SAMPLE_INT8 && sample_type != SAMPLE_FLOAT))
+      ThrowError("mock host: ConvertAudio converts 8 bit and float audio to 32 bit only");
+    return PClip(new MockConvertAudio(args[0].AsClip()));
+  }
+  if (!strcmp(name, "EnsureVBRMp3Sync")) {
+    invokes_sync++;
+    return PClip(new MockEnsureVBRMp3Sync(args[0].AsClip()));
+  }
+  throw NotFound();
+}
+
+bool __stdcall MockEnvironment::InvokeTry(AVSValue* result, const char* name, const AVSValue& args, const char* const* arg_names)
+{
+  try {
+    *result = Invoke(name, args, arg_names);
+    return true;
+  }
+  catch (const NotFound&) {
+    return false;
+  }
+}
+
+AVSValue __stdcall MockEnvironment::Invoke2(const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names)
+{
+  return Invoke(name, args, arg_names);
+}
+
+bool __stdcall MockEnvironment::Invoke2Try(AVSValue* result, const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names)
+{
+  return InvokeTry(result, name, args, arg_names);
+}
+
+void __stdcall MockEnvironment::CheckVersion(int version)
+{
+  if (version > AVISYNTH_INTERFACE_VERSION)
+    ThrowError("Plugin was designed for a later version of Avisynth (%d)", version);
+}
+
+size_t __stdcall MockEnvironment::GetEnvProperty(AvsEnvProperty prop)
+{
+  switch (prop) {
+  case AEP_INTERFACE_VERSION: return AVISYNTH_INTERFACE_VERSION;
+  case AEP_THREADPOOL_THREADS:
+  case AEP_FILTERCHAIN_THREADS: return 1;
+  default: return 0;
+  }
+}
+
+// video and frame properties: no video here
+PVideoFrame __stdcall MockEnvironment::NewVideoFrame(const VideoInfo&, int) { unsupported("NewVideoFrame"); }
+bool __stdcall MockEnvironment::MakeWritable(PVideoFrame*) { unsupported("MakeWritable"); }
+void __stdcall MockEnvironment::BitBlt(BYTE*, int, const BYTE*, int, int, int) { unsupported("BitBlt"); }
+PVideoFrame __stdcall MockEnvironment::Subframe(PVideoFrame, int, int, int, int) { unsupported("Subframe"); }
+PVideoFrame __stdcall MockEnvironment::SubframePlanar(PVideoFrame, int, int, int, int, int, int, int) { unsupported("SubframePlanar"); }
+PVideoFrame __stdcall MockEnvironment::SubframePlanarA(PVideoFrame, int, int, int, int, int, int, int, int) { unsupported("SubframePlanarA"); }
+PVideoFrame __stdcall MockEnvironment::NewVideoFrameP(const VideoInfo&, const PVideoFrame*, int) { unsupported("NewVideoFrameP"); }
+int64_t __stdcall MockEnvironment::propGetInt(const AVSMap*, const char*, int, int*) { unsupported("propGetInt"); }
+double __stdcall MockEnvironment::propGetFloat(const AVSMap*, const char*, int, int*) { unsupported("propGetFloat"); }
+const char* __stdcall MockEnvironment::propGetData(const AVSMap*, const char*, int, int*) { unsupported("propGetData"); }
+int __stdcall MockEnvironment::propGetDataSize(const AVSMap*, const char*, int, int*) { unsupported("propGetDataSize"); }
+PClip __stdcall MockEnvironment::propGetClip(const AVSMap*, const char*, int, int*) { unsupported("propGetClip"); }
+const PVideoFrame __stdcall MockEnvironment::propGetFrame(const AVSMap*, const char*, int, int*) { unsupported("propGetFrame"); }
+const int64_t* __stdcall MockEnvironment::propGetIntArray(const AVSMap*, const char*, int*) { unsupported("propGetIntArray"); }
+const double* __stdcall MockEnvironment::propGetFloatArray(const AVSMap*, const char*, int*) { unsupported("propGetFloatArray"); }
+void* __stdcall MockEnvironment::Allocate(size_t, size_t, AvsAllocType) { unsupported("Allocate"); }
+void __stdcall MockEnvironment::Free(void*) { unsupported("Free"); }
+AVSValue __stdcall MockEnvironment::Invoke3(const AVSValue&, const PFunction&, const AVSValue, const char* const*) { unsupported("Invoke3"); }
+bool __stdcall MockEnvironment::Invoke3Try(AVSValue*, const AVSValue&, const PFunction&, const AVSValue, const char* const*) { unsupported("Invoke3Try"); }
+
+// ------------------------ SoxFilter ------------------------------
+
+// The named parameters of the AddFunction call of AvisynthPluginInit3, in order:
+// "cs+[checkpoint]f[preroll]f..." the clip is #0, the effects #1, these from #2
+static const struct { const char* name; char type; } soxfilter_params[] = {
+  { "checkpoint", 'f' }, { "preroll", 'f' }, { "spare", 'b' }, { "prefetch", 'f' }, { "lookahead", 'f' },
+  { "pipeline", 'i' }, { "threads", 'i' }, { "segment", 'f' }, { "nativefloat", 'b' }, { "biquad", 'b' },
+  { "fftconv", 'i' }, { "stats", 'f' }, { "statslog", 's' }, { "trace", 's' }, { "segmentthreads", 'i' }
+};
+static const int SOXFILTER_ARGS = 2 + (int)(sizeof(soxfilter_params) / sizeof(soxfilter_params[0]));
+
+int soxfilter_param_index(const std::string& name)
+{
+  for (int i = 0; i < SOXFILTER_ARGS - 2; i++)
+    if (name == soxfilter_params[i].name)
+      return i + 2;
+  return -1;
+}
+
+PClip create_soxfilter(const PClip& clip, const std::vector<std::string>& effects,
+  const std::vector<std::string>& params, IScriptEnvironment* env)
+{
+  std::vector<AVSValue> effect_args;
+  for (const auto& effect : effects)
+    effect_args.push_back(env->SaveString(effect.c_str()));
+
+  std::vector<AVSValue> args(SOXFILTER_ARGS);
+  args[0] = clip;
+  args[1] = AVSValue(effect_args.data(), (int)effect_args.size());
+  for (const auto& param : params) {
+    const size_t eq = param.find('=');
+    const int index = soxfilter_param_index(param.substr(0, eq));
+    if (eq == std::string::npos || index < 0)
+      env->ThrowError("mock host: unknown SoxFilter parameter '%s'", param.c_str());
+    const char* value = param.c_str() + eq + 1;
+    switch (soxfilter_params[index - 2].type) {
+    case 'f': args[index] = AVSValue(atof(value)); break;
+    case 'i': args[index] = AVSValue(atoi(value)); break;
+    case 'b': args[index] = AVSValue(!strcmp(value, "true") || !strcmp(value, "1")); break;
+    default: args[index] = AVSValue(env->SaveString(value)); break;
+    }
+  }
+  return Create_SoxFilter(AVSValue(args.data(), SOXFILTER_ARGS), nullptr, env).AsClip();
+}
@@ -0,0 +1,172 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Mock Avisynth host for the benchmark programs: runs SoxFilter without Avisynth
+ *
+ * The programs are built with AVS_STATIC_LIB, so that the AVSValue, PClip and VideoInfo
+ * methods of avisynth.h are plain functions, defined in mock_host.cpp like the Avisynth core
+ * does, instead of calls through the AVS_Linkage table of the host.
+ * The environment knows two functions, the ones Create_SoxFilter invokes:
+ * ConvertAudio (to 32 bit integer) and EnsureVBRMp3Sync, which makes the requests
+ * linear the way Avisynth+ does. There is no audio cache between the filters.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __SOXFILTER_MOCK_HOST_H__
+#define __SOXFILTER_MOCK_HOST_H__
+
+#include <avisynth.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+enum source_signal_t {
+  SIGNAL_NOISE, // white, uniform
+  SIGNAL_SWEEP, // logarithmic sine sweep from 20 Hz to 90% of the Nyquist frequency
+  SIGNAL_SINE   // 997 Hz
+};
+
+// Every channel has its own signal: the noise its own seed, the sweeps and sines a phase
+// shift and a level of -6 dBFS less 1 dB per channel, so that swapped channels show.
+typedef struct source_format_t {
+  source_signal_t signal;
+  int sample_type; // SAMPLE_INT8 .. SAMPLE_FLOAT
+  int rate;
+  int channels;
+  int64_t frames;
+  uint32_t seed;
+} source_format_t;
+
+// "noise", "sweep", "sine"; false for an unknown name
+bool parse_signal(const char* name, source_signal_t& signal);
+// "int8", "int16", "int24", "int32", "float"; false for an unknown name
+bool parse_sample_type(const char* name, int& sample_type);
+const char* sample_type_name(int sample_type);
+
+// Synthetic audio clip, rendered at creation: the same samples at any position and
+// in any request order, requests are a copy. Outside of the clip it gives silence.
+class MockAudioSource : public IClip {
+private:
+  VideoInfo vi;
+  std::vector<uint8_t> samples;
+  std::atomic<int64_t> frames_read; // by the filter, the work of its input
+
+public:
+  explicit MockAudioSource(const source_format_t& format);
+
+  int64_t read_frames() const { return frames_read.load(); }
+
+  PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env) override;
+  bool __stdcall GetParity(int n) override { return false; }
+  void __stdcall GetAudio(void* buf, int64_t start, int64_t count, IScriptEnvironment* env) override;
+  int __stdcall SetCacheHints(int cachehints, int frame_range) override { return 0; }
+  const VideoInfo& __stdcall GetVideoInfo() override { return vi; }
+};
+
+// The CPUF_* flags of avs/cpuid.h of the running CPU, up to an instruction set:
+// "c" (none), "sse2", "avx2", "avx512" or "" (all of them)
+int mock_cpu_flags(const std::string& max_isa);
+
+class MockEnvironment : public IScriptEnvironment {
+private:
+  int cpu_flags;
+  std::deque<std::string> strings;
+  int invokes_sync; // EnsureVBRMp3Sync, to tell whether the host makes the requests linear
+
+public:
+  explicit MockEnvironment(int _cpu_flags) : cpu_flags(_cpu_flags), invokes_sync(0) {}
+
+  int sync_invocations() const { return invokes_sync; }
+
+  int __stdcall GetCPUFlags() override { return cpu_flags; }
+  char* __stdcall SaveString(const char* s, int length = -1) override;
+  char* Sprintf(const char* fmt, ...) override;
+  char* __stdcall VSprintf(const char* fmt, va_list val) override;
+  void ThrowError(const char* fmt, ...) override;
+  void __stdcall AddFunction(const char* name, const char* params, ApplyFunc apply, void* user_data) override {}
+  bool __stdcall FunctionExists(const char* name) override;
+  AVSValue __stdcall Invoke(const char* name, const AVSValue args, const char* const* arg_names = 0) override;
+  AVSValue __stdcall GetVar(const char* name) override { throw NotFound(); }
+  bool __stdcall SetVar(const char* name, const AVSValue& val) override { return false; }
+  bool __stdcall SetGlobalVar(const char* name, const AVSValue& val) override { return false; }
+  void __stdcall PushContext(int level = 0) override {}
+  void __stdcall PopContext() override {}
+  PVideoFrame __stdcall NewVideoFrame(const VideoInfo& vi, int align = FRAME_ALIGN) override;
+  bool __stdcall MakeWritable(PVideoFrame* pvf) override;
+  void __stdcall BitBlt(BYTE* dstp, int dst_pitch, const BYTE* srcp, int src_pitch, int row_size, int height) override;
+  void __stdcall AtExit(ShutdownFunc function, void* user_data) override {}
+  void __stdcall CheckVersion(int version = AVISYNTH_INTERFACE_VERSION) override;
+  PVideoFrame __stdcall Subframe(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size, int new_height) override;
+  int __stdcall SetMemoryMax(int mem) override { return 0; }
+  int __stdcall SetWorkingDir(const char* newdir) override { return -1; }
+  void* __stdcall ManageCache(int key, void* data) override { return nullptr; }
+  bool __stdcall PlanarChromaAlignment(PlanarChromaAlignmentMode key) override { return false; }
+  PVideoFrame __stdcall SubframePlanar(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+    int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV) override;
+  void __stdcall DeleteScriptEnvironment() override {}
+  void __stdcall ApplyMessage(PVideoFrame* frame, const VideoInfo& vi, const char* message, int size,
+    int textcolor, int halocolor, int bgcolor) override {}
+  const AVS_Linkage* __stdcall GetAVSLinkage() override { return nullptr; }
+  AVSValue __stdcall GetVarDef(const char* name, const AVSValue& def = AVSValue()) override { return def; }
+  PVideoFrame __stdcall SubframePlanarA(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+    int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA) override;
+  void __stdcall copyFrameProps(const PVideoFrame& src, PVideoFrame& dst) override {}
+  const AVSMap* __stdcall getFramePropsRO(const PVideoFrame& frame) override { return nullptr; }
+  AVSMap* __stdcall getFramePropsRW(PVideoFrame& frame) override { return nullptr; }
+  int __stdcall propNumKeys(const AVSMap* map) override { return 0; }
+  const char* __stdcall propGetKey(const AVSMap* map, int index) override { return nullptr; }
+  int __stdcall propNumElements(const AVSMap* map, const char* key) override { return -1; }
+  char __stdcall propGetType(const AVSMap* map, const char* key) override { return PROPTYPE_UNSET; }
+  int64_t __stdcall propGetInt(const AVSMap* map, const char* key, int index, int* error) override;
+  double __stdcall propGetFloat(const AVSMap* map, const char* key, int index, int* error) override;
+  const char* __stdcall propGetData(const AVSMap* map, const char* key, int index, int* error) override;
+  int __stdcall propGetDataSize(const AVSMap* map, const char* key, int index, int* error) override;
+  PClip __stdcall propGetClip(const AVSMap* map, const char* key, int index, int* error) override;
+  const PVideoFrame __stdcall propGetFrame(const AVSMap* map, const char* key, int index, int* error) override;
+  int __stdcall propDeleteKey(AVSMap* map, const char* key) override { return 0; }
+  int __stdcall propSetInt(AVSMap* map, const char* key, int64_t i, int append) override { return 1; }
+  int __stdcall propSetFloat(AVSMap* map, const char* key, double d, int append) override { return 1; }
+  int __stdcall propSetData(AVSMap* map, const char* key, const char* d, int length, int append) override { return 1; }
+  int __stdcall propSetClip(AVSMap* map, const char* key, PClip& clip, int append) override { return 1; }
+  int __stdcall propSetFrame(AVSMap* map, const char* key, const PVideoFrame& frame, int append) override { return 1; }
+  const int64_t* __stdcall propGetIntArray(const AVSMap* map, const char* key, int* error) override;
+  const double* __stdcall propGetFloatArray(const AVSMap* map, const char* key, int* error) override;
+  int __stdcall propSetIntArray(AVSMap* map, const char* key, const int64_t* i, int size) override { return 1; }
+  int __stdcall propSetFloatArray(AVSMap* map, const char* key, const double* d, int size) override { return 1; }
+  AVSMap* __stdcall createMap() override { return nullptr; }
+  void __stdcall freeMap(AVSMap* map) override {}
+  void __stdcall clearMap(AVSMap* map) override {}
+  PVideoFrame __stdcall NewVideoFrameP(const VideoInfo& vi, const PVideoFrame* prop_src, int align = FRAME_ALIGN) override;
+  size_t __stdcall GetEnvProperty(AvsEnvProperty prop) override;
+  void* __stdcall Allocate(size_t nBytes, size_t alignment, AvsAllocType type) override;
+  void __stdcall Free(void* ptr) override;
+  bool __stdcall GetVarTry(const char* name, AVSValue* val) const override { return false; }
+  bool __stdcall GetVarBool(const char* name, bool def) const override { return def; }
+  int __stdcall GetVarInt(const char* name, int def) const override { return def; }
+  double __stdcall GetVarDouble(const char* name, double def) const override { return def; }
+  const char* __stdcall GetVarString(const char* name, const char* def) const override { return def; }
+  int64_t __stdcall GetVarLong(const char* name, int64_t def) const override { return def; }
+  bool __stdcall InvokeTry(AVSValue* result, const char* name, const AVSValue& args, const char* const* arg_names = 0) override;
+  AVSValue __stdcall Invoke2(const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names = 0) override;
+  bool __stdcall Invoke2Try(AVSValue* result, const AVSValue& implicit_last, const char* name, const AVSValue args, const char* const* arg_names = 0) override;
+  AVSValue __stdcall Invoke3(const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names = 0) override;
+  bool __stdcall Invoke3Try(AVSValue* result, const AVSValue& implicit_last, const PFunction& func, const AVSValue args, const char* const* arg_names = 0) override;
+  bool __stdcall MakePropertyWritable(PVideoFrame* pvf) override { return false; }
+};
+
+// SoxFilter's parameters, by name as in the script: "preroll=0.5", "spare=true", "statslog=x.log";
+// the effects are given apart. The index of each in the argument array of Create_SoxFilter.
+int soxfilter_param_index(const std::string& name);
+
+// Creates SoxFilter(clip, effects..., params...) the way the script would,
+// through Create_SoxFilter: errors are thrown as AvisynthError.
+PClip create_soxfilter(const PClip& clip, const std::vector<std::string>& effects,
+  const std::vector<std::string>& params, IScriptEnvironment* env);
+
+#endif // __SOXFILTER_MOCK_HOST_H__
@@ -0,0 +1,195 @@
+/*
+ * SoxFilter plugin for AviSynth
+ *
+ * Quality and speed table of the polyphase resampler (resample.h)
+ *
+ * Each quality preset converts 44.1 kHz to 48 kHz and back, stereo.
+ * Quality is measured on sine waves of half full scale, against the exact sine at the
+ * output rate: the signal to error ratio at 997 Hz and at 98% of the passband of the preset
+ * (passband ripple, images, float noise), and for downsampling the level left of a sine
+ * at 105% of the output Nyquist frequency (aliasing), relative to its input level.
+ * The vector versions must give the output of the C one within 1e-6 of full scale.
+ * Speed is input frames per second of two seconds of noise, fed in libsox sized buffers.
+ * When built with libsox (SOXFILTER_BENCH_LIBSOX), its rate effect is measured the same way,
+ * with the same quality option: l, m, h and v are designed to libsox' bandwidth and rejection,
+ * libsox' q is cubic interpolation (about 30 dB) against the 60 dB sinc of the q preset.
+ * Instruction sets the CPU does not support must be skipped: --isa c,avx2,avx512
+ * Output is one line per case: isa quality in_rate out_rate taps snr_1k_dB snr_hi_dB alias_dB Mframes/s
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "resample.h"
+#include "bench_util.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <functional>
+
+static const size_t CHANNELS = 2;
+static const int REPEAT = 5;
+// the effects get at most one libsox buffer at once
+static const size_t BLOCK_SAMPLES = 8192;
+static const double MAX_ERROR = 1e-6;
+static const double PI = 3.14159265358979323846;
+
+typedef std::function<std::vector<sample32_t>(const std::vector<sample32_t>& in)> resample_fn;
+
+static std::vector<sample32_t> sine(double frequency, double rate, size_t frames)
+{
+  std::vector<sample32_t> v(frames * CHANNELS);
+  for (size_t i = 0; i < frames; i++)
+    for (size_t c = 0; c < CHANNELS; c++)
+      v[i * CHANNELS + c] = (sample32_t)lrint(0.5 * 2147483647.0 * sin(2 * PI * frequency * i / rate));
+  return v;
+}
+
+// error of the output against the exact sine (or silence), in dB below the input level;
+// a tenth of a second at both ends is left out, the filter starts and ends on silence
+static double error_db(const std::vector<sample32_t>& out, double frequency, double rate, bool silent)
+{
+  const size_t frames = out.size() / CHANNELS, edge = (size_t)(rate / 10);
+  double error = 0, signal = 0;
+  for (size_t i = edge; i + edge < frames; i++) {
+    const double expected = silent ? 0.0 : 0.5 * 2147483647.0 * sin(2 * PI * frequency * i / rate);
+    for (size_t c = 0; c < CHANNELS; c++) {
+      const double d = out[i * CHANNELS + c] - expected;
+      error += d * d;
+      signal += 0.25 * 2147483647.0 * 2147483647.0 / 2;
+    }
+  }
+  return error > 0 ? 10 * log10(signal / error) : 999.0;
+}
+
+typedef struct quality_result_t {
+  double snr_1k;
+  double snr_hi;
+  double alias; // 0 when upsampling
+} quality_result_t;
+
+static quality_result_t measure_quality(const resample_fn& resample, double in_rate, double out_rate, double passband)
+{
+  const double nyquist = std::min(in_rate, out_rate) / 2;
+  const double high = 0.98 * passband * nyquist;
+  const size_t frames = (size_t)in_rate;
+  quality_result_t result;
+  result.snr_1k = error_db(resample(sine(997, in_rate, frames)), 997, out_rate, false);
+  result.snr_hi = error_db(resample(sine(high, in_rate, frames)), high, out_rate, false);
+  result.alias = out_rate < in_rate ? error_db(resample(sine(1.05 * nyquist, in_rate, frames)), 0, out_rate, true) : 0;
+  return result;
+}
+
+static double measure_speed(const resample_fn& resample, const std::vector<sample32_t>& in)
+{
+  return measure([&] { resample(in); }, REPEAT, (double)(in.size() / CHANNELS));
+}
+
+static std::vector<sample32_t> run_resampler(PolyphaseResampler& resampler, const std::vector<sample32_t>& in)
+{
+  uint64_t clips = 0;
+  const size_t block_frames = BLOCK_SAMPLES / CHANNELS;
+  const size_t frames = in.size() / CHANNELS;
+  std::vector<sample32_t> out, buffer(BLOCK_SAMPLES);
+  resampler.reset();
+  for (size_t f = 0; f < frames; f += block_frames) {
+    resampler.write(&in[f * CHANNELS], std::min(block_frames, frames - f));
+    size_t n;
+    while ((n = resampler.read(buffer.data(), block_frames, clips)) > 0)
+      out.insert(out.end(), buffer.begin(), buffer.begin() + n * CHANNELS);
+  }
+  resampler.flush();
+  size_t n;
+  while ((n = resampler.read(buffer.data(), block_frames, clips)) > 0)
+    out.insert(out.end(), buffer.begin(), buffer.begin() + n * CHANNELS);
+  return out;
+}
+
+static void print_row(const char* isa, char quality, double in_rate, double out_rate, const char* taps, const quality_result_t& q, double speed)
+{
+  char alias[32] = "-";
+  if (q.alias)
+    snprintf(alias, sizeof(alias), "%.1f", q.alias);
+  printf("%s %c %d %d %s %.1f %.1f %s %.1f\n", isa, quality, (int)in_rate, (int)out_rate, taps, q.snr_1k, q.snr_hi, alias, speed);
+}
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+static std::vector<sample32_t> run_libsox(char quality, double in_rate, double out_rate, const std::vector<sample32_t>& in)
+{
+  char flag[] = { '-', quality, 0 };
+  char rate[32];
+  snprintf(rate, sizeof(rate), "%d", (int)out_rate);
+  char* args[] = { flag, rate };
+  return run_libsox_effect("rate", 2, args, in_rate, CHANNELS, out_rate, in);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+  const std::string isas = parse_isa_option(argc, argv, "c,avx2,avx512");
+
+  static const struct { const char* name; resample_isa_t isa; } all[] = {
+    { "c", RESAMPLE_C }, { "avx2", RESAMPLE_AVX2 }, { "avx512", RESAMPLE_AVX512 }
+  };
+  static const char qualities[] = { 'q', 'l', 'm', 'h', 'v' };
+  static const double rates[][2] = { { 44100, 48000 }, { 48000, 44100 } };
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+  sox_init();
+#endif
+
+  int errors = 0;
+  for (const auto& rate : rates) {
+    const double in_rate = rate[0], out_rate = rate[1];
+    std::vector<sample32_t> in((size_t)in_rate * 2 * CHANNELS);
+    for (auto& v : in)
+      v = (sample32_t)noise() / 2;
+    size_t up, down;
+    get_resample_ratio(in_rate, out_rate, 4096, up, down);
+
+    for (char flag : qualities) {
+      const resample_quality_t& quality = *get_resample_quality(flag);
+      const std::shared_ptr<const poly_filter_t> filter = make_poly_filter(up, down, quality);
+      const std::string taps = std::to_string(filter->taps);
+      PolyphaseResampler reference(filter, CHANNELS, get_resample_kernels_isa(RESAMPLE_C));
+      const std::vector<sample32_t> expected = run_resampler(reference, in);
+
+      for (const auto& entry : all) {
+        if (!isa_selected(isas, entry.name))
+          continue;
+        const resample_kernels_t* kernels = get_resample_kernels_isa(entry.isa);
+        if (!kernels)
+          continue;
+
+        PolyphaseResampler resampler(filter, CHANNELS, kernels);
+        const resample_fn resample = [&](const std::vector<sample32_t>& v) { return run_resampler(resampler, v); };
+        const std::vector<sample32_t> out = resample(in);
+        double max_error = out.size() == expected.size() ? 0 : 1;
+        for (size_t i = 0; i < out.size() && i < expected.size(); i++)
+          max_error = std::max(max_error, fabs((double)out[i] - expected[i]) / 2147483648.0);
+        if (max_error > MAX_ERROR) {
+          printf("%s: %c %d to %d: MISMATCH (max error %.3g of full scale)\n", kernels->name, flag, (int)in_rate, (int)out_rate, max_error);
+          errors++;
+          continue;
+        }
+        print_row(kernels->name, flag, in_rate, out_rate, taps.c_str(), measure_quality(resample, in_rate, out_rate, quality.passband), measure_speed(resample, in));
+      }
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+      if (!sox_find_effect("rate"))
+        continue;
+      const resample_fn resample = [&](const std::vector<sample32_t>& v) { return run_libsox(flag, in_rate, out_rate, v); };
+      print_row("libsox", flag, in_rate, out_rate, "-", measure_quality(resample, in_rate, out_rate, quality.passband), measure_speed(resample, in));
+#endif
+    }
+  }
+
+#ifdef SOXFILTER_BENCH_LIBSOX
+  sox_quit();
+#endif
+  return errors ? 1 : 0;
+}